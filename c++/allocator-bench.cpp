@@ -0,0 +1,288 @@
+/* allocator-bench.cpp
+   Copyright (C) 2018 Eric Herman <eric@freesa.org>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as
+   published by the Free Software Foundation, either version 3 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+	https://www.gnu.org/licenses/lgpl-3.0.txt
+	https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+/*
+The same container workloads with std::allocator and with each flavor
+of the Tracking_allocator of map-of-str-to-ptrlist.cpp
+
+Each workload and backend pair runs in a child process of its own, so
+the peak RSS is its own, and prints one JSON object per line:
+
+{"workload":"list_push_sort","backend":"tracking-pool-cache",
+ "n":1000000,"ops":1000000,"seconds":0.21,"ops_per_sec":4.7e+06,
+ "allocs_per_op":1.00,"peak_rss_kb":33000}
+
+The allocations of std::allocator are counted by replacing the global
+operator new, those of Tracking_allocator by its own counters.
+
+g++ -std=c++20 -Wall -O2 -DNDEBUG -pthread \
+	-o allocator-bench allocator-bench.cpp
+./allocator-bench [n] [workload] [backend] > results.jsonl
+*/
+
+#define MAP_OF_STR_TO_PTRLIST_LIB 1
+#include "map-of-str-to-ptrlist.cpp"
+
+#include <new>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+static atomic<unsigned long long> operator_new_count(0);
+
+void *operator new(size_t size)
+{
+	operator_new_count.fetch_add(1, memory_order_relaxed);
+	void *ptr= malloc(size ? size : 1);
+	if (!ptr) {
+		throw bad_alloc();
+	}
+	return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete(void *ptr, size_t size) noexcept
+{
+	(void)size;
+	free(ptr);
+}
+
+static double now_seconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + (ts.tv_nsec / 1000000000.0);
+}
+
+/* a cheap deterministic generator, the same for every backend */
+static unsigned long next_random(unsigned long *seed)
+{
+	*seed= (*seed * 6364136223846793005UL) + 1442695040888963407UL;
+	return *seed >> 33;
+}
+
+
+/* how each backend makes its allocators */
+struct Std_backend {
+	template <class T> using alloc= allocator<T>;
+
+	template <class T> static alloc<T> make() { return alloc<T>(); }
+};
+
+struct Tracking_backend_allocators {
+	template <class T> using alloc= Tracking_allocator<T>;
+
+	template <class T> static alloc<T> make()
+	{
+		return alloc<T>(memory_key_e);
+	}
+};
+
+
+/* unordered_map<string, list> with four values per name, torn down */
+template <class B>
+static size_t map_build_teardown(size_t n)
+{
+	typedef typename B::template alloc<char> Char_alloc;
+	typedef basic_string<char, char_traits<char>, Char_alloc> String;
+	typedef list<unsigned long, typename B::template alloc<unsigned long>>
+			List;
+	typedef scoped_allocator_adaptor<
+			typename B::template alloc<pair<const String, List>>>
+			Map_alloc;
+	/* std::hash only knows strings with std::allocator */
+	typedef unordered_map<String, List, Name_hash, equal_to<>,
+			      Map_alloc> Map;
+
+	Map_alloc map_alloc(B::template make<pair<const String, List>>());
+	Map *map= new Map(map_alloc);
+	char name[64];
+	for (size_t i= 0; i < n; ++i) {
+		/* longer than any small string buffer */
+		snprintf(name, sizeof(name), "user-with-a-long-name-%zu", i / 4);
+		String key(name, B::template make<char>());
+		(*map)[key].push_back(i);
+	}
+	delete map;
+	return n;
+}
+
+
+template <class B>
+static size_t list_push_sort(size_t n)
+{
+	typedef list<unsigned long, typename B::template alloc<unsigned long>>
+			List;
+
+	List values(B::template make<unsigned long>());
+	unsigned long seed= 1;
+	for (size_t i= 0; i < n; ++i) {
+		values.push_back(next_random(&seed));
+	}
+	values.sort();
+	return n;
+}
+
+
+/* n pushes, then n erases in a random order */
+template <class B>
+static size_t list_random_erase(size_t n)
+{
+	typedef list<unsigned long, typename B::template alloc<unsigned long>>
+			List;
+	typedef typename List::iterator Iterator;
+	typedef vector<Iterator, typename B::template alloc<Iterator>>
+			Iterators;
+
+	List values(B::template make<unsigned long>());
+	Iterators positions(B::template make<Iterator>());
+	positions.reserve(n);
+	for (size_t i= 0; i < n; ++i) {
+		positions.push_back(values.insert(values.end(), i));
+	}
+	unsigned long seed= 1;
+	for (size_t i= n; i > 1; --i) {
+		swap(positions[i - 1], positions[next_random(&seed) % i]);
+	}
+	for (size_t i= 0; i < n; ++i) {
+		values.erase(positions[i]);
+	}
+	return 2 * n;
+}
+
+
+struct Workload {
+	const char *name;
+	size_t (*with_std)(size_t n);
+	size_t (*with_tracking)(size_t n);
+};
+
+static const Workload workloads[]= {
+	{ "map_build_teardown", map_build_teardown<Std_backend>,
+	  map_build_teardown<Tracking_backend_allocators> },
+	{ "list_push_sort", list_push_sort<Std_backend>,
+	  list_push_sort<Tracking_backend_allocators> },
+	{ "list_random_erase", list_random_erase<Std_backend>,
+	  list_random_erase<Tracking_backend_allocators> },
+};
+
+struct Backend {
+	const char *name;
+	int tracking;
+	enum Tracking_backend tracking_backend;
+	int thread_cache;
+};
+
+static const Backend backends[]= {
+	{ "std", 0, TRACKING_BACKEND_MALLOC, 0 },
+	{ "tracking-malloc", 1, TRACKING_BACKEND_MALLOC, 0 },
+	{ "tracking-malloc-cache", 1, TRACKING_BACKEND_MALLOC, 1 },
+	{ "tracking-pool", 1, TRACKING_BACKEND_POOL, 0 },
+	{ "tracking-pool-cache", 1, TRACKING_BACKEND_POOL, 1 },
+};
+
+#define Array_len(a) (sizeof(a) / sizeof((a)[0]))
+
+
+static void run_workload(const Workload *workload, const Backend *backend,
+			 size_t n)
+{
+	struct Tracking_key_stats before, after;
+
+	tracking_thread_cache= backend->thread_cache;
+	if (tracking_set_backend(memory_key_e, backend->tracking_backend)) {
+		exit(EXIT_FAILURE);
+	}
+
+	tracking_snapshot(memory_key_e, &before);
+	unsigned long long news= operator_new_count.load();
+	double start= now_seconds();
+	size_t ops= backend->tracking ? workload->with_tracking(n)
+	    : workload->with_std(n);
+	double seconds= now_seconds() - start;
+	news= operator_new_count.load() - news;
+	tracking_snapshot(memory_key_e, &after);
+
+	unsigned long long allocs= backend->tracking ?
+	    (after.alloc_count - before.alloc_count) : news;
+	if (after.bytes_live != before.bytes_live) {
+		fprintf(stderr, "%s %s leaked %lld bytes\n", workload->name,
+			backend->name, after.bytes_live - before.bytes_live);
+		exit(EXIT_FAILURE);
+	}
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	printf("{\"workload\":\"%s\",\"backend\":\"%s\",\"n\":%zu,"
+	       "\"ops\":%zu,\"seconds\":%.6f,\"ops_per_sec\":%.6g,"
+	       "\"allocs_per_op\":%.4f,\"peak_rss_kb\":%ld}\n",
+	       workload->name, backend->name, n, ops, seconds, ops / seconds,
+	       (double)allocs / ops, usage.ru_maxrss);
+	fflush(stdout);
+}
+
+
+static int run_in_child(const Workload *workload, const Backend *backend,
+			size_t n)
+{
+	fflush(stdout);
+	pid_t pid= fork();
+	if (pid < 0) {
+		perror("fork");
+		return 1;
+	}
+	if (pid == 0) {
+		run_workload(workload, backend, n);
+		_exit(EXIT_SUCCESS);
+	}
+	int status;
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)
+	    || WEXITSTATUS(status)) {
+		fprintf(stderr, "%s %s failed\n", workload->name,
+			backend->name);
+		return 1;
+	}
+	return 0;
+}
+
+
+int main(int argc, char **argv)
+{
+	size_t n= (argc > 1) ? strtoul(argv[1], NULL, 10) : 1000000;
+	const char *only_workload= (argc > 2) ? argv[2] : NULL;
+	const char *only_backend= (argc > 3) ? argv[3] : NULL;
+	int failures= 0;
+
+	load_mem_tracking_keys();
+
+	for (size_t i= 0; i < Array_len(workloads); ++i) {
+		if (only_workload && strcmp(only_workload, "all")
+		    && strcmp(only_workload, workloads[i].name)) {
+			continue;
+		}
+		for (size_t j= 0; j < Array_len(backends); ++j) {
+			if (only_backend
+			    && strcmp(only_backend, backends[j].name)) {
+				continue;
+			}
+			failures+= run_in_child(&workloads[i], &backends[j], n);
+		}
+	}
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,598 @@
+/* map-of-str-to-ptrlist-bench.cpp
+   Copyright (C) 2018 Eric Herman <eric@freesa.org>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as
+   published by the Free Software Foundation, either version 3 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+	https://www.gnu.org/licenses/lgpl-3.0.txt
+	https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+/*
+Timing the Tracking_allocator backends of map-of-str-to-ptrlist.cpp
+
+Each backend is run in a child process, so that the peak RSS reported
+belongs to that backend alone. The churn benchmark compares 1, 8 and 32
+threads, with and without the per-thread cache. The sampling benchmark
+times the tracked malloc/free pair against an untracked one; build with
+-DTRACKING_NO_SAMPLING as well to see what the sampling check costs.
+
+g++ -std=c++20 -Wall -O2 -DNDEBUG -pthread \
+	-o map-of-str-to-ptrlist-bench map-of-str-to-ptrlist-bench.cpp
+./map-of-str-to-ptrlist-bench [count]
+*/
+
+#define MAP_OF_STR_TO_PTRLIST_LIB 1
+#include "map-of-str-to-ptrlist.cpp"
+
+#include <map>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now_seconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + (ts.tv_nsec / 1000000000.0);
+}
+
+static long current_rss_kb(void)
+{
+	long pages= 0;
+	FILE *statm= fopen("/proc/self/statm", "r");
+	if (!statm) {
+		return -1;
+	}
+	if (fscanf(statm, "%*s %ld", &pages) != 1) {
+		pages= -1;
+	}
+	fclose(statm);
+	return pages < 0 ? -1 : (pages * (sysconf(_SC_PAGESIZE) / 1024));
+}
+
+static const char *backend_name(enum Tracking_backend backend)
+{
+	return backend == TRACKING_BACKEND_POOL ? "pool" : "malloc";
+}
+
+typedef Tracking_allocator<pair<const unsigned long, unsigned long>>
+		Ulong_pair_allocator;
+typedef unordered_map<unsigned long, unsigned long, hash<unsigned long>,
+		equal_to<unsigned long>, Ulong_pair_allocator> Ulong_map;
+
+struct Bench_args {
+	enum Tracking_backend backend;
+	size_t count;
+	unsigned threads;
+	int thread_cache;
+};
+
+static void bench_unordered_map(const Bench_args *args)
+{
+	enum Tracking_backend backend= args->backend;
+	size_t count= args->count;
+	Tracking_memory_key key= memory_key_e;
+	if (tracking_set_backend(key, backend)) {
+		fprintf(stderr, "could not set backend %s\n",
+			backend_name(backend));
+		exit(EXIT_FAILURE);
+	}
+
+	long rss_before= current_rss_kb();
+	Ulong_map *map= new Ulong_map(Ulong_pair_allocator(key));
+
+	double start= now_seconds();
+	for (size_t i= 0; i < count; ++i) {
+		(*map)[i * 2654435761UL]= i;
+	}
+	double insert_seconds= now_seconds() - start;
+	long rss_full= current_rss_kb();
+
+	start= now_seconds();
+	for (size_t i= 0; i < count; ++i) {
+		map->erase(i * 2654435761UL);
+	}
+	double erase_seconds= now_seconds() - start;
+
+	delete map;
+
+	struct Tracking_key_stats stats;
+	tracking_snapshot(key, &stats);
+	printf("%-6s insert: %8.2f Mops/s  erase: %8.2f Mops/s"
+	       "  rss growth: %7ld kB  allocs: %llu  leaked: %lld\n",
+	       backend_name(backend), (count / insert_seconds) / 1e6,
+	       (count / erase_seconds) / 1e6, rss_full - rss_before,
+	       stats.alloc_count, stats.bytes_live);
+	fflush(stdout);
+}
+
+/* the name_to_users map as it was, with a list per name, for comparison */
+typedef list<Host_user *, Host_user_ptr_allocator> Host_user_ptr_list;
+typedef Tracking_allocator<pair<const string, Host_user_ptr_list>>
+		Name_hu_list_pair_allocator;
+typedef scoped_allocator_adaptor<Name_hu_list_pair_allocator,
+		Host_user_ptr_allocator> Name_to_user_list_allocator;
+typedef unordered_map<string, Host_user_ptr_list, hash<string>,
+		equal_to<string>, Name_to_user_list_allocator>
+		Name_to_user_list_map;
+
+/* 1 to 4 users per name, more often fewer */
+static void make_all_users(size_t count)
+{
+	char id[40];
+	char host[40];
+	size_t size= (count + 1) * sizeof(Host_user *);
+	all_users= (Host_user **)tracking_malloc(memory_key_a, size);
+	for (size_t i= 0, name= 0; i < count; ++name) {
+		size_t per_name= 1 + ((name * 7) % 10) / 4;
+		for (size_t j= 0; j < per_name && i < count; ++j, ++i) {
+			snprintf(id, sizeof(id), "user%zu", name);
+			snprintf(host, sizeof(host), "10.%zu.%zu.%zu",
+				 (i >> 16) & 0xFF, (i >> 8) & 0xFF, i & 0xFF);
+			all_users[i]= new(tracking_malloc(memory_key_b,
+							  sizeof(Host_user)))
+			    Host_user(id, host);
+		}
+	}
+	all_users[count]= nullptr;
+	all_users_len= count;
+}
+
+template <class Map>
+static size_t iterate_name_to_users(const Map &map)
+{
+	size_t sum= 0;
+	for (auto it= map.begin(); it != map.end(); ++it) {
+		for (auto it2= it->second.begin(); it2 != it->second.end();
+		     ++it2) {
+			sum+= (uintptr_t)(*it2);
+		}
+	}
+	return sum;
+}
+
+static void bench_name_to_users(const Bench_args *args)
+{
+	enum Tracking_backend backend= args->backend;
+	size_t count= args->count;
+	if (tracking_set_backend(memory_key_d, backend)) {
+		exit(EXIT_FAILURE);
+	}
+	make_all_users(count);
+
+	double start= now_seconds();
+	Name_hu_list_pair_allocator outer(memory_key_d);
+	Host_user_ptr_allocator inner(memory_key_d);
+	Name_to_user_list_map *lists=
+	    new Name_to_user_list_map(Name_to_user_list_allocator(outer,
+								  inner));
+	for (size_t i= 0; all_users[i]; ++i) {
+		(*lists)[all_users[i]->id].push_back(all_users[i]);
+	}
+	for (auto it= lists->begin(); it != lists->end(); ++it) {
+		it->second.sort(Host_user_compare());
+	}
+	double list_build= now_seconds() - start;
+
+	start= now_seconds();
+	size_t list_sum= iterate_name_to_users(*lists);
+	double list_iterate= now_seconds() - start;
+	delete lists;
+
+	start= now_seconds();
+	build_name_to_users();
+	double vector_build= now_seconds() - start;
+
+	start= now_seconds();
+	size_t vector_sum= iterate_name_to_users(*name_to_users);
+	double vector_iterate= now_seconds() - start;
+
+	if (list_sum != vector_sum) {
+		fprintf(stderr, "sums differ: %zu != %zu\n", list_sum,
+			vector_sum);
+		exit(EXIT_FAILURE);
+	}
+	printf("%-6s std::list     build: %7.3f s  iterate: %7.3f s"
+	       " (build includes list::sort)\n",
+	       backend_name(backend), list_build, list_iterate);
+	printf("%-6s Small_vector  build: %7.3f s  iterate: %7.3f s"
+	       " (build includes std::sort and publishing)\n",
+	       backend_name(backend), vector_build, vector_iterate);
+	fflush(stdout);
+
+	clear_all_users();
+}
+
+/* each thread builds and tears down small maps of lists, so nearly
+   every allocation is soon freed by the same thread */
+typedef Tracking_allocator<unsigned long> Ulong_allocator;
+typedef list<unsigned long, Ulong_allocator> Ulong_list;
+typedef Tracking_allocator<pair<const unsigned long, Ulong_list>>
+		Ulong_list_pair_allocator;
+typedef scoped_allocator_adaptor<Ulong_list_pair_allocator, Ulong_allocator>
+		Ulong_to_list_allocator;
+typedef map<unsigned long, Ulong_list, less<unsigned long>,
+		Ulong_to_list_allocator> Ulong_to_list_map;
+
+static void churn(size_t rounds, unsigned long seed, size_t *sum)
+{
+	Tracking_memory_key key= memory_key_e;
+	Ulong_list_pair_allocator outer(key);
+	Ulong_allocator inner(key);
+
+	for (size_t round= 0; round < rounds; ++round) {
+		Ulong_to_list_map map(Ulong_to_list_allocator(outer, inner));
+		for (unsigned long i= 0; i < 64; ++i) {
+			seed= seed * 6364136223846793005UL + 1442695040888963407UL;
+			map[(seed >> 33) % 32].push_back(i);
+		}
+		*sum+= map.size();
+	}
+	tracking_thread_cache_flush();
+}
+
+static void bench_churn(const Bench_args *args)
+{
+	tracking_thread_cache= args->thread_cache;
+	if (tracking_set_backend(memory_key_e, args->backend)) {
+		exit(EXIT_FAILURE);
+	}
+
+	/* the same total work, however many threads */
+	size_t rounds= args->count / (64 * args->threads);
+	vector<size_t> sums(args->threads);
+	vector<thread> threads;
+
+	double start= now_seconds();
+	for (unsigned i= 0; i < args->threads; ++i) {
+		threads.emplace_back(churn, rounds, i + 1, &sums[i]);
+	}
+	for (auto &t : threads) {
+		t.join();
+	}
+	double seconds= now_seconds() - start;
+
+	struct Tracking_key_stats stats;
+	tracking_snapshot(memory_key_e, &stats);
+	printf("%-6s cache %-3s %2u threads: %8.2f Mallocs/s  allocs: %llu"
+	       "  leaked: %lld\n", backend_name(args->backend),
+	       args->thread_cache ? "on" : "off", args->threads,
+	       (stats.alloc_count / seconds) / 1e6, stats.alloc_count,
+	       stats.bytes_live);
+	fflush(stdout);
+}
+
+/* the same users as make_all_users, one user@host per line */
+static int write_users_file(const char *path, size_t count)
+{
+	FILE *out= fopen(path, "w");
+	if (!out) {
+		perror(path);
+		return 1;
+	}
+	for (size_t i= 0, name= 0; i < count; ++name) {
+		size_t per_name= 1 + ((name * 7) % 10) / 4;
+		for (size_t j= 0; j < per_name && i < count; ++j, ++i) {
+			fprintf(out, "user%zu@10.%zu.%zu.%zu\n", name,
+				(i >> 16) & 0xFF, (i >> 8) & 0xFF, i & 0xFF);
+		}
+	}
+	return fclose(out) ? 1 : 0;
+}
+
+static const char *users_file_path= "/tmp/map-of-str-to-ptrlist-users.txt";
+
+/* the keys of all_users, the users and their strings, name_to_users and
+   the host index */
+static void set_users_backend(enum Tracking_backend backend)
+{
+	Tracking_memory_key keys[]= {
+		memory_key_a, memory_key_b, memory_key_c, memory_key_d,
+		memory_key_g
+	};
+	for (auto key : keys) {
+		if (tracking_set_backend(key, backend)) {
+			fprintf(stderr, "could not set backend %s\n",
+				backend_name(backend));
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+static void bench_load_users(const Bench_args *args)
+{
+	set_users_backend(args->backend);
+	double start= now_seconds();
+	if (load_all_users_from_file(users_file_path, args->threads)) {
+		exit(EXIT_FAILURE);
+	}
+	double seconds= now_seconds() - start;
+
+	if (all_users_len != args->count) {
+		fprintf(stderr, "loaded %zu of %zu users\n", all_users_len,
+			args->count);
+		exit(EXIT_FAILURE);
+	}
+	printf("%-6s %2u threads  load: %7.3f s  (%6.2f M users/s,"
+	       " %zu names, %zu strings)\n", backend_name(args->backend),
+	       args->threads, seconds, (args->count / seconds) / 1e6,
+	       name_to_users->size(), user_strings->size());
+	fflush(stdout);
+
+	clear_all_users();
+}
+
+/* most names have a few hosts, but the app names have thousands, of
+   every kind of host pattern */
+static const char *make_host_pattern(char *buf, size_t size, size_t i)
+{
+	size_t a= (i >> 16) & 0xFF, b= (i >> 8) & 0xFF, c= i & 0xFF;
+	switch (i % 10) {
+	case 6:
+		snprintf(buf, size, "10.%zu.%zu.0/24", a, b);
+		break;
+	case 7:
+		snprintf(buf, size, "10.%zu.%zu.%%", a, b);
+		break;
+	case 8:
+		snprintf(buf, size, "fd00:%zx:%zx::/64", a, (b << 8) | c);
+		break;
+	case 9:
+		snprintf(buf, size, "%%.d%zu.example.com", i % 1000);
+		break;
+	default:
+		snprintf(buf, size, "10.%zu.%zu.%zu", a, b, c);
+	}
+	return buf;
+}
+
+static void make_pattern_users(size_t count, size_t app_names)
+{
+	char id[40];
+	char host[64];
+	if (reserve_all_users(count)) {
+		exit(EXIT_FAILURE);
+	}
+	for (size_t i= 0, name= 0; i < count; ++name) {
+		size_t per_name= 1 + ((name * 7) % 10) / 4;
+		for (size_t j= 0; j < per_name && i < count; ++j, ++i) {
+			if (i % 10 == 0) {
+				snprintf(id, sizeof(id), "app%zu",
+					 (i / 10) % app_names);
+			} else {
+				snprintf(id, sizeof(id), "user%zu", name);
+			}
+			Host_user *hu= new(tracking_malloc(memory_key_b,
+							   sizeof(Host_user)))
+			    Host_user(id, make_host_pattern(host, sizeof(host),
+							    i));
+			hu->all_users_index= i;
+			all_users[i]= hu;
+		}
+	}
+	all_users[count]= nullptr;
+	all_users_len= count;
+}
+
+/* what finding the accounts took before the index */
+static size_t match_users_by_scan(const char *id, const char *client,
+				  Host_user_ptr_vector *matches)
+{
+	size_t found= 0;
+	auto it= name_to_users->find(string_view(id));
+	if (it == name_to_users->end()) {
+		return 0;
+	}
+	for (auto hu : it->second) {
+		if (host_pattern_matches(hu->host, client)) {
+			matches->push_back(hu);
+			++found;
+		}
+	}
+	return found;
+}
+
+static void bench_host_index(const Bench_args *args)
+{
+	size_t app_names= 50;
+	size_t queries= 100000;
+	char id[40];
+	char client[64];
+
+	set_users_backend(args->backend);
+	make_pattern_users(args->count, app_names);
+	double start= now_seconds();
+	build_name_to_users();
+	double build= now_seconds() - start;
+	struct Tracking_key_stats index_stats;
+	tracking_snapshot(memory_key_g, &index_stats);
+
+	Host_user_ptr_allocator allocator(memory_key_g);
+	Host_user_ptr_vector matches(allocator);
+	size_t found[2]= { 0, 0 };
+	double seconds[2];
+	for (int scan= 0; scan <= 1; ++scan) {
+		unsigned long seed= 1;
+		start= now_seconds();
+		for (size_t q= 0; q < queries; ++q) {
+			seed= seed * 6364136223846793005UL
+			    + 1442695040888963407UL;
+			size_t i= (seed >> 24) % args->count;
+			/* half from the app names, half the owner of a host
+			   near the client */
+			if (q % 2) {
+				snprintf(id, sizeof(id), "app%zu",
+					 (seed >> 8) % app_names);
+			} else {
+				snprintf(id, sizeof(id), "%s", all_users[i]->id);
+			}
+			snprintf(client, sizeof(client), "10.%zu.%zu.%zu",
+				 (i >> 16) & 0xFF, (i >> 8) & 0xFF,
+				 (q % 4) ? (i & 0xFF) : ((seed >> 40) & 0xFF));
+			matches.clear();
+			Users_read_guard guard;
+			found[scan]+= scan ?
+			    match_users_by_scan(id, client, &matches)
+			    : match_users(guard, id, client, &matches);
+		}
+		seconds[scan]= now_seconds() - start;
+	}
+	if (found[0] != found[1]) {
+		fprintf(stderr, "index found %zu, scan found %zu\n", found[0],
+			found[1]);
+		exit(EXIT_FAILURE);
+	}
+	printf("%-6s index build: %6.3f s  %zu trie nodes  %lld kB\n",
+	       backend_name(args->backend), build, host_index->nodes(),
+	       index_stats.bytes_live / 1024);
+	printf("%-6s index: %9.0f lookups/s  name and scan: %9.0f lookups/s"
+	       "  (%zu matches)\n", backend_name(args->backend),
+	       queries / seconds[0], queries / seconds[1], found[0]);
+	fflush(stdout);
+
+	clear_all_users();
+}
+
+static double time_malloc_free(size_t pairs, int tracked)
+{
+	double start= now_seconds();
+	for (size_t i= 0; i < pairs; ++i) {
+		size_t size= 1 + (i % 64);
+		void *ptr= tracked ? tracking_malloc(memory_key_e, size)
+				   : malloc(size);
+		__asm__ __volatile__("" : : "r"(ptr) : "memory");
+		if (tracked) {
+			tracking_free(ptr);
+		} else {
+			free(ptr);
+		}
+	}
+	return ((now_seconds() - start) * 1e9) / pairs;
+}
+
+/* the cost of the sampling check, on a tracking_malloc and tracking_free
+   pair which is otherwise served by the thread cache, against a plain
+   malloc and free pair */
+static void bench_sampling(const Bench_args *args)
+{
+#ifdef TRACKING_NO_SAMPLING
+	unsigned long rates[]= { 0 };
+#else
+	unsigned long rates[]= { 0, 1024, 1 };
+#endif
+	size_t pairs= args->count * 16;
+	char label[32];
+
+	double untracked= time_malloc_free(pairs, 0);
+	printf("%-18s %6.2f ns per malloc/free pair\n", "untracked", untracked);
+	for (auto every : rates) {
+#ifdef TRACKING_NO_SAMPLING
+		snprintf(label, sizeof(label), "no sampling hook");
+#else
+		snprintf(label, sizeof(label), "sample 1 in %lu", every);
+#endif
+		tracking_set_sampling(every);
+		double ns= time_malloc_free(pairs, 1);
+		printf("%-18s %6.2f ns per malloc/free pair"
+		       "  (%+.2f ns over untracked)\n", label, ns,
+		       ns - untracked);
+	}
+	tracking_set_sampling(0);
+	fflush(stdout);
+}
+
+typedef void (*bench_func)(const Bench_args *args);
+
+static void run_in_child(bench_func bench, const Bench_args *args)
+{
+	fflush(stdout);
+	pid_t pid= fork();
+	if (pid < 0) {
+		perror("fork");
+		exit(EXIT_FAILURE);
+	}
+	if (pid == 0) {
+		bench(args);
+		_exit(EXIT_SUCCESS);
+	}
+
+	int status;
+	struct rusage usage;
+	if (wait4(pid, &status, 0, &usage) < 0 || !WIFEXITED(status)
+	    || WEXITSTATUS(status)) {
+		fprintf(stderr, "%s child failed\n",
+			backend_name(args->backend));
+		exit(EXIT_FAILURE);
+	}
+	printf("%-6s peak rss: %ld kB\n", backend_name(args->backend),
+	       usage.ru_maxrss);
+}
+
+int main(int argc, char **argv)
+{
+	size_t count= (argc > 1) ? strtoul(argv[1], NULL, 10) : 1000000;
+	enum Tracking_backend backends[]= {
+		TRACKING_BACKEND_MALLOC, TRACKING_BACKEND_POOL
+	};
+	unsigned thread_counts[]= { 1, 8, 32 };
+
+	load_mem_tracking_keys();
+
+	printf("unordered_map<unsigned long, unsigned long>, %zu entries\n",
+	       count);
+	for (auto backend : backends) {
+		Bench_args args= { backend, count, 1, 1 };
+		run_in_child(bench_unordered_map, &args);
+	}
+
+	printf("\nname_to_users, %zu users\n", count);
+	for (auto backend : backends) {
+		Bench_args args= { backend, count, 1, 1 };
+		run_in_child(bench_name_to_users, &args);
+	}
+
+	printf("\nload_all_users_from_file, %zu lines\n", count * 5);
+	if (write_users_file(users_file_path, count * 5)) {
+		return 1;
+	}
+	for (auto backend : backends) {
+		for (unsigned threads : { 1, 4 }) {
+			Bench_args args= { backend, count * 5, threads, 1 };
+			run_in_child(bench_load_users, &args);
+		}
+	}
+	unlink(users_file_path);
+
+	printf("\nhost pattern index, %zu accounts\n", count);
+	for (auto backend : backends) {
+		Bench_args args= { backend, count, 1, 1 };
+		run_in_child(bench_host_index, &args);
+	}
+
+	printf("\nmap<unsigned long, list> churn, %zu values\n", count * 4);
+	for (auto backend : backends) {
+		for (auto threads : thread_counts) {
+			for (int cache= 0; cache <= 1; ++cache) {
+				Bench_args args= {
+					backend, count * 4, threads, cache
+				};
+				run_in_child(bench_churn, &args);
+			}
+		}
+	}
+
+	printf("\nsampled trace overhead, %zu pairs\n", count * 16);
+	Bench_args args= { TRACKING_BACKEND_MALLOC, count, 1, 1 };
+	run_in_child(bench_sampling, &args);
+
+	return 0;
+}
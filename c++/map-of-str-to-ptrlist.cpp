@@ -31,7 +31,15 @@ constructor argument, and each of the desired types ... however,
 this is not 100% successful, as the list.sort(Custom_comparitor)
 seems to need yet-another allocator!
 
+(The lists have since been replaced with an allocator-aware
+Small_vector, which std::sort is happy to sort.)
+
 Eric Herman <eric@freesa.org> 2018
+
+g++ -std=c++20 -Wall -O2 -pthread \
+	-o map-of-str-to-ptrlist map-of-str-to-ptrlist.cpp
+TRACKING_TRACE=1 ./map-of-str-to-ptrlist
+TRACKING_SAMPLE=16 TRACKING_SAMPLE_FILE=trace.bin ./map-of-str-to-ptrlist
 */
 
 
@@ -39,16 +47,43 @@ Eric Herman <eric@freesa.org> 2018
 #include <string.h>
 #include <assert.h>
 #include <limits.h>
-
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <link.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
 #include <limits>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <unordered_set>
 #include <scoped_allocator>
+#include <thread>
+#include <type_traits>
 #include <list>
+#include <mutex>
+#include <vector>
 using namespace std;
 
+#ifndef likely
+#define likely(x) __builtin_expect(!!(x), 1)
+#endif
+#ifndef unlikely
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#endif
+
 typedef unsigned int Tracking_memory_key;
 class Host_user;
+class String_pool;
+class Host_index;
 
 /* GLOBAL VARIABLES 1 */
 Tracking_memory_key memory_key_a;	/* this is not const */
@@ -57,10 +92,18 @@ Tracking_memory_key memory_key_c;	/* this is not const */
 Tracking_memory_key memory_key_d;	/* this is not const */
 Tracking_memory_key memory_key_e;	/* this is not const */
 Tracking_memory_key memory_key_f;	/* this is not const */
-Host_user **all_users= nullptr;
+Tracking_memory_key memory_key_g;	/* this is not const */
+Host_user **all_users= nullptr;	/* NULL terminated */
+size_t all_users_len= 0;
+size_t all_users_size= 0;	/* slots allocated, including the NULL */
+String_pool *user_strings= nullptr;	/* ids and hosts, with memory_key_c */
+int tracking_trace= 0;	/* print every tracking_malloc and tracking_free */
+int tracking_thread_cache= 1;	/* keep freed blocks in per-thread caches */
 
 /* END GLOBAL VARIABLES 1 */
 
+extern "C" void tracking_set_sampling(unsigned long every);
+
 
 void load_mem_tracking_keys(void)
 {
@@ -70,214 +113,2670 @@ void load_mem_tracking_keys(void)
 	memory_key_d= 2U;
 	memory_key_e= 3U;
 	memory_key_f= 5U;
+	memory_key_g= 4U;
+
+	const char *trace= getenv("TRACKING_TRACE");
+	tracking_trace= (trace && *trace && strcmp(trace, "0")) ? 1 : 0;
+
+	const char *cache= getenv("TRACKING_THREAD_CACHE");
+	tracking_thread_cache= (cache && !strcmp(cache, "0")) ? 0 : 1;
+
+	const char *sample= getenv("TRACKING_SAMPLE");
+	tracking_set_sampling(sample ? strtoul(sample, NULL, 10) : 0);
+}
+
+
+/*
+Sampled allocation trace.
+
+TRACKING_TRACE prints every call, which is far too slow to leave on.
+Instead, one in every N allocations and frees (per thread) may be
+recorded, with its key, size, the return address of the function which
+called into the allocator, and a timestamp. Each thread writes to a
+ring of its own, so recording takes no lock, and the oldest events are
+overwritten. With sampling off (N is 0, the default), the cost is a
+relaxed load and a branch; building with -DTRACKING_NO_SAMPLING takes
+out even that.
+
+Each slot is a seqlock: it is marked empty while being written, and
+tracking_sample_dump, which may run on any thread, skips slots which
+changed while they were read. The rings are never freed; a ring of a
+thread which has exited is kept, with its events, for the next thread.
+
+The dump is a Tracking_trace_file_header, followed by Tracking_event
+records; tracking-trace-agg.cpp sums them by key and callsite.
+*/
+#ifndef TRACKING_SAMPLE_EVENTS
+#define TRACKING_SAMPLE_EVENTS 4096	/* per thread */
+#endif
+
+#ifndef TRACKING_SAMPLE_RINGS
+#define TRACKING_SAMPLE_RINGS 256
+#endif
+
+#define TRACKING_TRACE_MAGIC "TRKTRACE"
+#define TRACKING_TRACE_VERSION 1
+
+enum Tracking_event_op {
+	TRACKING_EVENT_ALLOC= 1,
+	TRACKING_EVENT_FREE= 2
+};
+
+struct Tracking_trace_file_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t event_size;
+	/* subtract from a caller to get an address for addr2line */
+	uint64_t load_bias;
+};
+
+struct Tracking_event {
+	uint64_t nanos;	/* CLOCK_MONOTONIC */
+	uint64_t caller;
+	uint64_t size;
+	uint32_t key;
+	uint32_t op;
+};
+
+struct Tracking_sample_slot {
+	atomic<uint64_t> seq;	/* 0 while empty or being written */
+	atomic<uint64_t> nanos;
+	atomic<uint64_t> caller;
+	atomic<uint64_t> size;
+	atomic<uint64_t> key_op;
+};
+
+struct Tracking_sample_ring {
+	atomic<int> in_use;
+	uint64_t next;	/* only touched by the thread using the ring */
+	Tracking_sample_slot slots[TRACKING_SAMPLE_EVENTS];
+};
+
+static atomic<unsigned long> tracking_sample_every(0);
+static atomic<Tracking_sample_ring *>
+	tracking_sample_rings[TRACKING_SAMPLE_RINGS];
+static thread_local unsigned long tracking_sample_countdown= 0;
+static thread_local Tracking_sample_ring *tracking_sample_ring= nullptr;
+
+
+/* record 1 in every events, 0 turns sampling off */
+extern "C" void tracking_set_sampling(unsigned long every)
+{
+	tracking_sample_every.store(every, memory_order_relaxed);
+}
+
+
+class Tracking_sample_ring_owner {
+public:
+	~Tracking_sample_ring_owner()
+	{
+		if (tracking_sample_ring) {
+			tracking_sample_ring->in_use.store(0,
+							   memory_order_release);
+			tracking_sample_ring= nullptr;
+		}
+	}
+};
+
+
+static Tracking_sample_ring *tracking_sample_ring_claim(void)
+{
+	static thread_local Tracking_sample_ring_owner owner;
+	(void)owner;
+
+	for (size_t i= 0; i < TRACKING_SAMPLE_RINGS; ++i) {
+		Tracking_sample_ring *ring=
+		    tracking_sample_rings[i].load(memory_order_acquire);
+		if (!ring) {
+			ring= (Tracking_sample_ring *)
+			    calloc(1, sizeof(Tracking_sample_ring));
+			if (!ring) {
+				return nullptr;
+			}
+			ring->in_use.store(1, memory_order_relaxed);
+			Tracking_sample_ring *expected= nullptr;
+			if (tracking_sample_rings[i].compare_exchange_strong(
+				    expected, ring, memory_order_acq_rel)) {
+				return ring;
+			}
+			free(ring);
+			ring= expected;
+		}
+		int idle= 0;
+		if (ring->in_use.compare_exchange_strong(idle, 1,
+							 memory_order_acquire)) {
+			return ring;
+		}
+	}
+	return nullptr;	/* too many threads, this one is not sampled */
+}
+
+
+static void tracking_sample_record(Tracking_memory_key key, size_t size,
+				   enum Tracking_event_op op,
+				   const void *caller)
+{
+	if (!tracking_sample_ring) {
+		tracking_sample_ring= tracking_sample_ring_claim();
+		if (!tracking_sample_ring) {
+			return;
+		}
+	}
+	Tracking_sample_ring *ring= tracking_sample_ring;
+	Tracking_sample_slot *slot=
+	    &ring->slots[ring->next % TRACKING_SAMPLE_EVENTS];
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	/* a reader which sees any of the new values also sees seq change */
+	slot->seq.store(0, memory_order_relaxed);
+	slot->nanos.store((ts.tv_sec * 1000000000ULL) + ts.tv_nsec,
+			  memory_order_release);
+	slot->caller.store((uintptr_t)caller, memory_order_release);
+	slot->size.store(size, memory_order_release);
+	slot->key_op.store((((uint64_t)key) << 32) | op, memory_order_release);
+	slot->seq.store(++ring->next, memory_order_release);
 }
 
 
-extern "C" void *tracking_malloc(Tracking_memory_key key, size_t size)
+static inline void tracking_sample(Tracking_memory_key key, size_t size,
+				   enum Tracking_event_op op,
+				   const void *caller)
 {
-	void *ptr= malloc(size + (sizeof(Tracking_memory_key)));
-	fprintf(stderr, "tracking_malloc(key=%lu, size=%lu)=%p\n",
-		(unsigned long)key, (unsigned long)size, ptr);
-	*((Tracking_memory_key *) ptr)= key;
-	return (void *)(((char *)ptr) + sizeof(Tracking_memory_key));
+#ifdef TRACKING_NO_SAMPLING
+	return;
+#endif
+	unsigned long every= tracking_sample_every.load(memory_order_relaxed);
+	if (likely(!every)) {
+		return;
+	}
+	if (tracking_sample_countdown >= every) {
+		/* the rate was raised since the last event */
+		tracking_sample_countdown= every - 1;
+	}
+	if (tracking_sample_countdown) {
+		--tracking_sample_countdown;
+		return;
+	}
+	tracking_sample_countdown= every - 1;
+	tracking_sample_record(key, size, op, caller);
+}
+
+
+static int tracking_load_bias_callback(struct dl_phdr_info *info, size_t size,
+				       void *data)
+{
+	(void)size;
+	/* the first object is the executable itself */
+	*((uint64_t *)data)= info->dlpi_addr;
+	return 1;
 }
 
 
-extern "C" void tracking_free(void *ptr)
+/* Writes the sampled events of all threads to path, returns the number
+   of events written, or -1 on error. */
+extern "C" long tracking_sample_dump(const char *path)
 {
+	struct Tracking_trace_file_header header;
+	memset(&header, 0x00, sizeof(header));
+	memcpy(header.magic, TRACKING_TRACE_MAGIC, sizeof(header.magic));
+	header.version= TRACKING_TRACE_VERSION;
+	header.event_size= sizeof(struct Tracking_event);
+	dl_iterate_phdr(tracking_load_bias_callback, &header.load_bias);
+
+	FILE *out= fopen(path, "wb");
+	if (!out) {
+		return -1;
+	}
+	long written= 0;
+	int err= (fwrite(&header, sizeof(header), 1, out) != 1);
+
+	for (size_t i= 0; !err && i < TRACKING_SAMPLE_RINGS; ++i) {
+		Tracking_sample_ring *ring=
+		    tracking_sample_rings[i].load(memory_order_acquire);
+		if (!ring) {
+			break;
+		}
+		for (size_t j= 0; !err && j < TRACKING_SAMPLE_EVENTS; ++j) {
+			Tracking_sample_slot *slot= &ring->slots[j];
+			struct Tracking_event event;
+			uint64_t seq= slot->seq.load(memory_order_acquire);
+			if (!seq) {
+				continue;
+			}
+			event.nanos= slot->nanos.load(memory_order_acquire);
+			event.caller= slot->caller.load(memory_order_acquire);
+			event.size= slot->size.load(memory_order_acquire);
+			uint64_t key_op= slot->key_op.load(memory_order_acquire);
+			if (slot->seq.load(memory_order_relaxed) != seq) {
+				continue;	/* overwritten while reading */
+			}
+			event.key= (uint32_t)(key_op >> 32);
+			event.op= (uint32_t)key_op;
+			err= (fwrite(&event, sizeof(event), 1, out) != 1);
+			++written;
+		}
+	}
+	if (fclose(out) || err) {
+		return -1;
+	}
+	return written;
+}
+
+
+/*
+Per-key allocation statistics.
+
+Writing a line to stderr for every allocation takes the stdio lock
+and makes a syscall, which made any container using Tracking_allocator
+orders of magnitude slower than std::allocator. Instead, each key has
+a set of counters which are sharded by thread, each shard on its own
+cache line, and only ever updated with relaxed atomics. The shards are
+summed when a snapshot is requested.
+
+The high-water mark is the peak of the summed live bytes, as seen by
+the snapshots and by a sample which a thread takes every
+TRACKING_PEAK_INTERVAL of its allocations. A peak between two samples
+is missed, so it is a lower bound on the real peak. Summing the shard
+peaks instead is no bound at all: when one thread allocates what
+another frees, its shard only ever grows, and the sum converges on the
+bytes ever allocated.
+
+The old text tracing is still available with TRACKING_TRACE=1 in the
+environment.
+*/
+#ifndef TRACKING_MAX_KEYS
+#define TRACKING_MAX_KEYS 16
+#endif
+
+#ifndef TRACKING_SHARDS
+#define TRACKING_SHARDS 16
+#endif
+
+#ifndef TRACKING_CACHE_LINE
+#define TRACKING_CACHE_LINE 64
+#endif
+
+#ifndef TRACKING_PEAK_INTERVAL
+#define TRACKING_PEAK_INTERVAL 1024
+#endif
+
+struct Tracking_key_stats {
 	Tracking_memory_key key;
-	char *pos;
-	if (((unsigned long)ptr) > sizeof(Tracking_memory_key)) {
-		pos= (((char *)ptr) - (sizeof(Tracking_memory_key)));
-		key= *((Tracking_memory_key *) pos);
-	} else {
-		key= (Tracking_memory_key) UINT_MAX;
+	long long bytes_live;
+	unsigned long long alloc_count;
+	unsigned long long free_count;
+	long long high_water;
+};
+
+struct alignas(TRACKING_CACHE_LINE) Tracking_shard {
+	/* may go negative, if this thread freed what another allocated */
+	atomic<long long> bytes_live;
+	atomic<unsigned long long> alloc_count;
+	atomic<unsigned long long> free_count;
+};
+
+static Tracking_shard tracking_shards[TRACKING_MAX_KEYS][TRACKING_SHARDS];
+static atomic<long long> tracking_high_water[TRACKING_MAX_KEYS];
+
+
+static size_t tracking_key_index(Tracking_memory_key key)
+{
+	assert(key < TRACKING_MAX_KEYS);
+	return (key < TRACKING_MAX_KEYS) ? key : (TRACKING_MAX_KEYS - 1);
+}
+
+
+static size_t tracking_shard_index(void)
+{
+	static atomic<size_t> next_shard(0);
+	static thread_local size_t shard=
+		next_shard.fetch_add(1, memory_order_relaxed) % TRACKING_SHARDS;
+	return shard;
+}
+
+
+/* sums the live bytes of key k, and raises its high-water mark to
+   them */
+static long long tracking_sample_live(size_t k)
+{
+	long long live= 0;
+	for (size_t i= 0; i < TRACKING_SHARDS; ++i) {
+		live+= tracking_shards[k][i].bytes_live.load(memory_order_relaxed);
 	}
-	fprintf(stderr, "tracking_free(%p), (key: %lu)\n", ptr,
-		(unsigned long)key);
-	if (pos) {
-		free(pos);
+	long long high= tracking_high_water[k].load(memory_order_relaxed);
+	while (live > high
+	       && !tracking_high_water[k].compare_exchange_weak
+		   (high, live, memory_order_relaxed)) {
 	}
+	return live;
 }
 
 
-/* Custom Allocator which requires a contructor argument */
-#ifndef BOGUS_ALLOCATOR_INCLUDED
-#define BOGUS_ALLOCATOR_INCLUDED
-template <class T= void *> class Tracking_allocator
+static void tracking_count_malloc(Tracking_memory_key key, size_t size,
+				  const void *caller)
 {
-  // This cannot be const if we want to be able to swap.
-  Tracking_memory_key m_key;
+	tracking_sample(key, size, TRACKING_EVENT_ALLOC, caller);
 
-public:
-  typedef T value_type;
-  typedef size_t size_type;
-  typedef ptrdiff_t difference_type;
+	size_t k= tracking_key_index(key);
+	Tracking_shard *shard= &tracking_shards[k][tracking_shard_index()];
 
-  typedef T* pointer;
-  typedef const T* const_pointer;
+	/* only this thread writes to this shard, but others may read it */
+	unsigned long long count=
+	    shard->alloc_count.fetch_add(1, memory_order_relaxed);
+	shard->bytes_live.fetch_add(size, memory_order_relaxed);
+	if (unlikely(count % TRACKING_PEAK_INTERVAL == 0)) {
+		tracking_sample_live(k);
+	}
+}
 
-  typedef T& reference;
-  typedef const T& const_reference;
 
-  pointer address(reference r) const { return &r; }
-  const_pointer address(const_reference r) const { return &r; }
+static void tracking_count_free(Tracking_memory_key key, size_t size,
+				const void *caller)
+{
+	tracking_sample(key, size, TRACKING_EVENT_FREE, caller);
 
-  explicit Tracking_allocator(Tracking_memory_key key) : m_key(key)
-  {}
+	size_t k= tracking_key_index(key);
+	Tracking_shard *shard= &tracking_shards[k][tracking_shard_index()];
 
-  template <class U> Tracking_allocator
-    (const Tracking_allocator<U> &other __attribute__((unused)))
-      : m_key(other.psi_key())
-  {}
+	shard->free_count.fetch_add(1, memory_order_relaxed);
+	shard->bytes_live.fetch_sub(size, memory_order_relaxed);
+}
 
-  template <class U> Tracking_allocator & operator=
-    (const Tracking_allocator<U> &other __attribute__((unused)))
-  {
-    assert(m_key == other.psi_key()); // Don't swap key.
-  }
 
-  ~Tracking_allocator()
-  {}
+extern "C" void tracking_snapshot(Tracking_memory_key key,
+				  struct Tracking_key_stats *stats)
+{
+	size_t k= tracking_key_index(key);
+
+	memset(stats, 0x00, sizeof(struct Tracking_key_stats));
+	stats->key= key;
+	stats->bytes_live= tracking_sample_live(k);
+	stats->high_water= tracking_high_water[k].load(memory_order_relaxed);
+	for (size_t i= 0; i < TRACKING_SHARDS; ++i) {
+		Tracking_shard *shard= &tracking_shards[k][i];
+		stats->alloc_count+= shard->alloc_count.load(memory_order_relaxed);
+		stats->free_count+= shard->free_count.load(memory_order_relaxed);
+	}
+}
 
-  pointer allocate(size_type n, const_pointer hint __attribute__((unused))= 0)
-  {
-    if (n == 0)
-      return NULL;
-    if (n > max_size())
-      throw std::bad_alloc();
 
-    size_t size= n * sizeof(T);
-    pointer p= static_cast<pointer>(tracking_malloc(m_key, size));
-    if (p == NULL)
-      throw std::bad_alloc();
+int print_tracking_stats(FILE *stream)
+{
+	int rv;
+	int bytes_written= 0;
+	struct Tracking_key_stats stats;
 
-    return p;
-  }
+	for (Tracking_memory_key key= 0; key < TRACKING_MAX_KEYS; ++key) {
+		tracking_snapshot(key, &stats);
+		if (!stats.alloc_count && !stats.free_count) {
+			continue;
+		}
+		rv= fprintf(stream, "key %lu: live=%lld high_water=%lld"
+			    " allocs=%llu frees=%llu\n",
+			    (unsigned long)stats.key, stats.bytes_live,
+			    stats.high_water, stats.alloc_count,
+			    stats.free_count);
+		if (rv < 0)
+			return rv;
+		bytes_written+= rv;
+	}
+	return bytes_written;
+}
 
-  void deallocate(pointer p, size_type) { tracking_free(p); }
 
-  template <class U, class... Args>
-  void construct(U *p, Args&&... args)
-  {
-    assert(p != NULL);
-    try {
-      ::new((void *)p) U(std::forward<Args>(args)...);
-    } catch (...) {
-      assert(false); // Constructor should not throw an exception.
-    }
-  }
+/*
+Small blocks are grouped in size classes, of Tracking_class_granularity
+bytes each, both by the slab pool backend and the thread caches.
+*/
+enum Tracking_backend {
+	TRACKING_BACKEND_MALLOC= 0,
+	TRACKING_BACKEND_POOL= 1
+};
 
-  void destroy(pointer p)
-  {
-    assert(p != NULL);
-    try {
-      p->~T();
-    } catch (...) {
-      assert(false); // Destructor should not throw an exception
-    }
-  }
+#define Tracking_class_granularity 16
+#define Tracking_classes 16
+#define Tracking_class_max_size \
+	(Tracking_class_granularity * Tracking_classes)
 
-  size_type max_size() const
-  {
-    return std::numeric_limits<size_t>::max() / sizeof(T);
-  }
+static size_t tracking_class_index(size_t size)
+{
+	return size ? ((size - 1) / Tracking_class_granularity) : 0;
+}
+
+static size_t tracking_class_size(size_t c)
+{
+	return (c + 1) * Tracking_class_granularity;
+}
 
-  template <class U> struct rebind { typedef Tracking_allocator<U> other; };
 
-  Tracking_memory_key psi_key() const { return m_key; }
+/*
+Per-thread cache.
+
+Even with the counters out of the way, every allocation still goes to
+the global malloc (or to a pool behind a mutex). Each thread therefore
+keeps a few recently freed blocks per key and size class, and hands
+them out again without touching any shared state. A bin holds at most
+TRACKING_CACHE_BLOCKS; when it is full, half of it goes back to the
+backend. Every TRACKING_CACHE_FLUSH_OPS frees, and when the thread
+exits, the whole cache is returned, so memory does not stay stranded
+in idle threads.
+
+The counters are updated on every tracking call, as before, so the
+per-key accounting is exact: a block in a thread cache counts as freed.
+Set TRACKING_THREAD_CACHE=0 in the environment to bypass the cache.
+*/
+#ifndef TRACKING_CACHE_BLOCKS
+#define TRACKING_CACHE_BLOCKS 32
+#endif
+
+#ifndef TRACKING_CACHE_FLUSH_OPS
+#define TRACKING_CACHE_FLUSH_OPS (64 * 1024)
+#endif
+
+struct Tracking_cache_bin {
+	void *blocks[TRACKING_CACHE_BLOCKS];
+	unsigned count;
+	int backend;	/* which backend the cached blocks belong to */
 };
 
-template <class T>
-bool operator== (const Tracking_allocator<T>& a1, const Tracking_allocator<T>& a2)
+struct Tracking_thread_cache {
+	Tracking_cache_bin bins[TRACKING_MAX_KEYS][Tracking_classes];
+	unsigned long ops;
+};
+
+/* defined after the backends, returns blocks to the given backend */
+static void tracking_cache_release(size_t k, size_t c, int backend,
+				   void **blocks, size_t count);
+
+static thread_local Tracking_thread_cache *tracking_cache= nullptr;
+
+
+static void tracking_cache_drain(size_t k, size_t c, unsigned keep)
 {
-  return a1.psi_key() == a2.psi_key();
+	Tracking_cache_bin *bin= &tracking_cache->bins[k][c];
+	if (bin->count > keep) {
+		tracking_cache_release(k, c, bin->backend, bin->blocks + keep,
+				       bin->count - keep);
+		bin->count= keep;
+	}
 }
 
-template <class T>
-bool operator!= (const Tracking_allocator<T>& a1, const Tracking_allocator<T>& a2)
+
+/* returns every block cached by the calling thread to its backend */
+extern "C" void tracking_thread_cache_flush(void)
 {
-  return a1.psi_key() != a2.psi_key();
+	if (!tracking_cache) {
+		return;
+	}
+	for (size_t k= 0; k < TRACKING_MAX_KEYS; ++k) {
+		for (size_t c= 0; c < Tracking_classes; ++c) {
+			tracking_cache_drain(k, c, 0);
+		}
+	}
 }
 
-#endif // BOGUS_ALLOCATOR_INCLUDED
+
+class Tracking_thread_cache_owner {
+public:
+	~Tracking_thread_cache_owner()
+	{
+		tracking_thread_cache_flush();
+		free(tracking_cache);
+		tracking_cache= nullptr;
+	}
+};
 
 
-char *tracking_strdup(Tracking_memory_key key, const char *s)
+static Tracking_thread_cache *tracking_thread_cache_get(void)
 {
-	size_t len;
-	char *dup;
+	if (likely(tracking_cache)) {
+		return tracking_cache;
+	}
+	if (!tracking_thread_cache) {
+		return nullptr;
+	}
+	static thread_local Tracking_thread_cache_owner owner;
+	(void)owner;
+	tracking_cache= (Tracking_thread_cache *)
+	    calloc(1, sizeof(Tracking_thread_cache));
+	return tracking_cache;
+}
 
-	len= s ? strlen(s) : 0;
-	dup= (char *)tracking_malloc(key, len + 1);
-	if (!dup) {
+
+static Tracking_cache_bin *tracking_cache_bin(size_t k, size_t c,
+					      int backend)
+{
+	Tracking_thread_cache *cache= tracking_thread_cache_get();
+	if (!cache) {
+		return nullptr;
+	}
+	Tracking_cache_bin *bin= &cache->bins[k][c];
+	if (unlikely(bin->backend != backend)) {
+		/* the backend of the key was changed */
+		tracking_cache_drain(k, c, 0);
+		bin->backend= backend;
+	}
+	return bin;
+}
+
+
+static void *tracking_cache_pop(size_t k, size_t c, int backend)
+{
+	Tracking_cache_bin *bin= tracking_cache_bin(k, c, backend);
+	if (!bin || !bin->count) {
+		return nullptr;
+	}
+	return bin->blocks[--bin->count];
+}
+
+
+/* returns 1 if the block was kept by the cache */
+static int tracking_cache_push(size_t k, size_t c, int backend, void *block)
+{
+	Tracking_cache_bin *bin= tracking_cache_bin(k, c, backend);
+	if (!bin) {
+		return 0;
+	}
+	if (bin->count == TRACKING_CACHE_BLOCKS) {
+		tracking_cache_drain(k, c, TRACKING_CACHE_BLOCKS / 2);
+	}
+	bin->blocks[bin->count++]= block;
+
+	if (unlikely(++tracking_cache->ops == TRACKING_CACHE_FLUSH_OPS)) {
+		tracking_cache->ops= 0;
+		tracking_thread_cache_flush();
+	}
+	return 1;
+}
+
+
+/*
+Each block carries its key and its size, so that it can be counted
+when freed, and the offset back to the start of the malloc'ed region.
+
+The header is padded so that the memory handed out keeps at least
+Tracking_min_align (16 byte) alignment, which is what malloc gives and
+what 8 and 16 byte loads want. Stricter alignment, such as a cache line
+or an AVX register, is available from tracking_aligned_malloc.
+
+Small blocks are malloc'ed with room for the whole of their size
+class, so that the thread cache can hand them out for any size in it.
+*/
+#define Tracking_min_align \
+	((alignof(max_align_t) > 16) ? alignof(max_align_t) : 16)
+
+struct alignas(Tracking_min_align) Tracking_header {
+	size_t size;
+	Tracking_memory_key key;
+	unsigned int offset;
+};
+
+static_assert((sizeof(Tracking_header) % Tracking_min_align) == 0,
+	      "Tracking_header must preserve alignment");
+
+
+static void *tracking_header_init(void *user, Tracking_memory_key key,
+				  size_t size, size_t offset,
+				  const void *caller)
+{
+	Tracking_header *header= ((Tracking_header *)user) - 1;
+	header->size= size;
+	header->key= key;
+	header->offset= (unsigned int)offset;
+	tracking_count_malloc(key, size, caller);
+	return user;
+}
+
+
+static void *tracking_malloc_block(Tracking_memory_key key, size_t size,
+				   size_t block_size, size_t alignment,
+				   const void *caller)
+{
+	assert(alignment && !(alignment & (alignment - 1)));
+	if (alignment < Tracking_min_align) {
+		alignment= Tracking_min_align;
+	}
+
+	/* malloc itself only promises alignof(max_align_t) */
+	size_t slack= (alignment > alignof(max_align_t)) ? (alignment - 1) : 0;
+	if (block_size > (SIZE_MAX - sizeof(Tracking_header) - slack)) {
 		return NULL;
 	}
-	dup[len]= '\0';
+	void *ptr= malloc(block_size + sizeof(Tracking_header) + slack);
+	if (unlikely(tracking_trace)) {
+		fprintf(stderr, "tracking_malloc(key=%lu, size=%lu,"
+			" alignment=%lu)=%p\n", (unsigned long)key,
+			(unsigned long)size, (unsigned long)alignment, ptr);
+	}
+	if (!ptr) {
+		return NULL;
+	}
+
+	uintptr_t user= ((uintptr_t)ptr) + sizeof(Tracking_header);
+	user= (user + (alignment - 1)) & ~((uintptr_t)(alignment - 1));
+
+	return tracking_header_init((void *)user, key, size,
+				    user - (uintptr_t)ptr, caller);
+}
+
+
+/* alignment must be a power of two; a small block may still end up
+   with the plain header, and then be cached by tracking_free, so it
+   gets room for its whole size class as well */
+static void *tracking_aligned_malloc_from(Tracking_memory_key key,
+					  size_t size, size_t alignment,
+					  const void *caller)
+{
+	size_t block_size= (size <= Tracking_class_max_size) ?
+	    tracking_class_size(tracking_class_index(size)) : size;
+	return tracking_malloc_block(key, size, block_size, alignment,
+				     caller);
+}
+
+
+/*
+The entry points record their own return address as the caller of a
+sampled event, so they must never be inlined, or the address would be
+that of whoever called their caller.
+*/
+extern "C" __attribute__((noinline))
+void *tracking_aligned_malloc(Tracking_memory_key key, size_t size,
+			      size_t alignment)
+{
+	return tracking_aligned_malloc_from(key, size, alignment,
+					    __builtin_return_address(0));
+}
+
+
+static void *tracking_malloc_from(Tracking_memory_key key, size_t size,
+				  const void *caller)
+{
+	if (size > Tracking_class_max_size) {
+		return tracking_malloc_block(key, size, size,
+					     Tracking_min_align, caller);
+	}
+
+	size_t c= tracking_class_index(size);
+	void *ptr= tracking_cache_pop(tracking_key_index(key), c,
+				      TRACKING_BACKEND_MALLOC);
+	if (ptr) {
+		if (unlikely(tracking_trace)) {
+			fprintf(stderr, "tracking_malloc(key=%lu, size=%lu)"
+				"=%p (cached)\n", (unsigned long)key,
+				(unsigned long)size, ptr);
+		}
+		return tracking_header_init(ptr, key, size,
+					    sizeof(Tracking_header), caller);
+	}
+	return tracking_malloc_block(key, size, tracking_class_size(c),
+				     Tracking_min_align, caller);
+}
+
+
+extern "C" __attribute__((noinline))
+void *tracking_malloc(Tracking_memory_key key, size_t size)
+{
+	return tracking_malloc_from(key, size, __builtin_return_address(0));
+}
+
+
+static void tracking_free_from(void *ptr, const void *caller)
+{
+	if (!ptr) {
+		return;
+	}
+	Tracking_header *header= ((Tracking_header *)ptr) - 1;
+	if (unlikely(tracking_trace)) {
+		fprintf(stderr, "tracking_free(%p), (key: %lu)\n", ptr,
+			(unsigned long)header->key);
+	}
+	tracking_count_free(header->key, header->size, caller);
+
+	/* anything with the plain header has room for its whole class */
+	if (header->size <= Tracking_class_max_size
+	    && header->offset == sizeof(Tracking_header)
+	    && tracking_cache_push(tracking_key_index(header->key),
+				   tracking_class_index(header->size),
+				   TRACKING_BACKEND_MALLOC, ptr)) {
+		return;
+	}
+	free(((char *)ptr) - header->offset);
+}
+
+
+extern "C" __attribute__((noinline))
+void tracking_free(void *ptr)
+{
+	tracking_free_from(ptr, __builtin_return_address(0));
+}
+
+
+/*
+Slab pool backend.
+
+The containers allocate one node at a time through Tracking_allocator,
+and with the malloc backend each of those nodes is a malloc call plus
+a header. A key may instead be switched to the pool backend, which
+carves same-size nodes out of large chunks and keeps freed nodes on an
+intrusive free list, one per size class. Pool nodes carry no header:
+Tracking_allocator::deallocate knows the key and the size, and
+passes them back. Allocations are still counted against the key.
+
+The backend of a key can only be changed while the key has nothing
+allocated, as blocks must be returned to the backend they came from.
+Nodes which need more than Tracking_min_align alignment bypass the
+pool.
+*/
+#ifndef TRACKING_POOL_CHUNK_SIZE
+#define TRACKING_POOL_CHUNK_SIZE (64 * 1024)
+#endif
+
+struct Tracking_pool_node {
+	Tracking_pool_node *next;
+};
+
+struct Tracking_pool_chunk {
+	Tracking_pool_chunk *next;
+};
+
+struct Tracking_pool_class {
+	mutex lock;
+	Tracking_pool_node *free_list;
+	char *bump;
+	char *bump_end;
+	Tracking_pool_chunk *chunks;
+	size_t live;
+};
+
+static atomic<int> tracking_backends[TRACKING_MAX_KEYS];
+static Tracking_pool_class
+	tracking_pools[TRACKING_MAX_KEYS][Tracking_classes];
+
+
+static void *tracking_pool_alloc(Tracking_pool_class *pool, size_t node_size)
+{
+	lock_guard<mutex> guard(pool->lock);
+
+	Tracking_pool_node *node= pool->free_list;
+	if (node) {
+		pool->free_list= node->next;
+		++pool->live;
+		return node;
+	}
+	if (pool->bump + node_size > pool->bump_end) {
+		/* the chunk link is kept in the first node-sized slot, so
+		   the nodes stay aligned the same as the malloc'ed chunk */
+		size_t size= TRACKING_POOL_CHUNK_SIZE;
+		Tracking_pool_chunk *chunk= (Tracking_pool_chunk *)malloc(size);
+		if (!chunk) {
+			return NULL;
+		}
+		chunk->next= pool->chunks;
+		pool->chunks= chunk;
+		pool->bump= ((char *)chunk) + Tracking_class_granularity;
+		pool->bump_end= ((char *)chunk) + size;
+	}
+	void *ptr= pool->bump;
+	pool->bump+= node_size;
+	++pool->live;
+	return ptr;
+}
+
+
+static void tracking_pool_free(Tracking_pool_class *pool, void **nodes,
+			       size_t count)
+{
+	lock_guard<mutex> guard(pool->lock);
+
+	for (size_t i= 0; i < count; ++i) {
+		Tracking_pool_node *node= (Tracking_pool_node *)nodes[i];
+		node->next= pool->free_list;
+		pool->free_list= node;
+	}
+	pool->live-= count;
+}
+
+
+static void tracking_cache_release(size_t k, size_t c, int backend,
+				   void **blocks, size_t count)
+{
+	if (backend == TRACKING_BACKEND_POOL) {
+		tracking_pool_free(&tracking_pools[k][c], blocks, count);
+		return;
+	}
+	for (size_t i= 0; i < count; ++i) {
+		free(((char *)blocks[i]) - sizeof(Tracking_header));
+	}
+}
+
+
+/* Returns the chunks of each size class which has no live nodes to the
+   system; returns the number of chunks released. Nodes held in thread
+   caches are live, as far as the pool knows. */
+extern "C" size_t tracking_pool_release(Tracking_memory_key key)
+{
+	size_t k= tracking_key_index(key);
+	size_t released= 0;
+
+	for (size_t i= 0; i < Tracking_classes; ++i) {
+		Tracking_pool_class *pool= &tracking_pools[k][i];
+		lock_guard<mutex> guard(pool->lock);
+		if (pool->live) {
+			continue;
+		}
+		while (pool->chunks) {
+			Tracking_pool_chunk *chunk= pool->chunks;
+			pool->chunks= chunk->next;
+			free(chunk);
+			++released;
+		}
+		pool->free_list= NULL;
+		pool->bump= NULL;
+		pool->bump_end= NULL;
+	}
+	return released;
+}
+
+
+/* Returns 0 on success, or non-zero if the key has live allocations */
+extern "C" int tracking_set_backend(Tracking_memory_key key,
+				    enum Tracking_backend backend)
+{
+	struct Tracking_key_stats stats;
+	size_t k= tracking_key_index(key);
+
+	if (tracking_backends[k].load(memory_order_relaxed) == backend) {
+		return 0;
+	}
+	tracking_snapshot(key, &stats);
+	if (stats.alloc_count != stats.free_count) {
+		return 1;
+	}
+	tracking_backends[k].store(backend, memory_order_relaxed);
+	return 0;
+}
+
+
+static void *tracking_node_alloc_from(Tracking_memory_key key, size_t size,
+				      const void *caller)
+{
+	size_t k= tracking_key_index(key);
+	if (tracking_backends[k].load(memory_order_relaxed)
+	    != TRACKING_BACKEND_POOL || size > Tracking_class_max_size) {
+		return tracking_malloc_from(key, size, caller);
+	}
+
+	size_t c= tracking_class_index(size);
+	void *ptr= tracking_cache_pop(k, c, TRACKING_BACKEND_POOL);
+	if (!ptr) {
+		ptr= tracking_pool_alloc(&tracking_pools[k][c],
+					 tracking_class_size(c));
+	}
+	if (unlikely(tracking_trace)) {
+		fprintf(stderr, "tracking_node_alloc(key=%lu, size=%lu)=%p\n",
+			(unsigned long)key, (unsigned long)size, ptr);
+	}
+	if (ptr) {
+		tracking_count_malloc(key, size, caller);
+	}
+	return ptr;
+}
+
+
+/* allocate a node of the given size, which must be released with
+   tracking_node_free with the same key and size */
+extern "C" __attribute__((noinline))
+void *tracking_node_alloc(Tracking_memory_key key, size_t size)
+{
+	return tracking_node_alloc_from(key, size,
+					__builtin_return_address(0));
+}
+
+
+static void tracking_node_free_from(Tracking_memory_key key, void *ptr,
+				    size_t size, const void *caller)
+{
+	if (!ptr) {
+		return;
+	}
+	size_t k= tracking_key_index(key);
+	if (tracking_backends[k].load(memory_order_relaxed)
+	    != TRACKING_BACKEND_POOL || size > Tracking_class_max_size) {
+		tracking_free_from(ptr, caller);
+		return;
+	}
+	if (unlikely(tracking_trace)) {
+		fprintf(stderr, "tracking_node_free(%p), (key: %lu)\n", ptr,
+			(unsigned long)key);
+	}
+	tracking_count_free(key, size, caller);
+	size_t c= tracking_class_index(size);
+	if (!tracking_cache_push(k, c, TRACKING_BACKEND_POOL, ptr)) {
+		tracking_pool_free(&tracking_pools[k][c], &ptr, 1);
+	}
+}
+
+
+extern "C" __attribute__((noinline))
+void tracking_node_free(Tracking_memory_key key, void *ptr, size_t size)
+{
+	tracking_node_free_from(key, ptr, size, __builtin_return_address(0));
+}
+
+
+/* Custom Allocator which requires a contructor argument */
+/* Align may be used to ask for more than alignof(T), for instance a
+   cache line; 0 means alignof(T). It is kept when rebinding, so the
+   nodes of a container get at least that alignment as well. */
+#ifndef BOGUS_ALLOCATOR_INCLUDED
+#define BOGUS_ALLOCATOR_INCLUDED
+template <class T= void *, size_t Align= 0> class Tracking_allocator
+{
+  // This cannot be const if we want to be able to swap.
+  Tracking_memory_key m_key;
+
+public:
+  typedef T value_type;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+
+  typedef T* pointer;
+  typedef const T* const_pointer;
+
+  typedef T& reference;
+  typedef const T& const_reference;
+
+  pointer address(reference r) const { return &r; }
+  const_pointer address(const_reference r) const { return &r; }
+
+  explicit Tracking_allocator(Tracking_memory_key key) : m_key(key)
+  {}
+
+  template <class U> Tracking_allocator
+    (const Tracking_allocator<U, Align> &other __attribute__((unused)))
+      : m_key(other.psi_key())
+  {}
+
+  template <class U> Tracking_allocator & operator=
+    (const Tracking_allocator<U, Align> &other __attribute__((unused)))
+  {
+    assert(m_key == other.psi_key()); // Don't swap key.
+    return *this;
+  }
+
+  static constexpr size_t alignment()
+  {
+    return (Align > alignof(T)) ? Align : alignof(T);
+  }
+
+  ~Tracking_allocator()
+  {}
+
+  /*
+    Not inlined, and passing on their own return address, so that a
+    sampled event is put down to the code using the container, into
+    which the container's own members are mostly inlined, rather than
+    to this allocator.
+  */
+  __attribute__((noinline))
+  pointer allocate(size_type n, const_pointer hint __attribute__((unused))= 0)
+  {
+    if (n == 0)
+      return NULL;
+    if (n > max_size())
+      throw std::bad_alloc();
+
+    const void *caller= __builtin_return_address(0);
+    size_t size= n * sizeof(T);
+    pointer p;
+    if (alignment() > Tracking_min_align)
+      p= static_cast<pointer>(tracking_aligned_malloc_from(m_key, size,
+                                                           alignment(),
+                                                           caller));
+    else
+      p= static_cast<pointer>(tracking_node_alloc_from(m_key, size, caller));
+    if (p == NULL)
+      throw std::bad_alloc();
+
+    return p;
+  }
+
+  __attribute__((noinline))
+  void deallocate(pointer p, size_type n)
+  {
+    const void *caller= __builtin_return_address(0);
+    if (alignment() > Tracking_min_align)
+      tracking_free_from(p, caller);
+    else
+      tracking_node_free_from(m_key, p, n * sizeof(T), caller);
+  }
+
+  template <class U, class... Args>
+  void construct(U *p, Args&&... args)
+  {
+    assert(p != NULL);
+    try {
+      ::new((void *)p) U(std::forward<Args>(args)...);
+    } catch (...) {
+      assert(false); // Constructor should not throw an exception.
+    }
+  }
+
+  void destroy(pointer p)
+  {
+    assert(p != NULL);
+    try {
+      p->~T();
+    } catch (...) {
+      assert(false); // Destructor should not throw an exception
+    }
+  }
+
+  size_type max_size() const
+  {
+    return std::numeric_limits<size_t>::max() / sizeof(T);
+  }
+
+  template <class U> struct rebind
+  {
+    typedef Tracking_allocator<U, Align> other;
+  };
+
+  Tracking_memory_key psi_key() const { return m_key; }
+};
+
+template <class T, class U, size_t Align>
+bool operator== (const Tracking_allocator<T, Align>& a1,
+                 const Tracking_allocator<U, Align>& a2)
+{
+  return a1.psi_key() == a2.psi_key();
+}
+
+template <class T, class U, size_t Align>
+bool operator!= (const Tracking_allocator<T, Align>& a1,
+                 const Tracking_allocator<U, Align>& a2)
+{
+  return a1.psi_key() != a2.psi_key();
+}
+
+#endif // BOGUS_ALLOCATOR_INCLUDED
+
+
+/*
+A contiguous vector which keeps up to N elements inside the object
+itself, and only asks the allocator for memory beyond that. Most names
+have one to four users, so most of the name_to_users values never
+allocate at all, and iterating them does not chase pointers.
+
+It is allocator-aware, so that scoped_allocator_adaptor can pass the
+inner Tracking_allocator down to it. To keep it small, T must be
+trivially copyable (as a Host_user * is).
+*/
+#ifndef BOGUS_SMALL_VECTOR_INCLUDED
+#define BOGUS_SMALL_VECTOR_INCLUDED
+template <class T, size_t N, class Alloc> class Small_vector
+{
+  static_assert(std::is_trivially_copyable<T>::value,
+                "Small_vector only moves elements with memcpy");
+
+  Alloc m_alloc;
+  T *m_data;
+  size_t m_size;
+  size_t m_capacity;
+  T m_inline[N];
+
+  bool is_inline() const { return m_data == m_inline; }
+
+  void release()
+  {
+    if (!is_inline())
+      m_alloc.deallocate(m_data, m_capacity);
+    m_data= m_inline;
+    m_capacity= N;
+  }
+
+  void steal(Small_vector &other)
+  {
+    if (other.is_inline()) {
+      memcpy(m_inline, other.m_inline, other.m_size * sizeof(T));
+      m_data= m_inline;
+      m_capacity= N;
+    } else {
+      m_data= other.m_data;
+      m_capacity= other.m_capacity;
+      other.m_data= other.m_inline;
+      other.m_capacity= N;
+    }
+    m_size= other.m_size;
+    other.m_size= 0;
+  }
+
+public:
+  typedef T value_type;
+  typedef Alloc allocator_type;
+  typedef size_t size_type;
+  typedef T* iterator;
+  typedef const T* const_iterator;
+
+  explicit Small_vector(const allocator_type &alloc)
+    : m_alloc(alloc), m_data(m_inline), m_size(0), m_capacity(N)
+  {}
+
+  Small_vector(const Small_vector &other, const allocator_type &alloc)
+    : Small_vector(alloc)
+  {
+    reserve(other.m_size);
+    memcpy(m_data, other.m_data, other.m_size * sizeof(T));
+    m_size= other.m_size;
+  }
+
+  Small_vector(const Small_vector &other)
+    : Small_vector(other, other.m_alloc)
+  {}
+
+  Small_vector(Small_vector &&other, const allocator_type &alloc)
+    : Small_vector(alloc)
+  {
+    if (m_alloc == other.m_alloc) {
+      steal(other);
+    } else {
+      reserve(other.m_size);
+      memcpy(m_data, other.m_data, other.m_size * sizeof(T));
+      m_size= other.m_size;
+      other.clear();
+    }
+  }
+
+  Small_vector(Small_vector &&other)
+    : Small_vector(std::move(other), other.m_alloc)
+  {}
+
+  Small_vector &operator=(const Small_vector &other)
+  {
+    if (this != &other) {
+      m_size= 0;
+      reserve(other.m_size);
+      memcpy(m_data, other.m_data, other.m_size * sizeof(T));
+      m_size= other.m_size;
+    }
+    return *this;
+  }
+
+  Small_vector &operator=(Small_vector &&other)
+  {
+    if (this != &other) {
+      assert(m_alloc == other.m_alloc); // Don't swap key.
+      release();
+      steal(other);
+    }
+    return *this;
+  }
+
+  ~Small_vector() { release(); }
+
+  allocator_type get_allocator() const { return m_alloc; }
+
+  iterator begin() { return m_data; }
+  iterator end() { return m_data + m_size; }
+  const_iterator begin() const { return m_data; }
+  const_iterator end() const { return m_data + m_size; }
+
+  T *data() { return m_data; }
+  const T *data() const { return m_data; }
+  size_type size() const { return m_size; }
+  size_type capacity() const { return m_capacity; }
+  bool empty() const { return m_size == 0; }
+
+  T &operator[](size_type i) { return m_data[i]; }
+  const T &operator[](size_type i) const { return m_data[i]; }
+  T &back() { return m_data[m_size - 1]; }
+  const T &back() const { return m_data[m_size - 1]; }
+
+  void reserve(size_type capacity)
+  {
+    if (capacity <= m_capacity)
+      return;
+    T *data= m_alloc.allocate(capacity);
+    memcpy(data, m_data, m_size * sizeof(T));
+    if (!is_inline())
+      m_alloc.deallocate(m_data, m_capacity);
+    m_data= data;
+    m_capacity= capacity;
+  }
+
+  void push_back(const T &value)
+  {
+    if (m_size == m_capacity)
+      reserve(m_capacity * 2);
+    m_data[m_size++]= value;
+  }
+
+  void pop_back() { --m_size; }
+
+  iterator insert(iterator pos, const T &value)
+  {
+    size_type i= pos - begin();
+    assert(i <= m_size);
+    if (m_size == m_capacity)
+      reserve(m_capacity * 2);
+    memmove(m_data + i + 1, m_data + i, (m_size - i) * sizeof(T));
+    m_data[i]= value;
+    ++m_size;
+    return m_data + i;
+  }
+
+  iterator erase(iterator pos)
+  {
+    assert(pos >= begin() && pos < end());
+    memmove(pos, pos + 1, (end() - (pos + 1)) * sizeof(T));
+    --m_size;
+    return pos;
+  }
+
+  void clear() { m_size= 0; }
+};
+#endif // BOGUS_SMALL_VECTOR_INCLUDED
+
+
+char *tracking_strdup(Tracking_memory_key key, const char *s)
+{
+	size_t len;
+	char *dup;
+
+	len= s ? strlen(s) : 0;
+	dup= (char *)tracking_malloc(key, len + 1);
+	if (!dup) {
+		return NULL;
+	}
+	dup[len]= '\0';
+
+	strcpy(dup, s);
+
+	return dup;
+}
+
+
+#ifndef BOGUS_HOST_USER_INCLUDED
+#define BOGUS_HOST_USER_INCLUDED
+/*
+Every distinct id and host is stored once, rather than strdup'ed per
+user. The strings are bump-allocated from chunks of tracked memory; as
+they never move, they can be compared by address and used as
+string_view keys.
+
+Each string counts the times it was interned, and is dropped from the
+pool when it has been released as many times. A chunk is freed when
+the last of its strings is dropped, so a pool under steady add and
+remove does not grow without bound. Users release their strings when
+they are freed, which is after the readers have drained, see
+Users_read_guard.
+
+Strings may be interned from several threads at once, as when loading
+users in parallel, so the pool is split into stripes by hash, each with
+its own lock, set and chunks.
+*/
+struct Name_hash {
+	typedef void is_transparent;
+	size_t operator()(string_view s) const
+	{
+		return hash<string_view>()(s);
+	}
+};
+
+class String_pool {
+	struct Chunk {
+		Chunk *next;
+		Chunk *prev;
+		size_t live;	/* strings not yet dropped */
+	};
+
+	/* in front of each string */
+	struct Entry {
+		Chunk *chunk;
+		size_t refs;
+	};
+
+	typedef unordered_set<string_view, Name_hash, equal_to<>,
+			      Tracking_allocator<string_view>> String_set;
+
+	struct alignas(TRACKING_CACHE_LINE) Stripe {
+		mutex lock;
+		Chunk *chunks;
+		char *bump;
+		char *bump_end;
+		size_t next_chunk_size;
+		String_set strings;
+
+		explicit Stripe(Tracking_memory_key key)
+			: chunks(nullptr), bump(nullptr), bump_end(nullptr),
+			  next_chunk_size(min_chunk_size),
+			  strings(Tracking_allocator<string_view>(key))
+		{}
+	};
+
+	static const size_t stripe_count= 16;
+	/* chunks double in size, so a small pool stays small */
+	static const size_t min_chunk_size= 1024;
+	static const size_t max_chunk_size= 64 * 1024;
+
+	Tracking_memory_key m_key;
+	Stripe *m_stripes;
+
+	static Entry *entry_of(const char *s)
+	{
+		return ((Entry *)s) - 1;
+	}
+
+	void free_chunk(Stripe *stripe, Chunk *chunk)
+	{
+		if (chunk->prev) {
+			chunk->prev->next= chunk->next;
+		} else {
+			stripe->chunks= chunk->next;
+		}
+		if (chunk->next) {
+			chunk->next->prev= chunk->prev;
+		}
+		tracking_free(chunk);
+	}
+
+	/* returns an entry with room for a string of len, counted as live
+	   in its chunk */
+	Entry *alloc(Stripe *stripe, size_t len)
+	{
+		size_t size= sizeof(Entry) + len + 1;
+		size= (size + alignof(Entry) - 1) & ~(alignof(Entry) - 1);
+		if (size > (size_t)(stripe->bump_end - stripe->bump)) {
+			/* big strings get a chunk of their own */
+			size_t want= sizeof(Chunk) + size;
+			if (want < stripe->next_chunk_size) {
+				want= stripe->next_chunk_size;
+			}
+			if (stripe->next_chunk_size < max_chunk_size) {
+				stripe->next_chunk_size*= 2;
+			}
+			Chunk *chunk= (Chunk *)tracking_malloc(m_key, want);
+			if (!chunk) {
+				return nullptr;
+			}
+			Chunk *old= stripe->chunks;
+			chunk->next= old;
+			chunk->prev= nullptr;
+			chunk->live= 0;
+			if (old) {
+				old->prev= chunk;
+			}
+			stripe->chunks= chunk;
+			stripe->bump= (char *)(chunk + 1);
+			stripe->bump_end= ((char *)chunk) + want;
+			if (old && !old->live) {
+				free_chunk(stripe, old);
+			}
+		}
+		Entry *entry= (Entry *)stripe->bump;
+		stripe->bump+= size;
+		entry->chunk= stripe->chunks;
+		entry->refs= 0;
+		++entry->chunk->live;
+		return entry;
+	}
+
+	Stripe *stripe_for(string_view s) const
+	{
+		size_t h= Name_hash()(s);
+		return &m_stripes[(h ^ (h >> 32)) % stripe_count];
+	}
+
+public:
+	explicit String_pool(Tracking_memory_key key) : m_key(key)
+	{
+		size_t size= stripe_count * sizeof(Stripe);
+		m_stripes= (Stripe *)tracking_aligned_malloc(key, size,
+							     alignof(Stripe));
+		if (!m_stripes) {
+			throw bad_alloc();
+		}
+		for (size_t i= 0; i < stripe_count; ++i) {
+			new(&m_stripes[i]) Stripe(key);
+		}
+	}
+
+	~String_pool()
+	{
+		clear();
+		for (size_t i= 0; i < stripe_count; ++i) {
+			m_stripes[i].~Stripe();
+		}
+		tracking_free(m_stripes);
+	}
+
+	String_pool(const String_pool &)= delete;
+	String_pool &operator=(const String_pool &)= delete;
+
+	/* returns the pooled copy of s, which lives until it has been
+	   released once for each intern, or until clear(); or NULL if
+	   there is no memory for it */
+	const char *intern(string_view s)
+	{
+		Stripe *stripe= stripe_for(s);
+		lock_guard<mutex> guard(stripe->lock);
+
+		auto it= stripe->strings.find(s);
+		if (it != stripe->strings.end()) {
+			++entry_of(it->data())->refs;
+			return it->data();
+		}
+		Entry *entry= alloc(stripe, s.size());
+		if (!entry) {
+			return nullptr;
+		}
+		char *copy= (char *)(entry + 1);
+		memcpy(copy, s.data(), s.size());
+		copy[s.size()]= '\0';
+		stripe->strings.insert(string_view(copy, s.size()));
+		entry->refs= 1;
+		return copy;
+	}
+
+	/* s must have come from intern */
+	void release(const char *s)
+	{
+		string_view sv(s);
+		Stripe *stripe= stripe_for(sv);
+		lock_guard<mutex> guard(stripe->lock);
+
+		Entry *entry= entry_of(s);
+		if (--entry->refs) {
+			return;
+		}
+		stripe->strings.erase(sv);
+		Chunk *chunk= entry->chunk;
+		if (--chunk->live) {
+			return;
+		}
+		if (chunk == stripe->chunks) {
+			/* the chunk being filled is empty again, refill it */
+			stripe->bump= (char *)(chunk + 1);
+		} else {
+			free_chunk(stripe, chunk);
+		}
+	}
+
+	/* make room for about count strings, spread over the stripes */
+	void reserve(size_t count)
+	{
+		for (size_t i= 0; i < stripe_count; ++i) {
+			lock_guard<mutex> guard(m_stripes[i].lock);
+			m_stripes[i].strings.reserve(count / stripe_count);
+		}
+	}
+
+	/* returns the pooled copy of s, or NULL if it is not in the pool;
+	   this does not count as interning it */
+	const char *find(string_view s)
+	{
+		Stripe *stripe= stripe_for(s);
+		lock_guard<mutex> guard(stripe->lock);
+
+		auto it= stripe->strings.find(s);
+		return (it == stripe->strings.end()) ? nullptr : it->data();
+	}
+
+	size_t size()
+	{
+		size_t total= 0;
+		for (size_t i= 0; i < stripe_count; ++i) {
+			lock_guard<mutex> guard(m_stripes[i].lock);
+			total+= m_stripes[i].strings.size();
+		}
+		return total;
+	}
+
+	/* must not race with intern */
+	void clear()
+	{
+		for (size_t i= 0; i < stripe_count; ++i) {
+			Stripe *stripe= &m_stripes[i];
+			stripe->strings.clear();
+			while (stripe->chunks) {
+				Chunk *chunk= stripe->chunks;
+				stripe->chunks= chunk->next;
+				tracking_free(chunk);
+			}
+			stripe->bump= nullptr;
+			stripe->bump_end= nullptr;
+			stripe->next_chunk_size= min_chunk_size;
+		}
+	}
+};
+
+
+/* the pool must be created before any threads use it; returns 0 if
+   it exists */
+static int create_user_strings(void)
+{
+	if (user_strings) {
+		return 0;
+	}
+	void *ptr= tracking_malloc(memory_key_c, sizeof(String_pool));
+	if (!ptr) {
+		return 1;
+	}
+	try {
+		user_strings= new(ptr) String_pool(memory_key_c);
+	} catch (const bad_alloc &) {
+		tracking_free(ptr);
+		return 1;
+	}
+	return 0;
+}
+
+
+/* returns NULL if out of memory */
+const char *intern_user_string(string_view s)
+{
+	if (create_user_strings()) {
+		return nullptr;
+	}
+	return user_strings->intern(s);
+}
+
+
+void release_user_string(const char *s)
+{
+	if (s && user_strings) {
+		user_strings->release(s);
+	}
+}
+
+
+void free_user_strings(void)
+{
+	if (!user_strings)
+		return;
+
+	user_strings->~String_pool();
+	tracking_free(user_strings);
+	user_strings= nullptr;
+}
+
+
+/* users loaded in bulk share one allocation, freed with the last */
+struct Host_user_batch {
+	size_t live;
+};
+
+/* if either string could not be interned, it is NULL, and the user must
+   be freed with free_host_user without being used */
+class Host_user {
+public:
+	const char *id;		/* interned */
+	const char *host;	/* interned */
+	size_t all_users_index;	/* position in all_users */
+	Host_user *next_retired;	/* waiting for readers to drain */
+	Host_user_batch *batch;	/* NULL if allocated alone */
+
+	 Host_user(const char *id, const char *host) {
+		this->id= intern_user_string(id ? id : "");
+		this->host= intern_user_string(host ? host : "localhost");
+		this->all_users_index= 0;
+		this->next_retired= nullptr;
+		this->batch= nullptr;
+	};
+
+	/* a host with a NULL data() is the default host */
+	 Host_user(string_view id, string_view host, Host_user_batch *batch) {
+		this->id= intern_user_string(id);
+		this->host= intern_user_string(host.data() ? host
+					       : "localhost");
+		this->all_users_index= 0;
+		this->next_retired= nullptr;
+		this->batch= batch;
+	};
+
+	~Host_user() {
+		release_user_string(this->id);
+		release_user_string(this->host);
+	};
+};
+
+/* orders by host, then by id */
+class Host_user_compare
+{
+public:
+  bool operator()(const Host_user &a, const Host_user &b) const
+  {
+    int cmp= strcmp(a.host, b.host);
+    return cmp ? (cmp < 0) : (strcmp(a.id, b.id) < 0);
+  }
+  bool operator()(const Host_user *a, const Host_user *b) const
+  {
+    return (*this)(*a, *b);
+  }
+};
+#endif // BOGUS_HOST_USER_INCLUDED
+
+
+/* returns room for count users, to be constructed with the batch */
+static Host_user *alloc_host_user_batch(size_t count,
+					Host_user_batch **batch)
+{
+	size_t offset= sizeof(Host_user_batch);
+	offset= (offset + alignof(Host_user) - 1) & ~(alignof(Host_user) - 1);
+	if (!count || count > ((SIZE_MAX - offset) / sizeof(Host_user))) {
+		return nullptr;
+	}
+	size_t size= offset + (count * sizeof(Host_user));
+	*batch= (Host_user_batch *)tracking_malloc(memory_key_b, size);
+	if (!*batch) {
+		return nullptr;
+	}
+	(*batch)->live= count;
+	return (Host_user *)(((char *)*batch) + offset);
+}
+
+
+static void free_host_user(Host_user *hu)
+{
+	Host_user_batch *batch= hu->batch;
+	hu->~Host_user();	/* destroy */
+	if (!batch) {
+		tracking_free(hu);	/* free */
+	} else if (--batch->live == 0) {
+		tracking_free(batch);	/* free the last of the batch */
+	}
+}
+
+
+/* returns NULL if out of memory */
+static Host_user *new_host_user(const char *id, const char *host)
+{
+	void *ptr= tracking_malloc(memory_key_b, sizeof(Host_user));
+	if (!ptr) {
+		return nullptr;
+	}
+	Host_user *hu= new(ptr) Host_user(id, host);
+	if (!hu->id || !hu->host) {
+		free_host_user(hu);
+		return nullptr;
+	}
+	return hu;
+}
+
+
+/* GLOBAL VARIABLES 2 */
+/* This unordered_map should use Tracking_allocator with memory_key_d */
+/* The Host_user * vector should also allocate with memory_key_d */
+typedef Tracking_allocator<Host_user *> Host_user_ptr_allocator;
+typedef Small_vector<Host_user *, 4, Host_user_ptr_allocator>
+		Host_user_ptr_vector;
+/* The keys are views of the interned ids */
+typedef Tracking_allocator<pair<const string_view, Host_user_ptr_vector>>
+		Name_hu_pair_allocator;
+typedef scoped_allocator_adaptor<Name_hu_pair_allocator,
+		Host_user_ptr_allocator> Name_to_users_allocator;
+typedef unordered_map<string_view, Host_user_ptr_vector, Name_hash,
+		equal_to<>, Name_to_users_allocator> Name_to_users_map;
+
+/* only touched by the (one) thread which loads and changes users */
+Name_to_users_map *name_to_users= nullptr;
+Host_index *host_index= nullptr;	/* with memory_key_g */
+Host_user *retired_users= nullptr;
+
+/* the frozen trie and wildcard bucket of host_index, see Host_index */
+struct Host_index_node;
+struct Host_index_users;
+struct Host_index_version {
+	const Host_index_node *root;
+	const Host_index_users *wildcards;
+};
+
+/* an immutable copy of name_to_users, which may be NULL, and a version
+   of host_index */
+struct Users_snapshot {
+	const Name_to_users_map *map;
+	Host_index_version index;
+	int has_index;
+};
+
+/* what the readers see, see Users_read_guard */
+atomic<const Users_snapshot *> published_users(nullptr);
+/* END GLOBAL VARIABLES 2 */
+
+
+/*
+Readers never take a lock.
+
+Many threads look users up, while one admin thread occasionally
+changes them. The admin thread works on its own name_to_users and
+host_index, and publish_name_to_users() copies the map, and freezes a
+version of the index, in a new immutable Users_snapshot, swaps that in
+with an atomic pointer exchange, and then waits for the readers of the
+old snapshot to drain before freeing it, along with any Host_user, or
+part of the index, which was removed or replaced in the meantime.
+
+Draining is epoch based: a reader records the global epoch in its own
+cache line while it holds a Users_read_guard. After the swap, the
+admin thread advances the epoch and waits until every slot is either
+idle or has seen the new epoch.
+
+The interned id and host of a user are released by ~Host_user, so they
+go through the same drain: free_retired_users() only calls
+free_host_user() after swap_published_users() has waited in
+synchronize_users_readers().
+*/
+#ifndef USERS_MAX_READERS
+#define USERS_MAX_READERS 256
+#endif
+
+struct alignas(TRACKING_CACHE_LINE) Users_reader_slot {
+	atomic<unsigned long> epoch;	/* 0 when not reading */
+	atomic<int> in_use;
+};
+
+static Users_reader_slot users_reader_slots[USERS_MAX_READERS];
+static atomic<unsigned long> users_epoch(1);
+
+
+/* claims a slot for the life of the calling thread */
+class Users_reader_registration {
+public:
+	Users_reader_slot *slot;
+	unsigned depth;
+
+	Users_reader_registration() : slot(nullptr), depth(0)
+	{
+		for (size_t i= 0; i < USERS_MAX_READERS; ++i) {
+			int unused= 0;
+			if (users_reader_slots[i].in_use.compare_exchange_strong
+			    (unused, 1)) {
+				slot= &users_reader_slots[i];
+				return;
+			}
+		}
+		fprintf(stderr, "more than %d reader threads\n",
+			USERS_MAX_READERS);
+		abort();
+	}
+
+	~Users_reader_registration()
+	{
+		slot->epoch.store(0, memory_order_release);
+		slot->in_use.store(0, memory_order_release);
+	}
+};
+
+
+class Users_read_guard {
+	Users_reader_registration *m_reader;
+	const Users_snapshot *m_users;
+
+	static Users_reader_registration *reader()
+	{
+		static thread_local Users_reader_registration registration;
+		return &registration;
+	}
+
+public:
+	Users_read_guard() : m_reader(reader())
+	{
+		/* guards may nest, the outer one holds the epoch */
+		if (m_reader->depth++ == 0) {
+			m_reader->slot->epoch.store(users_epoch.load());
+		}
+		m_users= published_users.load();
+	}
+
+	~Users_read_guard()
+	{
+		if (--m_reader->depth == 0) {
+			m_reader->slot->epoch.store(0, memory_order_release);
+		}
+	}
+
+	Users_read_guard(const Users_read_guard &)= delete;
+	Users_read_guard &operator=(const Users_read_guard &)= delete;
+
+	/* may be NULL if no users have been published */
+	const Name_to_users_map *map() const
+	{
+		return m_users ? m_users->map : nullptr;
+	}
+
+	/* may be NULL if the users have no index */
+	const Host_index_version *index() const
+	{
+		return (m_users && m_users->has_index) ? &m_users->index
+						       : nullptr;
+	}
+};
+
+
+/* waits until no reader can still see what was unpublished */
+static void synchronize_users_readers(void)
+{
+	unsigned long epoch= users_epoch.fetch_add(1) + 1;
+
+	for (size_t i= 0; i < USERS_MAX_READERS; ++i) {
+		Users_reader_slot *slot= &users_reader_slots[i];
+		unsigned long seen;
+		while ((seen= slot->epoch.load()) != 0 && seen < epoch) {
+			this_thread::yield();
+		}
+	}
+}
+
+
+static Name_to_users_map *new_name_to_users(void)
+{
+	Name_hu_pair_allocator outer(memory_key_d);
+	Host_user_ptr_allocator inner(memory_key_d);
+	Name_to_users_allocator adapter(outer, inner);
+
+	size_t size= sizeof(Name_to_users_map);
+	return new(tracking_malloc(memory_key_d, size))
+	    Name_to_users_map(adapter);
+}
+
+
+static void delete_name_to_users(const Name_to_users_map *map)
+{
+	if (!map)
+		return;
+
+	map->~unordered_map();
+	tracking_free((void *)map);
+}
+
+
+static void retire_user(Host_user *hu)
+{
+	hu->next_retired= retired_users;
+	retired_users= hu;
+}
+
+
+static void free_retired_users(void)
+{
+	while (retired_users) {
+		Host_user *hu= retired_users;
+		retired_users= hu->next_retired;
+		free_host_user(hu);
+	}
+}
+
+
+/*
+Host pattern index.
+
+Like MariaDB and MySQL accounts, a host may be a pattern, so finding
+the accounts a client at some address may use means matching each
+host of that id. name_to_users gives the hosts of an id, but some ids
+have thousands of them. The index is keyed by host instead:
+
+ - an address, a CIDR prefix (10.0.0.0/8 or fd00::/8), a netmask
+   (10.0.0.0/255.0.0.0), or whole leading octets and a '%' (10.0.%),
+   is a prefix of a 128 bit address, IPv4 being mapped into IPv6 as
+   ::ffff:a.b.c.d, and goes in a path-compressed binary radix trie
+ - anything else, such as '%' or '%.example.com', goes in the
+   wildcard bucket, and is matched as a LIKE pattern with '%' and '_'
+
+A lookup walks the trie once along the bits of the client address,
+so it takes O(address bits) steps, however many hosts there are.
+The users of each trie node, and of the bucket, are sorted by the
+address of their interned id, so the id is compared by pointer. They
+are kept out of line, so the fork nodes, which have none, stay small.
+
+Like name_to_users, the index belongs to the thread which changes the
+users; it is rebuilt by build_name_to_users() and patched by add_user
+and friends. It is not copied for the readers: publish() hands them
+the current root and bucket, which are frozen from then on. A change
+copies the frozen nodes on the way to the node it changes, and the
+users it changes, so a snapshot shares every subtree which did not
+change since the one before. What was replaced is retired, and freed
+once the readers of the snapshots which may still see it have gone.
+*/
+typedef unsigned __int128 Host_addr;
+
+#define Host_addr_bits 128
+#define Host_ipv4_mapped_bits 96
+
+static Host_addr host_addr_mask(unsigned len)
+{
+	return len ? ((~(Host_addr)0) << (Host_addr_bits - len)) : 0;
+}
+
+static unsigned host_addr_bit(Host_addr addr, unsigned i)
+{
+	return (unsigned)(addr >> (Host_addr_bits - 1 - i)) & 1U;
+}
+
+/* how many leading bits of a and b are the same, at most max */
+static unsigned host_addr_common(Host_addr a, Host_addr b, unsigned max)
+{
+	Host_addr diff= a ^ b;
+	uint64_t hi= (uint64_t)(diff >> 64);
+	uint64_t lo= (uint64_t)diff;
+	unsigned common= hi ? __builtin_clzll(hi)
+	    : (lo ? (64 + __builtin_clzll(lo)) : Host_addr_bits);
+	return (common < max) ? common : max;
+}
+
+static Host_addr host_addr_from_ipv4(const struct in_addr *in)
+{
+	return (((Host_addr)0xFFFF) << 32) | ntohl(in->s_addr);
+}
+
+static Host_addr host_addr_from_ipv6(const struct in6_addr *in6)
+{
+	Host_addr addr= 0;
+	for (size_t i= 0; i < sizeof(in6->s6_addr); ++i) {
+		addr= (addr << 8) | in6->s6_addr[i];
+	}
+	return addr;
+}
+
+/* returns 1 if s is an IPv4 or IPv6 address */
+static int host_addr_parse(const char *s, Host_addr *addr, unsigned *bits)
+{
+	struct in_addr in;
+	struct in6_addr in6;
+
+	if (inet_pton(AF_INET, s, &in) == 1) {
+		*addr= host_addr_from_ipv4(&in);
+		*bits= 32;
+		return 1;
+	}
+	if (inet_pton(AF_INET6, s, &in6) == 1) {
+		*addr= host_addr_from_ipv6(&in6);
+		*bits= Host_addr_bits;
+		return 1;
+	}
+	return 0;
+}
+
+/* returns 1 if host is an address prefix, see above */
+static int host_pattern_prefix(const char *host, Host_addr *prefix,
+			       unsigned *len)
+{
+	char buf[INET6_ADDRSTRLEN + 1];
+	size_t host_len= strlen(host);
+	unsigned bits;
+
+	if (host_len >= sizeof(buf) || !host_len) {
+		return 0;
+	}
+	memcpy(buf, host, host_len + 1);
+
+	/* leading octets and a '%' */
+	if (host_len > 2 && !strcmp(buf + host_len - 2, ".%")) {
+		unsigned octets= 0;
+		uint32_t ipv4= 0;
+		for (const char *p= buf; *p != '%'; ++octets) {
+			char *end;
+			if (*p < '0' || *p > '9' || octets == 3) {
+				return 0;
+			}
+			unsigned long octet= strtoul(p, &end, 10);
+			if (octet > 255 || *end != '.') {
+				return 0;
+			}
+			ipv4= (ipv4 << 8) | octet;
+			p= end + 1;
+		}
+		struct in_addr in;
+		in.s_addr= htonl(ipv4 << (8 * (4 - octets)));
+		*prefix= host_addr_from_ipv4(&in);
+		*len= Host_ipv4_mapped_bits + (8 * octets);
+		return 1;
+	}
+
+	char *slash= strchr(buf, '/');
+	if (slash) {
+		*slash= '\0';
+	}
+	if (!host_addr_parse(buf, prefix, &bits)) {
+		return 0;
+	}
+	*len= Host_addr_bits;
+	if (slash) {
+		const char *suffix= slash + 1;
+		unsigned mask_bits;
+		Host_addr mask;
+		if (bits == 32 && strchr(suffix, '.')) {
+			/* a netmask, which must be contiguous */
+			if (!host_addr_parse(suffix, &mask, &mask_bits)
+			    || mask_bits != 32) {
+				return 0;
+			}
+			uint32_t m= (uint32_t)mask;
+			if ((~m) & ((~m) + 1)) {
+				return 0;
+			}
+			mask_bits= __builtin_popcount(m);
+		} else {
+			char *end;
+			unsigned long n= strtoul(suffix, &end, 10);
+			if (*suffix < '0' || *suffix > '9' || *end || n > bits) {
+				return 0;
+			}
+			mask_bits= (unsigned)n;
+		}
+		*len= (Host_addr_bits - bits) + mask_bits;
+	}
+	*prefix&= host_addr_mask(*len);
+	return 1;
+}
+
+/* SQL LIKE, with '%' for any run of characters and '_' for one */
+static int host_like(const char *pattern, const char *s)
+{
+	const char *star= nullptr;
+	const char *star_s= nullptr;
+
+	while (*s) {
+		if (*pattern == '%') {
+			star= pattern++;
+			star_s= s;
+		} else if (*pattern == '_' || *pattern == *s) {
+			++pattern;
+			++s;
+		} else if (star) {
+			pattern= star + 1;
+			s= ++star_s;
+		} else {
+			return 0;
+		}
+	}
+	while (*pattern == '%') {
+		++pattern;
+	}
+	return *pattern == '\0';
+}
+
+/* the definition of a match, which the index must agree with */
+int host_pattern_matches(const char *pattern, const char *client)
+{
+	Host_addr prefix, addr;
+	unsigned len, bits;
+
+	if (host_pattern_prefix(pattern, &prefix, &len)) {
+		return host_addr_parse(client, &addr, &bits)
+		    && host_addr_common(prefix, addr, len) == len;
+	}
+	return host_like(pattern, client);
+}
+
+
+/* the users of a trie node, or of the wildcard bucket */
+struct Host_index_users {
+	unsigned gen;		/* see Host_index */
+	unsigned count;
+	size_t capacity;
+	/* followed by capacity users, sorted by id address */
+
+	Host_user **users() { return (Host_user **)(this + 1); }
+	Host_user *const *users() const
+	{
+		return (Host_user *const *)(this + 1);
+	}
+};
+
+struct Host_index_node {
+	Host_addr prefix;	/* bits past len are zero */
+	unsigned len;
+	unsigned gen;		/* see Host_index */
+	Host_index_node *child[2];
+	Host_index_users *users;	/* NULL if none */
+};
+
+
+class Host_index {
+	typedef Host_index_node Node;
+	typedef Host_index_users Users;
+	typedef vector<void *, Tracking_allocator<void *>> Retired_vector;
+
+	Tracking_memory_key m_key;
+	Node *m_root;
+	Users *m_wildcards;
+	size_t m_nodes;
+	/* nodes and users of an older generation have been published, so
+	   are frozen */
+	unsigned m_gen;
+	/* frozen, and no longer in the trie: nodes alone, users, and
+	   whole subtrees, which free_retired() frees */
+	Retired_vector m_retired_nodes;
+	Retired_vector m_retired_users;
+	Retired_vector m_retired_trees;
+
+	/* orders users, and finds the users of an interned id */
+	struct Id_less {
+		static uintptr_t id(const Host_user *hu)
+		{
+			return (uintptr_t)hu->id;
+		}
+		static uintptr_t id(const char *id) { return (uintptr_t)id; }
+
+		template <class A, class B>
+		bool operator()(const A &a, const B &b) const
+		{
+			return id(a) < id(b);
+		}
+	};
+
+	static size_t users_size(size_t capacity)
+	{
+		return sizeof(Users) + capacity * sizeof(Host_user *);
+	}
+
+	Node *new_node(Host_addr prefix, unsigned len)
+	{
+		Node *node= (Node *)tracking_node_alloc(m_key, sizeof(Node));
+		if (!node) {
+			return nullptr;
+		}
+		node->prefix= prefix;
+		node->len= len;
+		node->gen= m_gen;
+		node->child[0]= node->child[1]= nullptr;
+		node->users= nullptr;
+		++m_nodes;
+		return node;
+	}
+
+	void free_node(Node *node)
+	{
+		tracking_node_free(m_key, node, sizeof(Node));
+	}
+
+	void free_users(Users *users)
+	{
+		if (users) {
+			tracking_node_free(m_key, users,
+					   users_size(users->capacity));
+		}
+	}
+
+	/* frees a subtree and its users, which nothing else refers to */
+	void free_tree(Node *node)
+	{
+		if (!node) {
+			return;
+		}
+		free_tree(node->child[0]);
+		free_tree(node->child[1]);
+		free_users(node->users);
+		free_node(node);
+	}
+
+	void drop_users(Users *users)
+	{
+		if (users && users->gen != m_gen) {
+			m_retired_users.push_back(users);
+		} else {
+			free_users(users);
+		}
+	}
+
+	/* removes a subtree, retiring what is frozen and freeing the
+	   rest */
+	void drop_nodes(Node *node)
+	{
+		if (!node) {
+			return;
+		}
+		if (node->gen != m_gen) {
+			m_retired_trees.push_back(node);
+			return;
+		}
+		drop_nodes(node->child[0]);
+		drop_nodes(node->child[1]);
+		drop_users(node->users);
+		free_node(node);
+	}
+
+	/* returns *link, which is first replaced by a copy if it is
+	   frozen; NULL if out of memory */
+	Node *writable(Node **link)
+	{
+		Node *node= *link;
+		if (node->gen == m_gen) {
+			return node;
+		}
+		m_retired_nodes.push_back(node);
+		Node *copy= (Node *)tracking_node_alloc(m_key, sizeof(Node));
+		if (!copy) {
+			m_retired_nodes.pop_back();
+			return nullptr;
+		}
+		*copy= *node;
+		copy->gen= m_gen;
+		*link= copy;
+		return copy;
+	}
+
+	/* returns *link with room for more users, which is first replaced
+	   by a copy if it is frozen or full; NULL if out of memory */
+	Users *writable(Users **link, size_t more)
+	{
+		Users *users= *link;
+		size_t count= users ? users->count : 0;
+		int frozen= users && users->gen != m_gen;
+		if (users && !frozen && count + more <= users->capacity) {
+			return users;
+		}
+		/* a frozen list is copied once per publish, so it is not
+		   given room to grow */
+		size_t capacity= (users && !frozen) ? 2 * users->capacity
+						    : count + more;
+		if (frozen) {
+			m_retired_users.push_back(users);
+		}
+		Users *copy= (Users *)tracking_node_alloc(m_key,
+							  users_size(capacity));
+		if (!copy) {
+			if (frozen) {
+				m_retired_users.pop_back();
+			}
+			return nullptr;
+		}
+		copy->gen= m_gen;
+		copy->count= count;
+		copy->capacity= capacity;
+		if (count) {
+			memcpy(copy->users(), users->users(),
+			       count * sizeof(Host_user *));
+		}
+		if (!frozen) {
+			free_users(users);
+		}
+		*link= copy;
+		return copy;
+	}
+
+	/* returns the node for exactly prefix/len, adding it if need be,
+	   and makes the path to it writable */
+	Node *insert(Host_addr prefix, unsigned len)
+	{
+		Node **link= &m_root;
+		Node *node;
+
+		while ((node= *link) != nullptr) {
+			unsigned max= (node->len < len) ? node->len : len;
+			unsigned common= host_addr_common(node->prefix, prefix,
+							  max);
+			if (common == node->len) {
+				node= writable(link);
+				if (!node) {
+					return nullptr;
+				}
+				if (len == node->len) {
+					return node;
+				}
+				link= &node->child[host_addr_bit(prefix,
+								 node->len)];
+				continue;
+			}
+			/* prefix/len and node part ways after common bits */
+			Node *added= new_node(prefix, len);
+			if (!added) {
+				return nullptr;
+			}
+			if (common == len) {
+				added->child[host_addr_bit(node->prefix, len)]=
+				    node;
+				*link= added;
+				return added;
+			}
+			Node *fork= new_node(prefix & host_addr_mask(common),
+					     common);
+			if (!fork) {
+				free_node(added);
+				--m_nodes;
+				return nullptr;
+			}
+			fork->child[host_addr_bit(prefix, common)]= added;
+			fork->child[host_addr_bit(node->prefix, common)]= node;
+			*link= fork;
+			return added;
+		}
+		*link= new_node(prefix, len);
+		return *link;
+	}
+
+	const Node *find(Host_addr prefix, unsigned len) const
+	{
+		const Node *node= m_root;
+		while (node && node->len <= len) {
+			if (host_addr_common(node->prefix, prefix, node->len)
+			    < node->len) {
+				return nullptr;
+			}
+			if (node->len == len) {
+				return node;
+			}
+			node= node->child[host_addr_bit(prefix, node->len)];
+		}
+		return nullptr;
+	}
+
+	/* returns the users of host, which may be NULL */
+	const Users *users_of(const char *host) const
+	{
+		Host_addr prefix;
+		unsigned len;
+		if (!host_pattern_prefix(host, &prefix, &len)) {
+			return m_wildcards;
+		}
+		const Node *node= find(prefix, len);
+		return node ? node->users : nullptr;
+	}
+
+	/* returns where the users of host are kept, adding a node for it
+	   and making the path to it writable; NULL if out of memory */
+	Users **users_link(const char *host)
+	{
+		Host_addr prefix;
+		unsigned len;
+		if (!host_pattern_prefix(host, &prefix, &len)) {
+			return &m_wildcards;
+		}
+		Node *node= insert(prefix, len);
+		return node ? &node->users : nullptr;
+	}
+
+	static Host_user *const *find_user(const Users *users, Host_user *hu)
+	{
+		Host_user *const *begin= users->users();
+		auto range= equal_range(begin, begin + users->count, hu,
+					Id_less());
+		for (auto it= range.first; it != range.second; ++it) {
+			if (*it == hu) {
+				return it;
+			}
+		}
+		return nullptr;
+	}
+
+	static void append_id(const Users *users, const char *id,
+			      const char *client, int like,
+			      Host_user_ptr_vector *matches)
+	{
+		if (!users) {
+			return;
+		}
+		Host_user *const *begin= users->users();
+		auto range= equal_range(begin, begin + users->count, id,
+					Id_less());
+		for (auto it= range.first; it != range.second; ++it) {
+			if (!like || host_like((*it)->host, client)) {
+				matches->push_back(*it);
+			}
+		}
+	}
+
+public:
+	explicit Host_index(Tracking_memory_key key)
+		: m_key(key), m_root(nullptr), m_wildcards(nullptr),
+		  m_nodes(0), m_gen(0),
+		  m_retired_nodes(Tracking_allocator<void *>(key)),
+		  m_retired_users(Tracking_allocator<void *>(key)),
+		  m_retired_trees(Tracking_allocator<void *>(key))
+	{}
+
+	/* no version of it may still be published */
+	~Host_index()
+	{
+		free_tree(m_root);
+		free_users(m_wildcards);
+		free_retired();
+	}
+
+	Host_index(const Host_index &)= delete;
+	Host_index &operator=(const Host_index &)= delete;
+
+	/* returns 0 on success */
+	int add(Host_user *hu)
+	{
+		Users **link= users_link(hu->host);
+		Users *users= link ? writable(link, 1) : nullptr;
+		if (!users) {
+			return 1;
+		}
+		Host_user **begin= users->users();
+		Host_user **end= begin + users->count;
+		Host_user **pos= upper_bound(begin, end, hu, Id_less());
+		memmove(pos + 1, pos, (end - pos) * sizeof(*pos));
+		*pos= hu;
+		++users->count;
+		return 0;
+	}
+
+	/* returns 0 if hu was removed, 1 if it was not in the index, or -1
+	   if out of memory, and then it is still there; trie nodes are
+	   kept, as the same hosts tend to come back */
+	int remove(Host_user *hu)
+	{
+		const Users *found= users_of(hu->host);
+		if (!found || !find_user(found, hu)) {
+			return 1;
+		}
+		Users **link= users_link(hu->host);
+		Users *users= link ? writable(link, 0) : nullptr;
+		if (!users) {
+			return -1;
+		}
+		Host_user **pos= (Host_user **)find_user(users, hu);
+		Host_user **end= users->users() + users->count;
+		memmove(pos, pos + 1, (end - pos - 1) * sizeof(*pos));
+		if (--users->count == 0) {
+			free_users(users);
+			*link= nullptr;
+		}
+		return 0;
+	}
+
+	void clear()
+	{
+		drop_nodes(m_root);
+		m_root= nullptr;
+		m_nodes= 0;
+		drop_users(m_wildcards);
+		m_wildcards= nullptr;
+	}
+
+	/* freezes the index as it is, for the readers */
+	Host_index_version publish()
+	{
+		Host_index_version version= { m_root, m_wildcards };
+		++m_gen;
+		return version;
+	}
+
+	/* frees what was retired, which no reader may still see */
+	void free_retired()
+	{
+		for (void *node : m_retired_nodes) {
+			free_node((Node *)node);
+		}
+		for (void *users : m_retired_users) {
+			free_users((Users *)users);
+		}
+		for (void *node : m_retired_trees) {
+			free_tree((Node *)node);
+		}
+		m_retired_nodes.clear();
+		m_retired_users.clear();
+		m_retired_trees.clear();
+	}
+
+	/* of the current trie, not counting those only kept for readers */
+	size_t nodes() const { return m_nodes; }
+
+	/*
+	Appends the users id@pattern of version whose pattern matches
+	client, most specific first: the longest address prefix first,
+	then those in the wildcard bucket. As the users are found by the
+	address of their id, interned must be the interned id itself.
+	*/
+	static size_t match(const Host_index_version &version,
+			    const char *interned, const char *client,
+			    Host_user_ptr_vector *matches)
+	{
+		size_t before= matches->size();
+		Host_addr addr;
+		unsigned bits;
+		if (host_addr_parse(client, &addr, &bits)) {
+			for (const Node *node= version.root; node; ) {
+				if (host_addr_common(node->prefix, addr,
+						     node->len) < node->len) {
+					break;
+				}
+				append_id(node->users, interned, client, 0,
+					  matches);
+				if (node->len == Host_addr_bits) {
+					break;
+				}
+				node= node->child[host_addr_bit(addr,
+								node->len)];
+			}
+			/* the walk went from short to long prefixes */
+			reverse(matches->begin() + before, matches->end());
+		}
+		append_id(version.wildcards, interned, client, 1, matches);
+		return matches->size() - before;
+	}
+};
+
+
+static Host_index *new_host_index(void)
+{
+	void *ptr= tracking_malloc(memory_key_g, sizeof(Host_index));
+	return ptr ? new(ptr) Host_index(memory_key_g) : nullptr;
+}
+
+
+static int build_host_index(void)
+{
+	if (!host_index) {
+		host_index= new_host_index();
+		if (!host_index) {
+			return 1;
+		}
+	}
+	host_index->clear();
+	for (size_t i= 0; i < all_users_len; ++i) {
+		if (host_index->add(all_users[i])) {
+			return 1;
+		}
+	}
+	return 0;
+}
 
-	strcpy(dup, s);
 
-	return dup;
+/* nothing of it may still be published */
+static void free_host_index(void)
+{
+	if (!host_index) {
+		return;
+	}
+	host_index->~Host_index();
+	tracking_free(host_index);
+	host_index= nullptr;
 }
 
 
-#ifndef BOGUS_HOST_USER_INCLUDED
-#define BOGUS_HOST_USER_INCLUDED
-class Host_user {
-public:
-	const char *id;
-	const char *host;
+static void delete_users_snapshot(const Users_snapshot *users)
+{
+	if (!users) {
+		return;
+	}
+	delete_name_to_users(users->map);
+	tracking_free((void *)users);
+}
 
-	 Host_user(const char *id, const char *host) {
-		this->id= tracking_strdup(memory_key_b, id ? id : "");
-		this->host=
-		    tracking_strdup(memory_key_b, host ? host : "localhost");
-	};
-	~Host_user() {
-		tracking_free((void *)this->id);
-		tracking_free((void *)this->host);
-	};
-};
 
-class Host_user_compare :
-  public std::binary_function<Host_user, Host_user, bool>
+/* swaps the readers over to users, which may be NULL, and reclaims the
+   old snapshot, the retired users and what was retired of the index
+   once the readers have moved on */
+static void swap_published_users(const Users_snapshot *users)
 {
-public:
-  bool operator()(const Host_user &a, const Host_user &b)
-  {
-    return !(strcmp(a.host, b.host) <= 0 || strcmp(a.id, b.id) <= 0);
-  }
-  bool operator()(const Host_user *a, const Host_user *b)
-  {
-    return !(strcmp(a->host, b->host) <= 0 || strcmp(a->id, b->id) <= 0);
-  }
-};
-#endif // BOGUS_HOST_USER_INCLUDED
+	const Users_snapshot *old= published_users.exchange(users);
+	synchronize_users_readers();
+	delete_users_snapshot(old);
+	free_retired_users();
+	if (host_index) {
+		host_index->free_retired();
+	}
+}
 
 
-/* GLOBAL VARIABLES 2 */
-/* This unordered_map should use Tracking_allocator with memory_key_d */
-/* The list<Host_user *> should also allocate with memory_key_d */
-typedef Tracking_allocator<Host_user *> Host_user_ptr_allocator;
-typedef list<Host_user *, Host_user_ptr_allocator> Host_user_ptr_list;
-typedef Tracking_allocator<pair<const string, Host_user_ptr_list>>
-		Name_hu_pair_allocator;
-typedef scoped_allocator_adaptor<Name_hu_pair_allocator,
-		Host_user_ptr_allocator> Name_to_users_allocator;
-typedef unordered_map<string, Host_user_ptr_list, hash<string>,
-		equal_to<string>, Name_to_users_allocator> Name_to_users_map;
+/*
+Makes the changes to name_to_users and host_index visible to readers;
+returns 0 on success.
 
-Name_to_users_map *name_to_users= nullptr;
-/* END GLOBAL VARIABLES 2 */
+This copies the whole map, so it costs as much as all the users, not
+as much as the changes since the last call: publish once after a batch
+of add_user, remove_user and update_user_host calls, never after each
+of them. The index is not copied, only the parts of it which changed.
+*/
+int publish_name_to_users(void)
+{
+	Users_snapshot *copy= (Users_snapshot *)
+	    tracking_malloc(memory_key_d, sizeof(Users_snapshot));
+	if (!copy) {
+		return 1;
+	}
+	copy->map= nullptr;
+	copy->has_index= 0;
+	if (name_to_users) {
+		Name_to_users_map *map= new_name_to_users();
+		if (!map) {
+			delete_users_snapshot(copy);
+			return 1;
+		}
+		*map= *name_to_users;
+		copy->map= map;
+	}
+	if (host_index) {
+		copy->index= host_index->publish();
+		copy->has_index= 1;
+	}
+	swap_published_users(copy);
+	return 0;
+}
+
+
+/*
+Appends the users which client may connect as id as, most specific
+first; returns how many were found. They are those of the snapshot of
+guard, so may only be used while the guard is held.
+*/
+size_t match_users(const Users_read_guard &guard, const char *id,
+		   const char *client, Host_user_ptr_vector *matches)
+{
+	const Name_to_users_map *map= guard.map();
+	const Host_index_version *index= guard.index();
+	if (!map || !index) {
+		return 0;
+	}
+	/* the key is a view of the interned id, so the pool, and its
+	   locks, are not needed to find it */
+	auto it= map->find(string_view(id));
+	if (it == map->end()) {
+		return 0;	/* no such id at all */
+	}
+	return Host_index::match(*index, it->first.data(), client, matches);
+}
 
 
 void free_name_to_users(void)
 {
-	if (!name_to_users)
-		return;
+	swap_published_users(nullptr);
+	free_host_index();
 
-	name_to_users->~unordered_map();
-	tracking_free(name_to_users);
+	delete_name_to_users(name_to_users);
 	name_to_users= nullptr;
 }
 
@@ -290,18 +2789,61 @@ void clear_all_users()
 		return;
 
 	for (size_t i= 0; all_users[i] != nullptr; ++i) {
-		all_users[i]->~Host_user();	/* destroy */
-		tracking_free(all_users[i]);	/* free */
+		free_host_user(all_users[i]);
 		all_users[i]= nullptr;
 	}
 	tracking_free(all_users);
 	all_users= nullptr;
+	all_users_len= 0;
+	all_users_size= 0;
+
+	free_user_strings();
+}
+
+
+/* users being reloaded are retired rather than freed, as readers may
+   still be looking at them until the new ones are published */
+static void retire_all_users(void)
+{
+	for (size_t i= 0; i < all_users_len; ++i) {
+		retire_user(all_users[i]);
+		all_users[i]= nullptr;
+	}
+	all_users_len= 0;
+}
+
+
+/* make room in all_users for len users, plus the NULL terminator */
+static int reserve_all_users(size_t len)
+{
+	if (len < all_users_size) {
+		return 0;
+	}
+	size_t slots= all_users_size ? all_users_size : 16;
+	while (slots <= len) {
+		slots*= 2;
+	}
+	size_t size= slots * sizeof(Host_user *);
+	Host_user **users= (Host_user **)tracking_malloc(memory_key_a, size);
+	if (!users) {
+		return 1;
+	}
+	if (all_users_len) {
+		memcpy(users, all_users, all_users_len * sizeof(Host_user *));
+	}
+	users[all_users_len]= nullptr;
+	tracking_free(all_users);
+	all_users= users;
+	all_users_size= slots;
+	return 0;
 }
 
 
 void build_name_to_users()
 {
-	fprintf(stderr, "build_name_to_users()\n");
+	if (unlikely(tracking_trace)) {
+		fprintf(stderr, "build_name_to_users()\n");
+	}
 
 	if (!all_users) {
 		goto end_build_name_to_users;
@@ -310,37 +2852,180 @@ void build_name_to_users()
 	if (name_to_users) {
 		name_to_users->clear();
 	} else {
-		Name_hu_pair_allocator outer(memory_key_d);
-		Host_user_ptr_allocator inner(memory_key_d);
-		Name_to_users_allocator adapter(outer, inner);
-
-		size_t size= sizeof(Name_to_users_map);
-		name_to_users= new(tracking_malloc(memory_key_d, size))
-		    Name_to_users_map(adapter);
+		name_to_users= new_name_to_users();
 	}
+	/* at most one name per user */
+	name_to_users->reserve(all_users_len);
 	for (size_t i= 0; all_users[i]; ++i) {
 		Host_user *hu= all_users[i];
-		string name= hu->id ? hu->id : "";
-		auto *list= &((*name_to_users)[name]);
-		list->push_back(hu);
-		// XXX: FIXME: FIXXXME: This sort complains about the allocator
-		// list->sort(Host_user_compare());
+		(*name_to_users)[hu->id].push_back(hu);
+	}
+	for (auto it= name_to_users->begin(); it != name_to_users->end();
+	     ++it) {
+		sort(it->second.begin(), it->second.end(),
+		     Host_user_compare());
 	}
+	if (build_host_index()) {
+		fprintf(stderr, "could not build the host index\n");
+	}
+
+	publish_name_to_users();
 
 end_build_name_to_users:
-	fprintf(stderr, "build_name_to_users() done\n");
+	if (unlikely(tracking_trace)) {
+		fprintf(stderr, "build_name_to_users() done\n");
+	}
 }
 
 
-void load_all_users()
+/*
+Patching name_to_users in place, rather than rebuilding all of it for
+every change. build_name_to_users() remains the bulk-load path.
+
+Each user remembers its position in all_users, so it can be swapped
+with the last one and removed in constant time. The per-name vectors
+are kept sorted, and as they are short, finding a user in one is
+constant time as well.
+
+Readers do not see these changes until publish_name_to_users() is
+called, which copies the map and the index, so a batch of changes must
+be published once, at the end. Removed users are only freed then, too.
+*/
+static Host_user_ptr_vector *find_users(const char *id)
+{
+	if (!name_to_users) {
+		return nullptr;
+	}
+	auto it= name_to_users->find(string_view(id));
+	return (it == name_to_users->end()) ? nullptr : &it->second;
+}
+
+
+static Host_user **find_user(Host_user_ptr_vector *users, const char *host)
+{
+	for (auto it= users->begin(); it != users->end(); ++it) {
+		if (strcmp((*it)->host, host) == 0) {
+			return it;
+		}
+	}
+	return nullptr;
+}
+
+
+static void insert_sorted(Host_user_ptr_vector *users, Host_user *hu)
+{
+	auto pos= upper_bound(users->begin(), users->end(), hu,
+			      Host_user_compare());
+	users->insert(pos, hu);
+}
+
+
+/* returns NULL if out of memory; the new user is not seen by readers,
+   nor by user_may_connect and match_users, until the next
+   publish_name_to_users() */
+Host_user *add_user(const char *id, const char *host)
+{
+	if (!name_to_users) {
+		name_to_users= new_name_to_users();
+	}
+	if (reserve_all_users(all_users_len + 1)) {
+		return nullptr;
+	}
+
+	Host_user *hu= new_host_user(id, host);
+	if (!hu) {
+		return nullptr;
+	}
+	hu->all_users_index= all_users_len;
+	all_users[all_users_len++]= hu;
+	all_users[all_users_len]= nullptr;
+
+	insert_sorted(&((*name_to_users)[hu->id]), hu);
+	if (host_index ? host_index->add(hu) : build_host_index()) {
+		fprintf(stderr, "could not index `%s`@`%s`\n", hu->id,
+			hu->host);
+	}
+	return hu;
+}
+
+
+/* returns 0 if the user was removed, 1 if there was no such user; it
+   stays visible to readers, and allocated, until the next publish */
+int remove_user(const char *id, const char *host)
+{
+	Host_user_ptr_vector *users= find_users(id);
+	Host_user **pos= users ? find_user(users, host) : nullptr;
+	if (!pos) {
+		return 1;
+	}
+	Host_user *hu= *pos;
+	users->erase(pos);
+	if (users->empty()) {
+		name_to_users->erase(string_view(hu->id));
+	}
+
+	/* swap the last user into the hole */
+	Host_user *last= all_users[--all_users_len];
+	last->all_users_index= hu->all_users_index;
+	all_users[hu->all_users_index]= last;
+	all_users[all_users_len]= nullptr;
+
+	/* hu is gone from all_users, so a rebuild drops it as well */
+	if (host_index && host_index->remove(hu) < 0 && build_host_index()) {
+		fprintf(stderr, "could not index the users\n");
+	}
+	retire_user(hu);
+	return 0;
+}
+
+
+/* returns 0 if the host was changed, 1 if there was no such user, or
+   -1 if out of memory, and then the host may have been changed without
+   being indexed; readers see the old host until the next publish */
+int update_user_host(const char *id, const char *old_host,
+		     const char *new_host)
 {
-	if (all_users) {
-		clear_all_users();
+	Host_user_ptr_vector *users= find_users(id);
+	Host_user **pos= users ? find_user(users, old_host) : nullptr;
+	if (!pos) {
+		return 1;
+	}
+	/* readers may be looking at the old one, so replace it */
+	Host_user *hu= *pos;
+	Host_user *moved= new_host_user(hu->id, new_host);
+	if (!moved) {
+		return -1;
+	}
+	moved->all_users_index= hu->all_users_index;
+	all_users[hu->all_users_index]= moved;
+
+	users->erase(pos);
+	insert_sorted(users, moved);
+	/* all_users has moved in place of hu, so a rebuild is right if
+	   there is no index yet, or hu could not be taken out of it */
+	int unindexed;
+	if (host_index && host_index->remove(hu) >= 0) {
+		unindexed= host_index->add(moved);
+	} else {
+		unindexed= build_host_index();
+	}
+	retire_user(hu);
+	if (unindexed) {
+		fprintf(stderr, "could not index `%s`@`%s`\n", moved->id,
+			moved->host);
+		return -1;
 	}
+	return 0;
+}
+
+
+void load_all_users()
+{
+	retire_all_users();
+
 	size_t all_user_len= 15;
 	size_t size= (all_user_len + 1) * sizeof(Host_user *);
-	all_users= (Host_user **) tracking_malloc(memory_key_a, size);
-	if (!all_users) {
+	if (reserve_all_users(all_user_len)) {
 		fprintf(stderr, "seriously? Couldn't allocate %lu bytes?\n",
 			(unsigned long)size);
 		exit(EXIT_FAILURE);
@@ -392,7 +3077,244 @@ void load_all_users()
 							       "10.8.0.7");
 	all_users[15]= NULL;
 
+	for (size_t i= 0; i < all_user_len; ++i) {
+		Host_user *hu= all_users[i];
+		if (!hu || !hu->id || !hu->host) {
+			fprintf(stderr, "seriously? Couldn't allocate user %lu?\n",
+				(unsigned long)i);
+			exit(EXIT_FAILURE);
+		}
+		hu->all_users_index= i;
+	}
+	all_users_len= all_user_len;
+
+	build_name_to_users();
+}
+
+
+/*
+Loading millions of users from a file of user@host lines.
+
+The file is mapped rather than read, and cut at line boundaries into a
+chunk per thread. In a first pass, each thread counts the users in its
+chunk, so each knows where its users go in all_users. All the
+Host_users are then allocated at once, as one Host_user_batch, and in
+a second pass the threads construct their users in place, interning
+the ids and hosts concurrently. Finally name_to_users is built and
+published as usual.
+
+Blank lines and lines starting with '#' are skipped, and a line with
+no '@' is a user with the default host.
+*/
+struct Users_file_chunk {
+	const char *begin;
+	const char *end;
+	size_t users;	/* counted by the first pass */
+	size_t first;	/* all_users index of the first user */
+	int failed;	/* some string of the chunk could not be interned */
+};
+
+
+/* returns 1 and the next user in [*pos, end), or 0 at the end */
+static int next_user_line(const char **pos, const char *end,
+			  string_view *id, string_view *host)
+{
+	while (*pos < end) {
+		const char *line= *pos;
+		const char *nl= (const char *)memchr(line, '\n', end - line);
+		const char *eol= nl ? nl : end;
+		*pos= nl ? (nl + 1) : end;
+
+		if (eol > line && eol[-1] == '\r') {
+			--eol;
+		}
+		if (eol == line || *line == '#') {
+			continue;
+		}
+		const char *at= (const char *)memchr(line, '@', eol - line);
+		*id= string_view(line, (at ? at : eol) - line);
+		*host= at ? string_view(at + 1, eol - (at + 1)) : string_view();
+		return 1;
+	}
+	return 0;
+}
+
+
+static void count_users_in_chunk(Users_file_chunk *chunk)
+{
+	string_view id, host;
+	const char *pos= chunk->begin;
+
+	chunk->users= 0;
+	while (next_user_line(&pos, chunk->end, &id, &host)) {
+		++chunk->users;
+	}
+}
+
+
+static void construct_users_in_chunk(Users_file_chunk *chunk,
+				     Host_user *users, Host_user_batch *batch)
+{
+	string_view id, host;
+	const char *pos= chunk->begin;
+
+	chunk->failed= 0;
+	for (size_t i= chunk->first;
+	     next_user_line(&pos, chunk->end, &id, &host); ++i) {
+		Host_user *hu= new(&users[i]) Host_user(id, host, batch);
+		hu->all_users_index= i;
+		if (!hu->id || !hu->host) {
+			chunk->failed= 1;
+		}
+	}
+}
+
+
+/* runs func on each chunk, one thread per chunk */
+template <class Func>
+static void for_each_users_chunk(vector<Users_file_chunk> &chunks, Func func)
+{
+	vector<thread> threads;
+	for (size_t i= 1; i < chunks.size(); ++i) {
+		threads.push_back(thread(func, &chunks[i]));
+	}
+	func(&chunks[0]);
+	for (size_t i= 0; i < threads.size(); ++i) {
+		threads[i].join();
+	}
+}
+
+
+/* replaces all users with those in the file at path, using threads
+   threads (0 for one per CPU); returns 0 on success */
+int load_all_users_from_file(const char *path, unsigned threads)
+{
+	int fd= open(path, O_RDONLY);
+	if (fd < 0) {
+		perror(path);
+		return 1;
+	}
+	struct stat st;
+	if (fstat(fd, &st)) {
+		perror(path);
+		close(fd);
+		return 1;
+	}
+	size_t len= (size_t)st.st_size;
+	const char *data= "";
+	if (len) {
+		void *map= mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) {
+			perror(path);
+			close(fd);
+			return 1;
+		}
+		madvise(map, len, MADV_SEQUENTIAL);
+		data= (const char *)map;
+	}
+	close(fd);
+
+	if (!threads) {
+		threads= thread::hardware_concurrency();
+	}
+	/* not worth a thread for less than a page or so */
+	size_t max_threads= (len / 4096) + 1;
+	if (!threads || threads > max_threads) {
+		threads= (threads ? max_threads : 1);
+	}
+
+	vector<Users_file_chunk> chunks(threads);
+	const char *end= data + len;
+	for (size_t i= 0; i < threads; ++i) {
+		const char *begin= data + ((len / threads) * i);
+		if (i) {
+			const char *nl= (const char *)
+			    memchr(begin - 1, '\n', end - (begin - 1));
+			begin= nl ? (nl + 1) : end;
+			chunks[i - 1].end= begin;
+		}
+		chunks[i].begin= begin;
+		chunks[i].end= end;
+	}
+
+	for_each_users_chunk(chunks, count_users_in_chunk);
+	size_t total= 0;
+	for (size_t i= 0; i < threads; ++i) {
+		chunks[i].first= total;
+		total+= chunks[i].users;
+	}
+
+	/* the old users stay published until the new ones are built, so
+	   they are only retired once nothing more can fail */
+	Host_user_batch *batch= nullptr;
+	Host_user *users= total ? alloc_host_user_batch(total, &batch)
+	    : nullptr;
+	/* create the pool before the threads intern into it */
+	if (create_user_strings() || reserve_all_users(total)
+	    || (total && !users)) {
+		fprintf(stderr, "could not allocate %lu users\n",
+			(unsigned long)total);
+		if (users) {
+			tracking_free(batch);
+		}
+		if (len) {
+			munmap((void *)data, len);
+		}
+		return 1;
+	}
+	/* the ids and hosts are often distinct, so one string per user */
+	user_strings->reserve(user_strings->size() + total);
+
+	for_each_users_chunk(chunks, [users, batch](Users_file_chunk *chunk) {
+		construct_users_in_chunk(chunk, users, batch);
+	});
+	if (len) {
+		munmap((void *)data, len);
+	}
+	int failed= 0;
+	for (size_t i= 0; i < threads; ++i) {
+		failed|= chunks[i].failed;
+	}
+	if (failed) {
+		fprintf(stderr, "could not intern the strings of %lu users\n",
+			(unsigned long)total);
+		/* never published, so they can go at once */
+		for (size_t i= 0; i < total; ++i) {
+			free_host_user(&users[i]);
+		}
+		return 1;
+	}
+
+	retire_all_users();
+	for (size_t i= 0; i < total; ++i) {
+		all_users[i]= &users[i];
+	}
+	all_users_len= total;
+	all_users[total]= nullptr;
+
 	build_name_to_users();
+	return 0;
+}
+
+
+/* returns 1 if there is a user id@host, safe to call from any thread */
+int user_may_connect(const char *id, const char *host)
+{
+	Users_read_guard guard;
+	const Name_to_users_map *map= guard.map();
+	if (!map) {
+		return 0;
+	}
+	auto it= map->find(string_view(id));
+	if (it == map->end()) {
+		return 0;
+	}
+	for (auto it2= it->second.begin(); it2 != it->second.end(); ++it2) {
+		if (strcmp((*it2)->host, host) == 0) {
+			return 1;
+		}
+	}
+	return 0;
 }
 
 
@@ -400,15 +3322,20 @@ int print_name_to_users(FILE *stream)
 {
 	int rv;			/* printf returns negative if error */
 	int bytes_written= 0;
-	for (auto it= (*name_to_users).begin(); it != (*name_to_users).end();
-	     ++it) {
-		string name= it->first;
-		auto list= it->second;
-		rv= fprintf(stream, "%s => {\n", name.c_str());
+	Users_read_guard guard;
+	const Name_to_users_map *map= guard.map();
+	if (!map) {
+		return 0;
+	}
+	for (auto it= map->begin(); it != map->end(); ++it) {
+		string_view name= it->first;
+		const Host_user_ptr_vector &users= it->second;
+		rv= fprintf(stream, "%.*s => {\n", (int)name.size(),
+			    name.data());
 		if (rv < 0)
 			goto err_print_name_to_users;
 		bytes_written += rv;
-		for (auto it2= list.begin(); it2 != list.end(); ++it2) {
+		for (auto it2= users.begin(); it2 != users.end(); ++it2) {
 			Host_user *hu= *it2;
 			rv= fprintf(stream, "\t`%s`@`%s`,\n", hu->id,
 				     hu->host);
@@ -429,14 +3356,193 @@ err_print_name_to_users:
 }
 
 
+void load_mem_tracking_backends(void)
+{
+	/* name_to_users is made of hash nodes and Small_vector buffers */
+	tracking_set_backend(memory_key_d, TRACKING_BACKEND_POOL);
+}
+
+
+/* tracked memory should be usable for over-aligned types, too */
+struct alignas(64) Cache_line_counter {
+	unsigned long count;
+};
+
+int check_tracking_alignment(void)
+{
+	int misaligned= 0;
+
+	void *p= tracking_malloc(memory_key_f, 1);
+	misaligned+= ((uintptr_t)p % alignof(max_align_t)) ? 1 : 0;
+	tracking_free(p);
+
+	Tracking_allocator<Cache_line_counter> counter_allocator(memory_key_f);
+	list<Cache_line_counter, Tracking_allocator<Cache_line_counter>>
+	    counters(counter_allocator);
+	for (size_t i= 0; i < 4; ++i) {
+		counters.push_back(Cache_line_counter());
+		misaligned+= ((uintptr_t)&counters.back() % 64) ? 1 : 0;
+	}
+
+	/* room for AVX loads */
+	Tracking_allocator<double, 32> double_allocator(memory_key_f);
+	vector<double, Tracking_allocator<double, 32>> doubles(double_allocator);
+	for (size_t i= 0; i < 9; ++i) {
+		doubles.push_back(i);
+		misaligned+= ((uintptr_t)doubles.data() % 32) ? 1 : 0;
+	}
+
+	return misaligned;
+}
+
+
+/* the users id@pattern whose pattern matches client, the slow way */
+static void match_all_users_by_scan(const char *id, const char *client,
+				    Host_user_ptr_vector *matches)
+{
+	for (size_t i= 0; i < all_users_len; ++i) {
+		Host_user *hu= all_users[i];
+		if (!strcmp(hu->id, id)
+		    && host_pattern_matches(hu->host, client)) {
+			matches->push_back(hu);
+		}
+	}
+}
+
+
+/* the accounts of `app` which clients at a few addresses may use, which
+   must be exactly those a scan of all the users finds */
+int demo_host_index(FILE *stream)
+{
+	const char *hosts[]= {
+		"10.0.%", "10.0.0.0/255.255.255.0", "10.0.0.7", "%",
+		"fd00::/8", "%.example.com"
+	};
+	const char *clients[]= {
+		"10.0.0.7", "10.0.9.1", "192.168.1.1", "fd00::1",
+		"db.example.com"
+	};
+	size_t nhosts= sizeof(hosts) / sizeof(hosts[0]);
+	size_t nclients= sizeof(clients) / sizeof(clients[0]);
+	int errors= 0;
+
+	for (size_t i= 0; i < nhosts; ++i) {
+		add_user("app", hosts[i]);
+	}
+	publish_name_to_users();
+
+	Host_user_ptr_allocator allocator(memory_key_g);
+	for (size_t i= 0; i < nclients; ++i) {
+		Users_read_guard guard;
+		Host_user_ptr_vector matches(allocator);
+		Host_user_ptr_vector scanned(allocator);
+		match_users(guard, "app", clients[i], &matches);
+		match_all_users_by_scan("app", clients[i], &scanned);
+		fprintf(stream, "`app` from %s:", clients[i]);
+		for (auto it= matches.begin(); it != matches.end(); ++it) {
+			fprintf(stream, " `%s`", (*it)->host);
+		}
+		fprintf(stream, "\n");
+
+		sort(matches.begin(), matches.end());
+		sort(scanned.begin(), scanned.end());
+		if (matches.size() != scanned.size()
+		    || !equal(matches.begin(), matches.end(),
+			      scanned.begin())) {
+			++errors;
+		}
+	}
+	for (size_t i= 0; i < nhosts; ++i) {
+		remove_user("app", hosts[i]);
+	}
+	publish_name_to_users();
+	return errors;
+}
+
+
+/* readers keep checking while the users are reloaded under them */
+int demo_concurrent_reload(size_t readers, size_t reloads)
+{
+	atomic<int> done(0);
+	atomic<unsigned long> misses(0);
+	vector<thread> threads;
+
+	for (size_t i= 0; i < readers; ++i) {
+		threads.push_back(thread([&done, &misses]() {
+			Host_user_ptr_allocator allocator(memory_key_g);
+			Host_user_ptr_vector matches(allocator);
+			while (!done.load(memory_order_relaxed)) {
+				/* these are present in every generation */
+				if (!user_may_connect("alice", "10.0.0.1") ||
+				    !user_may_connect("glen", "10.8.0.7")) {
+					misses.fetch_add(1);
+				}
+				Users_read_guard guard;
+				matches.clear();
+				if (!match_users(guard, "eve", "10.0.1.2",
+						 &matches)
+				    || strcmp(matches[0]->host, "10.0.1.2")) {
+					misses.fetch_add(1);
+				}
+			}
+		}));
+	}
+	for (size_t i= 0; i < reloads; ++i) {
+		load_all_users();
+	}
+	done.store(1);
+	for (size_t i= 0; i < threads.size(); ++i) {
+		threads[i].join();
+	}
+	return misses.load() ? 1 : 0;
+}
+
+
+#ifndef MAP_OF_STR_TO_PTRLIST_LIB
 int main(void)
 {
 	load_mem_tracking_keys();
+	load_mem_tracking_backends();
+	if (check_tracking_alignment()) {
+		fprintf(stderr, "tracked memory is misaligned\n");
+		return 1;
+	}
 	load_all_users();
 
 	print_name_to_users(stdout);
 
+	printf("\nadd `bob`@`10.0.0.9`, remove `eve`@`10.0.2.2`,"
+	       " move `alice`@`10.1.2.3` to 10.0.0.3\n\n");
+	add_user("bob", "10.0.0.9");
+	remove_user("eve", "10.0.2.2");
+	update_user_host("alice", "10.1.2.3", "10.0.0.3");
+	publish_name_to_users();
+
+	print_name_to_users(stdout);
+
+	printf("\n");
+	if (demo_host_index(stdout)) {
+		fprintf(stderr, "the host index disagrees with the patterns\n");
+		return 1;
+	}
+
+	if (demo_concurrent_reload(4, 100)) {
+		fprintf(stderr, "a reader missed a user during a reload\n");
+		return 1;
+	}
+
 	clear_all_users();
 
+	tracking_thread_cache_flush();
+	tracking_pool_release(memory_key_d);
+	print_tracking_stats(stderr);
+
+	const char *sample_file= getenv("TRACKING_SAMPLE_FILE");
+	if (sample_file && tracking_sample_dump(sample_file) < 0) {
+		perror(sample_file);
+		return 1;
+	}
+
 	return 0;
 }
+#endif
@@ -0,0 +1,123 @@
+/* tracking-trace-agg.cpp
+   Copyright (C) 2018 Eric Herman <eric@freesa.org>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as
+   published by the Free Software Foundation, either version 3 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+	https://www.gnu.org/licenses/lgpl-3.0.txt
+	https://www.gnu.org/licenses/gpl-3.0.txt
+ */
+/*
+Sums a tracking_sample_dump file by key and callsite
+
+The callsites are printed relative to the load address of the program
+which wrote the trace, so they can be given to addr2line:
+
+g++ -std=c++20 -Wall -O2 -pthread \
+	-o tracking-trace-agg tracking-trace-agg.cpp
+TRACKING_SAMPLE=16 TRACKING_SAMPLE_FILE=trace.bin ./map-of-str-to-ptrlist
+./tracking-trace-agg trace.bin
+addr2line -f -C -e map-of-str-to-ptrlist 0x...
+*/
+
+#define MAP_OF_STR_TO_PTRLIST_LIB 1
+#include "map-of-str-to-ptrlist.cpp"
+
+#include <map>
+
+struct Callsite_totals {
+	unsigned long long allocs;
+	unsigned long long alloc_bytes;
+	unsigned long long frees;
+	unsigned long long free_bytes;
+};
+
+/* key, callsite */
+typedef map<pair<uint32_t, uint64_t>, Callsite_totals> Callsite_map;
+
+static int read_trace(FILE *in, const char *path, Callsite_map *sites,
+		      unsigned long long *events)
+{
+	struct Tracking_trace_file_header header;
+	struct Tracking_event event;
+
+	if (fread(&header, sizeof(header), 1, in) != 1
+	    || memcmp(header.magic, TRACKING_TRACE_MAGIC, sizeof(header.magic))
+	    || header.version != TRACKING_TRACE_VERSION
+	    || header.event_size != sizeof(event)) {
+		fprintf(stderr, "%s: not a version %d tracking trace\n", path,
+			TRACKING_TRACE_VERSION);
+		return 1;
+	}
+
+	while (fread(&event, sizeof(event), 1, in) == 1) {
+		uint64_t site= event.caller - header.load_bias;
+		Callsite_totals *totals= &(*sites)[make_pair(event.key, site)];
+		if (event.op == TRACKING_EVENT_ALLOC) {
+			++totals->allocs;
+			totals->alloc_bytes+= event.size;
+		} else {
+			++totals->frees;
+			totals->free_bytes+= event.size;
+		}
+		++(*events);
+	}
+	if (ferror(in)) {
+		perror(path);
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	Callsite_map sites;
+	unsigned long long events= 0;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s trace.bin [trace.bin ...]\n",
+			argv[0]);
+		return 1;
+	}
+	for (int i= 1; i < argc; ++i) {
+		FILE *in= fopen(argv[i], "rb");
+		if (!in) {
+			perror(argv[i]);
+			return 1;
+		}
+		int err= read_trace(in, argv[i], &sites, &events);
+		fclose(in);
+		if (err) {
+			return 1;
+		}
+	}
+
+	/* largest allocators first, within each key */
+	vector<pair<pair<uint32_t, uint64_t>, Callsite_totals>>
+		rows(sites.begin(), sites.end());
+	sort(rows.begin(), rows.end(), [](const auto &a, const auto &b) {
+		if (a.first.first != b.first.first) {
+			return a.first.first < b.first.first;
+		}
+		return a.second.alloc_bytes > b.second.alloc_bytes;
+	});
+
+	printf("%llu sampled events\n", events);
+	printf("%4s  %-18s %10s %14s %10s %14s\n", "key", "callsite",
+	       "allocs", "alloc bytes", "frees", "free bytes");
+	for (const auto &row : rows) {
+		printf("%4lu  0x%-16llx %10llu %14llu %10llu %14llu\n",
+		       (unsigned long)row.first.first,
+		       (unsigned long long)row.first.second,
+		       row.second.allocs, row.second.alloc_bytes,
+		       row.second.frees, row.second.free_bytes);
+	}
+	return 0;
+}
@@ -31,6 +31,48 @@ static int write_byte_stdout_posix(void *b)
 #error "write_byte_stdout not defined"
 #endif
 
+#ifndef read_block_stdin
+#if defined (__unix__) || (defined (__APPLE__) && defined (__MACH__))
+#include <unistd.h>
+static size_t read_block_stdin_posix(void *buf, size_t len)
+{
+	ssize_t got = read(STDIN_FILENO, buf, len);
+	return (got > 0) ? (size_t)got : 0;
+}
+
+#define read_block_stdin read_block_stdin_posix
+#endif
+#endif
+#ifndef read_block_stdin
+#error "read_block_stdin not defined"
+#endif
+
+#ifndef write_block_stdout
+#if defined (__unix__) || (defined (__APPLE__) && defined (__MACH__))
+#include <unistd.h>
+static int write_block_stdout_posix(const void *buf, size_t len)
+{
+	const char *pos = (const char *)buf;
+	while (len) {
+		ssize_t put = write(STDOUT_FILENO, pos, len);
+		if (put <= 0) {
+			return 1;
+		}
+		pos += put;
+		len -= put;
+	}
+	return 0;
+}
+
+#define write_block_stdout write_block_stdout_posix
+#endif
+#endif
+#ifndef write_block_stdout
+#error "write_block_stdout not defined"
+#endif
+
+#include <string.h>
+
 static char nibble_to_hex(unsigned char nibble)
 {
 	if (nibble < 10) {
@@ -49,36 +91,236 @@ void byte_to_hex_chars(unsigned char byte, char *high, char *low)
 	*low = nibble_to_hex((byte & 0x0F));
 }
 
-int bin_to_hex(int (*read_byte)(void *b), int (*write_byte)(void *b))
+/* what is carried from one chunk to the next */
+struct bin_to_hex_state {
+	size_t pos;
+};
+
+#define Bin_to_hex_state_init { 0 }
+
+/* the most that bin_to_hex_chunk writes for len bytes */
+#define Bin_to_hex_size_needed(len) ((3 * (len)) + ((len) / 15) + 1)
+
+/* the same as bin_to_hex_chunk, one byte at a time, without SIMD */
+size_t bin_to_hex_chunk_simple(struct bin_to_hex_state *state,
+			       const unsigned char *in, size_t len, char *out)
 {
-	size_t pos = 0;
-	unsigned char b = 0;
-	char hi = 0;
-	char lo = 0;
-	char space = ' ';
-	char newln = '\n';
-	while (read_byte(&b)) {
+	size_t pos = state->pos;
+	size_t w = 0;
+	for (size_t i = 0; i < len; ++i) {
 		if (pos) {
-			write_byte(&space);
+			out[w++] = ' ';
 		}
-		byte_to_hex_chars(b, &hi, &lo);
-		write_byte(&hi);
-		write_byte(&lo);
+		byte_to_hex_chars(in[i], &out[w], &out[w + 1]);
+		w += 2;
 		++pos;
 		if (pos == 15) {
-			write_byte(&newln);
+			out[w++] = '\n';
 			pos = 0;
 		}
 	}
-	if (pos) {
-		write_byte(&newln);
+	state->pos = pos;
+	return w;
+}
+
+#ifndef BIN_TO_HEX_NO_SIMD
+#if defined(__AVX2__)
+#define BIN_TO_HEX_AVX2 1
+#endif
+#if defined(__SSSE3__)
+#define BIN_TO_HEX_SSSE3 1
+#include <immintrin.h>
+#endif
+#endif
+
+#ifdef BIN_TO_HEX_SSSE3
+/* A whole line is 15 bytes to 45 characters: "HH HH ... HH\n"; each of
+ * the three 16 character vectors of the line takes each character from
+ * the high or low nibble digits, or else from the spaces and newline: */
+static const signed char bin_to_hex_line_hi[3][16] = {
+	{ 0, -128, -128, 1, -128, -128, 2, -128,
+	  -128, 3, -128, -128, 4, -128, -128, 5 },
+	{ -128, -128, 6, -128, -128, 7, -128, -128,
+	  8, -128, -128, 9, -128, -128, 10, -128 },
+	{ -128, 11, -128, -128, 12, -128, -128, 13,
+	  -128, -128, 14, -128, -128, -128, -128, -128 },
+};
+
+static const signed char bin_to_hex_line_lo[3][16] = {
+	{ -128, 0, -128, -128, 1, -128, -128, 2,
+	  -128, -128, 3, -128, -128, 4, -128, -128 },
+	{ 5, -128, -128, 6, -128, -128, 7, -128,
+	  -128, 8, -128, -128, 9, -128, -128, 10 },
+	{ -128, -128, 11, -128, -128, 12, -128, -128,
+	  13, -128, -128, 14, -128, -128, -128, -128 },
+};
+
+static const signed char bin_to_hex_line_sep[3][16] = {
+	{ 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0 },
+	{ 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0 },
+	{ ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, '\n', 0, 0, 0 },
+};
+
+#define Bin_to_hex_load(table) _mm_loadu_si128((const __m128i *)(table))
+
+static inline void bin_to_hex_digits(__m128i in, __m128i *hi, __m128i *lo)
+{
+	const __m128i digits = _mm_setr_epi8('0', '1', '2', '3', '4', '5',
+					     '6', '7', '8', '9', 'A', 'B',
+					     'C', 'D', 'E', 'F');
+	const __m128i nibble = _mm_set1_epi8(0x0F);
+	*hi = _mm_shuffle_epi8(digits,
+			       _mm_and_si128(_mm_srli_epi16(in, 4), nibble));
+	*lo = _mm_shuffle_epi8(digits, _mm_and_si128(in, nibble));
+}
+
+static inline __m128i bin_to_hex_line_part(__m128i hi, __m128i lo, int j)
+{
+	__m128i h = _mm_shuffle_epi8(hi, Bin_to_hex_load(bin_to_hex_line_hi[j]));
+	__m128i l = _mm_shuffle_epi8(lo, Bin_to_hex_load(bin_to_hex_line_lo[j]));
+	return _mm_or_si128(_mm_or_si128(h, l),
+			    Bin_to_hex_load(bin_to_hex_line_sep[j]));
+}
+
+static inline void bin_to_hex_line_store(char *out, __m128i hi, __m128i lo)
+{
+	char last[16];
+	_mm_storeu_si128((__m128i *)out, bin_to_hex_line_part(hi, lo, 0));
+	_mm_storeu_si128((__m128i *)(out + 16),
+			 bin_to_hex_line_part(hi, lo, 1));
+	_mm_storeu_si128((__m128i *)last, bin_to_hex_line_part(hi, lo, 2));
+	memcpy(out + 32, last, 13);
+}
+
+/* whole lines, reading 16 bytes for each 15; returns the bytes used */
+static size_t bin_to_hex_lines(const unsigned char *in, size_t len,
+			       char *out)
+{
+	size_t i = 0;
+#ifdef BIN_TO_HEX_AVX2
+	/* two lines at once, one in each 128 bit lane */
+	for (; (len - i) >= 31; i += 30, out += 90) {
+		__m256i both = _mm256_set_m128i(_mm_loadu_si128((const __m128i *)
+								(in + i + 15)),
+						_mm_loadu_si128((const __m128i *)
+								(in + i)));
+		const __m256i digits =
+		    _mm256_broadcastsi128_si256(_mm_setr_epi8('0', '1', '2',
+							      '3', '4', '5',
+							      '6', '7', '8',
+							      '9', 'A', 'B',
+							      'C', 'D', 'E',
+							      'F'));
+		const __m256i nibble = _mm256_set1_epi8(0x0F);
+		__m256i hi = _mm256_shuffle_epi8(digits,
+			_mm256_and_si256(_mm256_srli_epi16(both, 4), nibble));
+		__m256i lo = _mm256_shuffle_epi8(digits,
+						 _mm256_and_si256(both, nibble));
+		bin_to_hex_line_store(out, _mm256_castsi256_si128(hi),
+				      _mm256_castsi256_si128(lo));
+		bin_to_hex_line_store(out + 45,
+				      _mm256_extracti128_si256(hi, 1),
+				      _mm256_extracti128_si256(lo, 1));
+	}
+#endif
+	for (; (len - i) >= 16; i += 15, out += 45) {
+		__m128i hi, lo;
+		bin_to_hex_digits(_mm_loadu_si128((const __m128i *)(in + i)),
+				  &hi, &lo);
+		bin_to_hex_line_store(out, hi, lo);
+	}
+	return i;
+}
+#endif
+
+/* encodes a chunk, of any size, 15 bytes to a line, returns the number
+ * of characters written to `out` */
+size_t bin_to_hex_chunk(struct bin_to_hex_state *state,
+			const unsigned char *in, size_t len, char *out)
+{
+#ifdef BIN_TO_HEX_SSSE3
+	size_t i = 0;
+	size_t w = 0;
+	if (state->pos) {
+		/* finish the line which was started */
+		i = 15 - state->pos;
+		if (i > len) {
+			i = len;
+		}
+		w = bin_to_hex_chunk_simple(state, in, i, out);
+	}
+	if (!state->pos) {
+		size_t used = bin_to_hex_lines(in + i, len - i, out + w);
+		i += used;
+		w += (used / 15) * 45;
+	}
+	return w + bin_to_hex_chunk_simple(state, in + i, len - i, out + w);
+#else
+	return bin_to_hex_chunk_simple(state, in, len, out);
+#endif
+}
+
+/* ends the last line, if need be, returns the characters written */
+size_t bin_to_hex_finish(struct bin_to_hex_state *state, char *out)
+{
+	size_t w = 0;
+	if (state->pos) {
+		out[w++] = '\n';
+		state->pos = 0;
+	}
+	return w;
+}
+
+int bin_to_hex(int (*read_byte)(void *b), int (*write_byte)(void *b))
+{
+	struct bin_to_hex_state state = Bin_to_hex_state_init;
+	unsigned char b = 0;
+	char out[Bin_to_hex_size_needed(1)];
+	size_t written = 0;
+	while (read_byte(&b)) {
+		written = bin_to_hex_chunk(&state, &b, 1, out);
+		for (size_t i = 0; i < written; ++i) {
+			write_byte(&out[i]);
+		}
+	}
+	written = bin_to_hex_finish(&state, out);
+	for (size_t i = 0; i < written; ++i) {
+		write_byte(&out[i]);
 	}
 	return 0;
 }
 
+#ifndef BIN_TO_HEX_BLOCK_SIZE
+#define BIN_TO_HEX_BLOCK_SIZE (64 * 1024)
+#endif
+
+/* like bin_to_hex, but BIN_TO_HEX_BLOCK_SIZE at a time */
+int bin_to_hex_blocks(size_t (*read_block)(void *buf, size_t len),
+		      int (*write_block)(const void *buf, size_t len))
+{
+	static unsigned char in[BIN_TO_HEX_BLOCK_SIZE];
+	static char out[Bin_to_hex_size_needed(BIN_TO_HEX_BLOCK_SIZE)];
+	struct bin_to_hex_state state = Bin_to_hex_state_init;
+	size_t len = 0;
+	size_t written = 0;
+	while ((len = read_block(in, sizeof(in))) > 0) {
+		written = bin_to_hex_chunk(&state, in, len, out);
+		if (write_block(out, written)) {
+			return 1;
+		}
+	}
+	written = bin_to_hex_finish(&state, out);
+	return write_block(out, written);
+}
+
 #ifndef BIN_TO_HEX_LIB
-int main(void)
+
+/* --byte-at-a-time for the old way, one system call per byte */
+int main(int argc, char **argv)
 {
-	return bin_to_hex(read_byte_stdin, write_byte_stdout);
+	if (argc > 1 && strcmp(argv[1], "--byte-at-a-time") == 0) {
+		return bin_to_hex(read_byte_stdin, write_byte_stdout);
+	}
+	return bin_to_hex_blocks(read_block_stdin, write_block_stdout);
 }
 #endif
@@ -0,0 +1,407 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2026 Eric Herman <eric@freesa.org> */
+
+/* bswap-array.c : byte swap whole arrays of 16, 32, or 64 bit values
+ *
+ * ntohll.c and byteswap64.c swap one value at a time; wire buffers have
+ * many. These swap 16 bytes at a time with pshufb (SSSE3), 32 with
+ * AVX2, or with the NEON rev instructions, then the tail one value at a
+ * time. The hton and ntoh versions know the host byte order at compile
+ * time, and are only a copy on a big endian host.
+ *
+ * gcc -g -Wall -Werror -O2 -DNDEBUG -march=native \
+ *	-o bswap-array bswap-array.c
+ * ./bswap-array [megabytes]
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/* the in place versions */
+void bswap_array_16(uint16_t *values, size_t n);
+void bswap_array_32(uint32_t *values, size_t n);
+void bswap_array_64(uint64_t *values, size_t n);
+
+/* the out of place versions; dst and src may be the same, but may not
+ * otherwise overlap */
+void bswap_array_16_copy(uint16_t *dst, const uint16_t *src, size_t n);
+void bswap_array_32_copy(uint32_t *dst, const uint32_t *src, size_t n);
+void bswap_array_64_copy(uint64_t *dst, const uint64_t *src, size_t n);
+
+/* one value at a time, as the compiler sees fit; for comparison */
+void bswap_array_16_simple(uint16_t *dst, const uint16_t *src, size_t n);
+void bswap_array_32_simple(uint32_t *dst, const uint32_t *src, size_t n);
+void bswap_array_64_simple(uint64_t *dst, const uint64_t *src, size_t n);
+
+/* host to network (big endian) order, and back */
+void hton_array_16(uint16_t *dst, const uint16_t *src, size_t n);
+void hton_array_32(uint32_t *dst, const uint32_t *src, size_t n);
+void hton_array_64(uint64_t *dst, const uint64_t *src, size_t n);
+#define ntoh_array_16 hton_array_16
+#define ntoh_array_32 hton_array_32
+#define ntoh_array_64 hton_array_64
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define BSWAP_ARRAY_HOST_BIG_ENDIAN 1
+#elif defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define BSWAP_ARRAY_HOST_BIG_ENDIAN 0
+#else
+#error "unknown byte order: __BYTE_ORDER__ is not defined"
+#endif
+
+#ifndef BSWAP_ARRAY_NO_SIMD
+#if defined(__AVX2__)
+#define BSWAP_ARRAY_AVX2 1
+#endif
+#if defined(__SSSE3__)
+#define BSWAP_ARRAY_SSSE3 1
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#define BSWAP_ARRAY_NEON 1
+#include <arm_neon.h>
+#endif
+#endif
+
+#if defined(BSWAP_ARRAY_SSSE3)
+/* the pshufb pattern for values of each size, indexed by size / 4 */
+static const signed char bswap_array_shuffles[3][16] = {
+	{ 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14 },
+	{ 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12 },
+	{ 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8 },
+};
+#endif
+
+/* swaps the whole vectors of values of `size` bytes; returns how many
+ * bytes it did, the rest are left for the scalar tail */
+static size_t bswap_array_vectors(void *dst, const void *src, size_t bytes,
+				  size_t size)
+{
+	unsigned char *out = (unsigned char *)dst;
+	const unsigned char *in = (const unsigned char *)src;
+	size_t i = 0;
+#if defined(BSWAP_ARRAY_SSSE3)
+	const __m128i shuffle = _mm_loadu_si128((const __m128i *)
+						bswap_array_shuffles[size / 4]);
+#if defined(BSWAP_ARRAY_AVX2)
+	const __m256i shuffle2 = _mm256_broadcastsi128_si256(shuffle);
+	for (; i + 64 <= bytes; i += 64) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)(in + i));
+		__m256i b = _mm256_loadu_si256((const __m256i *)(in + i + 32));
+		a = _mm256_shuffle_epi8(a, shuffle2);
+		b = _mm256_shuffle_epi8(b, shuffle2);
+		_mm256_storeu_si256((__m256i *)(out + i), a);
+		_mm256_storeu_si256((__m256i *)(out + i + 32), b);
+	}
+#endif
+	for (; i + 16 <= bytes; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(in + i));
+		_mm_storeu_si128((__m128i *)(out + i),
+				 _mm_shuffle_epi8(a, shuffle));
+	}
+#elif defined(BSWAP_ARRAY_NEON)
+	for (; i + 16 <= bytes; i += 16) {
+		uint8x16_t a = vld1q_u8(in + i);
+		switch (size) {
+		case 2:
+			a = vrev16q_u8(a);
+			break;
+		case 4:
+			a = vrev32q_u8(a);
+			break;
+		default:
+			a = vrev64q_u8(a);
+			break;
+		}
+		vst1q_u8(out + i, a);
+	}
+#else
+	(void)out;
+	(void)in;
+	(void)bytes;
+	(void)size;
+#endif
+	return i;
+}
+
+void bswap_array_16_simple(uint16_t *dst, const uint16_t *src, size_t n)
+{
+	for (size_t i = 0; i < n; ++i) {
+		dst[i] = __builtin_bswap16(src[i]);
+	}
+}
+
+void bswap_array_32_simple(uint32_t *dst, const uint32_t *src, size_t n)
+{
+	for (size_t i = 0; i < n; ++i) {
+		dst[i] = __builtin_bswap32(src[i]);
+	}
+}
+
+void bswap_array_64_simple(uint64_t *dst, const uint64_t *src, size_t n)
+{
+	for (size_t i = 0; i < n; ++i) {
+		dst[i] = __builtin_bswap64(src[i]);
+	}
+}
+
+void bswap_array_16_copy(uint16_t *dst, const uint16_t *src, size_t n)
+{
+	size_t done = bswap_array_vectors(dst, src, n * 2, 2) / 2;
+	bswap_array_16_simple(dst + done, src + done, n - done);
+}
+
+void bswap_array_32_copy(uint32_t *dst, const uint32_t *src, size_t n)
+{
+	size_t done = bswap_array_vectors(dst, src, n * 4, 4) / 4;
+	bswap_array_32_simple(dst + done, src + done, n - done);
+}
+
+void bswap_array_64_copy(uint64_t *dst, const uint64_t *src, size_t n)
+{
+	size_t done = bswap_array_vectors(dst, src, n * 8, 8) / 8;
+	bswap_array_64_simple(dst + done, src + done, n - done);
+}
+
+/* each vector is loaded before it is stored, so in place is the same */
+void bswap_array_16(uint16_t *values, size_t n)
+{
+	bswap_array_16_copy(values, values, n);
+}
+
+void bswap_array_32(uint32_t *values, size_t n)
+{
+	bswap_array_32_copy(values, values, n);
+}
+
+void bswap_array_64(uint64_t *values, size_t n)
+{
+	bswap_array_64_copy(values, values, n);
+}
+
+#if BSWAP_ARRAY_HOST_BIG_ENDIAN
+static void bswap_array_move(void *dst, const void *src, size_t bytes)
+{
+	if (dst != src) {
+		memcpy(dst, src, bytes);
+	}
+}
+
+void hton_array_16(uint16_t *dst, const uint16_t *src, size_t n)
+{
+	bswap_array_move(dst, src, n * 2);
+}
+
+void hton_array_32(uint32_t *dst, const uint32_t *src, size_t n)
+{
+	bswap_array_move(dst, src, n * 4);
+}
+
+void hton_array_64(uint64_t *dst, const uint64_t *src, size_t n)
+{
+	bswap_array_move(dst, src, n * 8);
+}
+#else
+void hton_array_16(uint16_t *dst, const uint16_t *src, size_t n)
+{
+	bswap_array_16_copy(dst, src, n);
+}
+
+void hton_array_32(uint32_t *dst, const uint32_t *src, size_t n)
+{
+	bswap_array_32_copy(dst, src, n);
+}
+
+void hton_array_64(uint64_t *dst, const uint64_t *src, size_t n)
+{
+	bswap_array_64_copy(dst, src, n);
+}
+#endif
+
+#ifndef BSWAP_ARRAY_LIB
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "microbench.h"
+
+/* every length up to 200 bytes, at each aligned offset up to 31, in
+ * place and not, against the simple versions */
+static int check_bswap_arrays(void)
+{
+	_Alignas(8) unsigned char src[256 + 32];
+	_Alignas(8) unsigned char want[256 + 32];
+	_Alignas(8) unsigned char got[256 + 32];
+	uint64_t seed = 3;
+	int errors = 0;
+	for (size_t i = 0; i < sizeof(src); ++i) {
+		src[i] = (unsigned char)microbench_random(&seed);
+	}
+	for (size_t size = 2; size <= 8; size *= 2) {
+		for (size_t off = 0; off < 32; off += size) {
+			for (size_t n = 0; (n * size) <= 200; ++n) {
+				void *w = want + off;
+				void *g = got + off;
+				const void *s = src + off;
+				memset(got, 0xA5, sizeof(got));
+				switch (size) {
+				case 2:
+					bswap_array_16_simple(w, s, n);
+					bswap_array_16_copy(g, s, n);
+					break;
+				case 4:
+					bswap_array_32_simple(w, s, n);
+					bswap_array_32_copy(g, s, n);
+					break;
+				default:
+					bswap_array_64_simple(w, s, n);
+					bswap_array_64_copy(g, s, n);
+					break;
+				}
+				int bad = memcmp(want + off, got + off,
+						 n * size) != 0
+				    || got[off + (n * size)] != 0xA5;
+				memcpy(got + off, src + off, n * size);
+				switch (size) {
+				case 2:
+					bswap_array_16(g, n);
+					break;
+				case 4:
+					bswap_array_32(g, n);
+					break;
+				default:
+					bswap_array_64(g, n);
+					break;
+				}
+				bad = bad || memcmp(want + off, got + off,
+						    n * size) != 0;
+				if (bad) {
+					fprintf(stderr, "bswap_array_%zu:"
+						" n %zu offset %zu differs\n",
+						size * 8, n, off);
+					++errors;
+				}
+			}
+		}
+	}
+	uint64_t v = 0x0102030405060708ULL;
+	uint64_t net = 0;
+	hton_array_64(&net, &v, 1);
+	if (memcmp(&net, "\x01\x02\x03\x04\x05\x06\x07\x08", 8) != 0) {
+		fprintf(stderr, "hton_array_64 is not big endian\n");
+		++errors;
+	}
+	return errors;
+}
+
+typedef void (*bswap_func)(void *dst, const void *src, size_t n);
+
+/* calling each through a bswap_func of its own type; the in place ones
+ * swap dst, and ignore src */
+#define Bswap_bench_funcs(bits) \
+	static void bench_##bits##_simple(void *dst, const void *src, \
+					  size_t n) \
+	{ \
+		bswap_array_##bits##_simple(dst, src, n); \
+	} \
+	static void bench_##bits##_copy(void *dst, const void *src, size_t n) \
+	{ \
+		bswap_array_##bits##_copy(dst, src, n); \
+	} \
+	static void bench_##bits##_in_place(void *dst, const void *src, \
+					    size_t n) \
+	{ \
+		(void)src; \
+		bswap_array_##bits(dst, n); \
+	}
+
+Bswap_bench_funcs(16)
+Bswap_bench_funcs(32)
+Bswap_bench_funcs(64)
+
+struct bswap_bench {
+	bswap_func func;
+	void *dst;
+	const void *src;
+	size_t n;
+};
+
+/* an iteration is one swap of the whole buffer */
+static void bench_bswap_run(void *context, size_t iterations)
+{
+	struct bswap_bench *bb = context;
+	for (size_t i = 0; i < iterations; ++i) {
+		bb->func(bb->dst, bb->src, bb->n);
+		Microbench_do_not_optimize(bb->dst);
+	}
+}
+
+static void bench_bswap(const char *name, bswap_func func, size_t size,
+			void *dst, const void *src, size_t bytes)
+{
+	struct bswap_bench bb = { func, dst, src, bytes / size };
+	struct microbench bench = Microbench_init;
+	microbench_run(&bench, bench_bswap_run, &bb);
+	printf("%-22s %8.2f GB/s (+/- %.2f)\n", name,
+	       bytes / bench.ns_median,
+	       (bytes / bench.ns_median) * (bench.ns_mad / bench.ns_median));
+}
+
+static void bench_bswaps(unsigned char *dst, const unsigned char *src,
+			 size_t bytes)
+{
+	printf("%zu KB, out of place\n", bytes / 1024);
+	bench_bswap("bswap_array_16_simple", bench_16_simple, 2, dst, src,
+		    bytes);
+	bench_bswap("bswap_array_16_copy", bench_16_copy, 2, dst, src, bytes);
+	bench_bswap("bswap_array_32_simple", bench_32_simple, 4, dst, src,
+		    bytes);
+	bench_bswap("bswap_array_32_copy", bench_32_copy, 4, dst, src, bytes);
+	bench_bswap("bswap_array_64_simple", bench_64_simple, 8, dst, src,
+		    bytes);
+	bench_bswap("bswap_array_64_copy", bench_64_copy, 8, dst, src, bytes);
+	printf("%zu KB, in place\n", bytes / 1024);
+	bench_bswap("bswap_array_16_simple", bench_16_simple, 2, dst, dst,
+		    bytes);
+	bench_bswap("bswap_array_16", bench_16_in_place, 2, dst, dst, bytes);
+	bench_bswap("bswap_array_32_simple", bench_32_simple, 4, dst, dst,
+		    bytes);
+	bench_bswap("bswap_array_32", bench_32_in_place, 4, dst, dst, bytes);
+	bench_bswap("bswap_array_64_simple", bench_64_simple, 8, dst, dst,
+		    bytes);
+	bench_bswap("bswap_array_64", bench_64_in_place, 8, dst, dst, bytes);
+}
+
+int main(int argc, char **argv)
+{
+	size_t megabytes = (argc > 1) ? strtoul(argv[1], NULL, 10) : 0;
+	if (!megabytes) {
+		megabytes = 16;
+	}
+	size_t bytes = megabytes * 1024 * 1024;
+
+	if (check_bswap_arrays()) {
+		return EXIT_FAILURE;
+	}
+
+	unsigned char *src = malloc(bytes);
+	unsigned char *dst = malloc(bytes);
+	if (!src || !dst) {
+		perror("malloc");
+		return EXIT_FAILURE;
+	}
+	uint64_t seed = 7;
+	for (size_t i = 0; i < bytes; ++i) {
+		src[i] = (unsigned char)microbench_random(&seed);
+	}
+	memset(dst, 0, bytes);
+
+	/* in the L1 cache, then in memory */
+	bench_bswaps(dst, src, 16 * 1024);
+	bench_bswaps(dst, src, bytes);
+
+	free(dst);
+	free(src);
+	return EXIT_SUCCESS;
+}
+#endif /* BSWAP_ARRAY_LIB */
@@ -8,11 +8,289 @@
 
    cc -O2 -DNDEBUG digit-to-int.c -o digit-to-int && ./digit-to-int
 
+   Building on that, parse_u32 and parse_u64 take whole numbers in base 10
+   or 16, converting up to 16 digits at once: with SSSE3 (-march=native)
+   or else 8 at a time in a 64 bit word (SWAR). parse_u64_lines parses a
+   column of numbers, one per line, from a buffer. The main compares them
+   with strtoul and sscanf, timed with microbench.h.
  */
 #include <assert.h>
+#include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
+#include <string.h>
+
+/* Parses the digits from `str` up to (not including) `end`, with no sign,
+ * space, or "0x" prefix, in base 10 or 16. Returns a pointer just past
+ * the digits, or NULL if there are none, if the value is too large, or
+ * if the base is neither 10 nor 16. */
+const char *parse_u64(const char *str, const char *end, unsigned base,
+		      uint64_t *value);
+const char *parse_u32(const char *str, const char *end, unsigned base,
+		      uint32_t *value);
+
+/* Parses one number per line ("\n" or "\r\n", the last may have none)
+ * into `values`, returning how many; stops at max_values, or at the first
+ * line which is not just a number; `*consumed` is where it stopped. */
+size_t parse_u64_lines(const char *buf, size_t len, unsigned base,
+		       uint64_t *values, size_t max_values, size_t *consumed);
+
+#ifndef DIGIT_TO_INT_NO_SIMD
+#if defined(__SSSE3__)
+#define DIGIT_TO_INT_SSSE3 1
+#include <immintrin.h>
+#endif
+#endif
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define DIGIT_TO_INT_SWAR 1
+#endif
+
+static const uint64_t parse_powers_of_10[17] = {
+	1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+	10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+	100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+	100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL
+};
+
+/* one more than the value of each hex digit, zero for any other byte */
+static const unsigned char parse_digit_values[256] = {
+	['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+	['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+	['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+	['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
+/* the value of a digit, or 255; a table, as branching on digit or
+ * letter mispredicts on most hex numbers */
+static unsigned parse_digit(char c, unsigned base)
+{
+	unsigned d = parse_digit_values[(unsigned char)c] - 1U;
+	return (d < base) ? d : 255;
+}
+
+#ifdef DIGIT_TO_INT_SWAR
+static uint64_t parse_load8(const char *str)
+{
+	uint64_t x;
+	memcpy(&x, str, 8);
+	return x;
+}
+
+/* The first character is the lowest byte, and the highest digit: pairs
+ * of digits become 16 bit lanes of 0..99, then 32 bit lanes of 0..9999,
+ * then the 8 digit value. */
+static uint32_t parse_eight_10(uint64_t x)
+{
+	x -= 0x3030303030303030ULL;
+	x = (x * 10) + (x >> 8);
+	x = (((x & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32)))
+	     + (((x >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32))))
+	    >> 32;
+	return (uint32_t)x;
+}
+
+static uint32_t parse_eight_16(uint64_t x)
+{
+	const uint64_t m8 = 0x00FF00FF00FF00FFULL;
+	const uint64_t m16 = 0x0000FFFF0000FFFFULL;
+	/* letters have bit 6 set, and their low nibble is 9 less */
+	x = (x & 0x0F0F0F0F0F0F0F0FULL) + (9 * ((x >> 6) & 0x0101010101010101ULL));
+	x = ((x & m8) << 4) + ((x >> 8) & m8);
+	x = ((x & m16) << 8) + ((x >> 16) & m16);
+	x = ((x & 0xFFFFFFFFULL) << 16) + (x >> 32);
+	return (uint32_t)x;
+}
+
+/* the first n (1 to 8) digits of the 8 which were loaded, as if there
+ * were leading zeros: shifting left puts zeros in front */
+static uint64_t parse_first_n(uint64_t x, size_t n, unsigned base)
+{
+	size_t pad = 8 * (8 - n);
+	x = (x << pad) | (0x3030303030303030ULL & ((1ULL << pad) - 1));
+	return (base == 10) ? parse_eight_10(x) : parse_eight_16(x);
+}
+#endif
+
+#ifdef DIGIT_TO_INT_SSSE3
+/* the mask for each character which is a digit in the base */
+static inline __m128i parse_digits16(__m128i c, unsigned base,
+				     __m128i *values)
+{
+	__m128i d = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+	__m128i is_d = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+	if (base == 10) {
+		*values = d;
+		return is_d;
+	}
+	__m128i l = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)),
+				 _mm_set1_epi8('a'));
+	__m128i is_l = _mm_cmpeq_epi8(_mm_min_epu8(l, _mm_set1_epi8(5)), l);
+	*values = _mm_or_si128(_mm_and_si128(is_d, d),
+			       _mm_and_si128(is_l,
+					     _mm_add_epi8(l, _mm_set1_epi8(10))));
+	return _mm_or_si128(is_d, is_l);
+}
+
+/* for shifting n digits to the end of the vector, zeros in front */
+static const signed char parse_align_shuffle[32] = {
+	-128, -128, -128, -128, -128, -128, -128, -128,
+	-128, -128, -128, -128, -128, -128, -128, -128,
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
+};
+
+/* 16 digit values, the first the highest, into the number */
+static inline uint64_t parse_sixteen(__m128i d, unsigned base)
+{
+	if (base == 10) {
+		__m128i t = _mm_maddubs_epi16(d, _mm_set1_epi16(0x010A));
+		t = _mm_madd_epi16(t, _mm_set1_epi32(0x00010064));
+		t = _mm_packs_epi32(t, t);
+		t = _mm_madd_epi16(t, _mm_set1_epi32(0x00012710));
+		uint64_t both = (uint64_t)_mm_cvtsi128_si64(t);
+		return ((both & 0xFFFFFFFF) * 100000000ULL) + (both >> 32);
+	}
+	__m128i t = _mm_maddubs_epi16(d, _mm_set1_epi16(0x0110));
+	t = _mm_packus_epi16(t, t);
+	return __builtin_bswap64((uint64_t)_mm_cvtsi128_si64(t));
+}
+#endif
+
+/* up to 16 digits, without overflow, at once; returns how many */
+static size_t parse_run(const char *str, const char *end, unsigned base,
+			uint64_t *value)
+{
+	size_t avail = end - str;
+#ifdef DIGIT_TO_INT_SSSE3
+	if (avail >= 16) {
+		__m128i c = _mm_loadu_si128((const __m128i *)str);
+		__m128i d;
+		unsigned ok = _mm_movemask_epi8(parse_digits16(c, base, &d));
+		size_t n = __builtin_ctz(~ok | 0x10000);
+		if (n) {
+			__m128i align = _mm_loadu_si128((const __m128i *)
+							(parse_align_shuffle
+							 + n));
+			*value = parse_sixteen(_mm_shuffle_epi8(d, align), base);
+		}
+		return n;
+	}
+#endif
+	size_t max = avail < 16 ? avail : 16;
+	size_t n = 0;
+	while (n < max && parse_digit(str[n], base) != 255) {
+		++n;
+	}
+#ifdef DIGIT_TO_INT_SWAR
+	if (n && avail >= 8) {
+		size_t first = n < 8 ? n : 8;
+		uint64_t v = parse_first_n(parse_load8(str), first, base);
+		if (n > 8 && avail >= 16) {
+			uint64_t lo = parse_first_n(parse_load8(str + 8), n - 8,
+						    base);
+			v = (base == 10) ?
+			    (v * parse_powers_of_10[n - 8]) + lo :
+			    (v << (4 * (n - 8))) | lo;
+		} else {
+			for (size_t i = first; i < n; ++i) {
+				v = (v * base) + parse_digit(str[i], base);
+			}
+		}
+		*value = v;
+		return n;
+	}
+#endif
+	uint64_t v = 0;
+	for (size_t i = 0; i < n; ++i) {
+		v = (v * base) + parse_digit(str[i], base);
+	}
+	*value = v;
+	return n;
+}
+
+static const char *parse_max(const char *str, const char *end,
+			     unsigned base, uint64_t max, uint64_t *value)
+{
+	if (base != 10 && base != 16) {
+		return NULL;
+	}
+	/* leading zeros would use up the 16 */
+	while ((end - str) > 1 && str[0] == '0' && str[1] == '0') {
+		++str;
+	}
+	uint64_t v = 0;
+	size_t n = parse_run(str, end, base, &v);
+	if (!n) {
+		return NULL;
+	}
+	str += n;
+	/* any more digits, checking for overflow */
+	while (str < end) {
+		unsigned d = parse_digit(*str, base);
+		if (d == 255) {
+			break;
+		}
+		if (__builtin_mul_overflow(v, base, &v)
+		    || __builtin_add_overflow(v, d, &v)) {
+			return NULL;
+		}
+		++str;
+	}
+	if (v > max) {
+		return NULL;
+	}
+	*value = v;
+	return str;
+}
+
+const char *parse_u64(const char *str, const char *end, unsigned base,
+		      uint64_t *value)
+{
+	return parse_max(str, end, base, UINT64_MAX, value);
+}
+
+const char *parse_u32(const char *str, const char *end, unsigned base,
+		      uint32_t *value)
+{
+	uint64_t v = 0;
+	const char *after = parse_max(str, end, base, UINT32_MAX, &v);
+	if (after) {
+		*value = (uint32_t)v;
+	}
+	return after;
+}
+
+size_t parse_u64_lines(const char *buf, size_t len, unsigned base,
+		       uint64_t *values, size_t max_values, size_t *consumed)
+{
+	const char *pos = buf;
+	const char *end = buf + len;
+	size_t count = 0;
+	while (count < max_values && pos < end) {
+		const char *after = parse_max(pos, end, base, UINT64_MAX,
+					      &values[count]);
+		if (!after) {
+			break;
+		}
+		if (after < end && *after == '\r') {
+			++after;
+		}
+		if (after < end) {
+			if (*after != '\n') {
+				break;
+			}
+			++after;
+		}
+		++count;
+		pos = after;
+	}
+	*consumed = pos - buf;
+	return count;
+}
+
+#ifndef DIGIT_TO_INT_LIB
+#include "microbench.h"
 
 static const char *ascii_digits = "0123456789";
 
@@ -47,29 +325,250 @@ void validate_digit_to_int_functions(void)
 	}
 }
 
-clock_t time_func(int (*digit_to_int)(char), int *d)
+/* each calls its function directly, so that it may be inlined, and
+ * hides each digit from the optimizer; an iteration is all ten digits,
+ * and the sum of the last one, 45, is left in the context */
+static void bench_digit_to_int_subtract(void *context, size_t iterations)
 {
-	clock_t start = clock();
-	for (size_t i = 0; i < CLOCKS_PER_SEC; ++i) {
-		for (size_t j = 0; ascii_digits[j]; ++j) {
+	unsigned d = 0;
+	for (size_t i = 0; i < iterations; ++i) {
+		d = 0;
+		for (size_t j = 0; j < 10; ++j) {
 			char c = ascii_digits[j];
-			*d += digit_to_int(c);
+			Microbench_do_not_optimize(c);
+			d += digit_to_int_subtract(c);
+		}
+		Microbench_do_not_optimize(d);
+	}
+	*(unsigned *)context = d;
+}
+
+static void bench_digit_to_int_mask(void *context, size_t iterations)
+{
+	unsigned d = 0;
+	for (size_t i = 0; i < iterations; ++i) {
+		d = 0;
+		for (size_t j = 0; j < 10; ++j) {
+			char c = ascii_digits[j];
+			Microbench_do_not_optimize(c);
+			d += digit_to_int_mask(c);
+		}
+		Microbench_do_not_optimize(d);
+	}
+	*(unsigned *)context = d;
+}
+
+/* returns the sum of the digits in one iteration */
+unsigned time_digit_to_int(microbench_func func, const char *name)
+{
+	struct microbench bench = Microbench_init;
+	unsigned d = 0;
+	microbench_run(&bench, func, &d);
+	printf("%.3f ns (+/- %.3f) %.2f cycles per digit: %s (%u)\n",
+	       bench.ns_median / 10, bench.ns_mad / 10,
+	       bench.cycles_median / 10, name, d);
+	return d;
+}
+
+/* against strtoull, which also takes the longest run of digits */
+void validate_parse_functions(void)
+{
+	static const char alphabet[] = "0123456789abcdefABCDEF";
+	char buf[64];
+	uint64_t seed = 5;
+	size_t errors = 0;
+	for (size_t i = 0; i < 2000000; ++i) {
+		unsigned base = (i & 1) ? 16 : 10;
+		size_t digits = 1 + (microbench_random(&seed) % 24);
+		size_t zeros = (microbench_random(&seed) % 8) ? 0 : 4;
+		size_t len = 0;
+		for (size_t j = 0; j < zeros; ++j) {
+			buf[len++] = '0';
+		}
+		for (size_t j = 0; j < digits; ++j) {
+			size_t letters = (base == 16) ? 22 : 10;
+			buf[len++] = alphabet[microbench_random(&seed) % letters];
+		}
+		/* something after, or the end */
+		buf[len] = " \nx:G9"[microbench_random(&seed) % 6];
+		size_t limit = len + 1 - (microbench_random(&seed) % 3);
+		buf[limit] = '\0';
+		for (size_t j = limit + 1; j < sizeof(buf); ++j) {
+			buf[j] = '7';
+		}
+
+		errno = 0;
+		char *want_end = NULL;
+		unsigned long long want = strtoull(buf, &want_end, base);
+		/* no digits, and too big, are both failures */
+		int fails = (errno == ERANGE) || (want_end == buf);
+		uint64_t got = 0;
+		const char *got_end = parse_u64(buf, buf + limit, base, &got);
+		if (fails ? (got_end != NULL)
+		    : (got_end != want_end || got != want)) {
+			fprintf(stderr, "parse_u64(\"%s\", %u) == %llu\n",
+				buf, base, (unsigned long long)got);
+			++errors;
 		}
+		uint32_t got32 = 0;
+		got_end = parse_u32(buf, buf + limit, base, &got32);
+		fails = fails || (want > UINT32_MAX);
+		if (fails ? (got_end != NULL)
+		    : (got_end != want_end || got32 != want)) {
+			fprintf(stderr, "parse_u32(\"%s\", %u) == %lu\n",
+				buf, base, (unsigned long)got32);
+			++errors;
+		}
+	}
+	if (errors) {
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* n numbers, one per line, of 1 to 19 digits, or 1 to 16 in hex */
+static char *make_column(size_t n, unsigned base, uint64_t *sum,
+			 size_t *len)
+{
+	char *buf = malloc((n * 21) + 1);
+	uint64_t seed = base;
+	size_t pos = 0;
+	*sum = 0;
+	for (size_t i = 0; i < n; ++i) {
+		uint64_t v = microbench_random(&seed);
+		if (base == 10) {
+			v %= parse_powers_of_10[1 + (i % 16)] * 1000;
+		} else {
+			v >>= 4 * (i % 16);
+		}
+		*sum += v;
+		pos += sprintf(buf + pos, (base == 10) ? "%llu\n" : "%llx\n",
+			       (unsigned long long)v);
 	}
-	return clock() - start;
+	*len = pos;
+	return buf;
+}
+
+enum parse_way { way_strtoul, way_sscanf, way_parse_u64, way_lines };
+
+static uint64_t parse_column(enum parse_way way, const char *buf,
+			     size_t len, unsigned base, uint64_t *values,
+			     size_t n)
+{
+	const char *pos = buf;
+	const char *end = buf + len;
+	uint64_t sum = 0;
+	uint64_t v = 0;
+	size_t used = 0;
+	switch (way) {
+	case way_strtoul:
+		while (pos < end) {
+			char *after;
+			sum += strtoul(pos, &after, base);
+			pos = after + 1;
+		}
+		break;
+	case way_sscanf:
+		while (pos < end) {
+			/* glibc sscanf does a strlen of its input first,
+			 * so give it only the line */
+			char line[24];
+			const char *nl = memchr(pos, '\n', end - pos);
+			size_t line_len = nl ? (size_t)(nl - pos) : 0;
+			if (line_len >= sizeof(line)) {
+				line_len = sizeof(line) - 1;
+			}
+			memcpy(line, pos, line_len);
+			line[line_len] = '\0';
+			unsigned long lv = 0;
+			sscanf(line, (base == 10) ? "%lu" : "%lx", &lv);
+			sum += lv;
+			pos += line_len + 1;
+		}
+		break;
+	case way_parse_u64:
+		while (pos < end) {
+			pos = parse_u64(pos, end, base, &v) + 1;
+			sum += v;
+		}
+		break;
+	case way_lines:
+		n = parse_u64_lines(buf, len, base, values, n, &used);
+		for (size_t i = 0; i < n; ++i) {
+			sum += values[i];
+		}
+		break;
+	}
+	return sum;
+}
+
+struct parse_bench {
+	enum parse_way way;
+	const char *buf;
+	size_t len;
+	unsigned base;
+	uint64_t *values;
+	size_t n;
+	uint64_t sum;
+};
+
+/* an iteration is the whole column */
+static void bench_parse_column(void *context, size_t iterations)
+{
+	struct parse_bench *pb = (struct parse_bench *)context;
+	for (size_t i = 0; i < iterations; ++i) {
+		pb->sum = parse_column(pb->way, pb->buf, pb->len, pb->base,
+				       pb->values, pb->n);
+		Microbench_do_not_optimize(pb->sum);
+	}
+}
+
+void time_parse_functions(size_t n)
+{
+	static const char *names[] = { "strtoul", "sscanf", "parse_u64",
+		"parse_u64_lines"
+	};
+	uint64_t *values = calloc(n, sizeof(uint64_t));
+	/* touch the pages now, not while timing */
+	memset(values, 0xFF, n * sizeof(uint64_t));
+	for (unsigned base = 10; base <= 16; base += 6) {
+		uint64_t want = 0;
+		size_t len = 0;
+		char *buf = make_column(n, base, &want, &len);
+		printf("%zu numbers in base %u, %zu bytes\n", n, base, len);
+		for (int way = way_strtoul; way <= way_lines; ++way) {
+			struct parse_bench pb = { (enum parse_way)way, buf,
+				len, base, values, n, 0
+			};
+			struct microbench bench = Microbench_init;
+			bench.samples = 5;
+			microbench_run(&bench, bench_parse_column, &pb);
+			printf("%-16s %6.2f ns per number (+/- %.2f)"
+			       " %8.1f MB/s%s\n", names[way],
+			       bench.ns_median / n, bench.ns_mad / n,
+			       (len * 1e3) / bench.ns_median,
+			       pb.sum == want ? "" : " WRONG SUM");
+		}
+		free(buf);
+	}
+	free(values);
 }
 
 int main(void)
 {
 	validate_digit_to_int_functions();
+	validate_parse_functions();
 
-	int d1 = 0;
-	clock_t time1 = time_func(digit_to_int_subtract, &d1);
-	printf("%lld: digit_to_int_subtract (%d)\n", (long long)time1, d1);
+	unsigned d1 = time_digit_to_int(bench_digit_to_int_subtract,
+					"digit_to_int_subtract");
+	unsigned d2 = time_digit_to_int(bench_digit_to_int_mask,
+					"digit_to_int_mask    ");
+	if (d1 != 45 || d2 != 45) {
+		fprintf(stderr, "digit sums %u and %u, not 45?\n", d1, d2);
+		return EXIT_FAILURE;
+	}
 
-	int d2 = 0;
-	clock_t time2 = time_func(digit_to_int_mask, &d2);
-	printf("%lld: digit_to_int_mask     (%d)\n", (long long)time2, d2);
+	time_parse_functions(1000 * 1000);
 
 	return 0;
 }
+#endif /* DIGIT_TO_INT_LIB */
@@ -0,0 +1,291 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2026 Eric Herman <eric@freesa.org> */
+
+/* hex-bench.c : bin_to_hex_chunk and hex_to_bin_chunk versus the
+ * simple, one character at a time, versions; checks that the output
+ * is the same, then reports GB/s
+ *
+ * cc -O2 -DNDEBUG -march=native c/hex-bench.c -o hex-bench
+ * ./hex-bench [megabytes] [samples]
+ */
+
+/* the stdin and stdout defaults are not used here */
+#define read_byte_stdin 0
+#define write_byte_stdout 0
+#define read_block_stdin 0
+#define write_block_stdout 0
+
+#define BIN_TO_HEX_LIB 1
+#include "bin-to-hex.c"
+
+#define HEX_TO_BIN_LIB 1
+#include "hex-to-bin.c"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "microbench.h"
+
+typedef int (*hex_to_bin_func)(struct hex_to_bin_state *state,
+			       const char *in, size_t len,
+			       unsigned char *out, size_t *written);
+
+/* decodes in randomly sized chunks, returns the bytes written, or -1 */
+static long decode_in_chunks(hex_to_bin_func decode, const char *in,
+			     size_t len, unsigned char *out, uint64_t seed)
+{
+	struct hex_to_bin_state state = Hex_to_bin_state_init;
+	size_t w = 0;
+	for (size_t i = 0; i < len;) {
+		size_t chunk = 1 + (microbench_random(&seed) % 200);
+		if (chunk > (len - i)) {
+			chunk = len - i;
+		}
+		size_t written = 0;
+		int err = decode(&state, in + i, chunk, out + w, &written);
+		w += written;
+		if (err) {
+			return -1 - (long)w;
+		}
+		i += chunk;
+	}
+	return state.have_hi ? (-1 - (long)w) : (long)w;
+}
+
+/* hex dumps with comments, odd spacing, and mistakes sprinkled in */
+static int check_identical(void)
+{
+	enum { max_len = 4096 };
+	static const char noise[][8] = {
+		"# a", "\n", " ", "\t", "\r\n", "zz", "#\n", "0", "00 ",
+		"ab\n", "AB", "\n# x y\n"
+	};
+	static char hex[max_len + 64];
+	static unsigned char out1[max_len], out2[max_len];
+	uint64_t seed = 3;
+	int errors = 0;
+
+	for (size_t round = 0; round < 20000; ++round) {
+		unsigned char bytes[512];
+		size_t bytes_len = microbench_random(&seed) % sizeof(bytes);
+		for (size_t i = 0; i < bytes_len; ++i) {
+			bytes[i] = microbench_random(&seed);
+		}
+		struct bin_to_hex_state state = Bin_to_hex_state_init;
+		size_t len = bin_to_hex_chunk(&state, bytes, bytes_len, hex);
+		len += bin_to_hex_finish(&state, hex + len);
+		if (round & 1) {
+			/* run together */
+			size_t k = 0;
+			for (size_t i = 0; i < len; ++i) {
+				if (hex[i] != ' ' && hex[i] != '\n') {
+					hex[k++] = hex[i];
+				}
+			}
+			len = k;
+		}
+		size_t splats = (round % 3) ? microbench_random(&seed) % 4 : 0;
+		for (size_t s = 0; s < splats; ++s) {
+			const char *n = noise[microbench_random(&seed) %
+					      (sizeof(noise) / sizeof(noise[0]))];
+			size_t n_len = strlen(n);
+			size_t at = len ? microbench_random(&seed) % len : 0;
+			memmove(hex + at + n_len, hex + at, len - at);
+			memcpy(hex + at, n, n_len);
+			len += n_len;
+		}
+
+		memset(out1, 0, sizeof(out1));
+		memset(out2, 0, sizeof(out2));
+		long w1 = decode_in_chunks(hex_to_bin_chunk, hex, len, out1,
+					   round);
+		long w2 = decode_in_chunks(hex_to_bin_chunk_simple, hex, len,
+					   out2, round + 1);
+		if (w1 != w2 || memcmp(out1, out2, sizeof(out1))) {
+			fprintf(stderr, "decode round %zu differs\n", round);
+			++errors;
+		}
+		if (!splats && (w1 != (long)bytes_len
+				|| memcmp(out1, bytes, bytes_len))) {
+			fprintf(stderr, "round trip %zu differs\n", round);
+			++errors;
+		}
+
+		char hex2[Bin_to_hex_size_needed(sizeof(bytes))];
+		struct bin_to_hex_state s1 = Bin_to_hex_state_init;
+		struct bin_to_hex_state s2 = Bin_to_hex_state_init;
+		size_t split = bytes_len ? microbench_random(&seed) % bytes_len : 0;
+		size_t l1 = bin_to_hex_chunk(&s1, bytes, split, hex);
+		l1 += bin_to_hex_chunk(&s1, bytes + split, bytes_len - split,
+				       hex + l1);
+		size_t l2 = bin_to_hex_chunk_simple(&s2, bytes, bytes_len, hex2);
+		if (l1 != l2 || memcmp(hex, hex2, l1)) {
+			fprintf(stderr, "encode round %zu differs\n", round);
+			++errors;
+		}
+	}
+	return errors;
+}
+
+typedef size_t (*bin_to_hex_func)(struct bin_to_hex_state *state,
+				  const unsigned char *in, size_t len,
+				  char *out);
+
+struct hex_bench {
+	bin_to_hex_func encode;
+	hex_to_bin_func decode;
+	const void *in;
+	size_t len;
+	void *out;
+	size_t written;
+	int failed;
+};
+
+/* an iteration encodes, or decodes, the whole buffer */
+static void bench_encode(void *context, size_t iterations)
+{
+	struct hex_bench *hb = context;
+	for (size_t i = 0; i < iterations; ++i) {
+		struct bin_to_hex_state state = Bin_to_hex_state_init;
+		char *out = hb->out;
+		size_t w = hb->encode(&state, hb->in, hb->len, out);
+		hb->written = w + bin_to_hex_finish(&state, out + w);
+		Microbench_do_not_optimize(hb->out);
+	}
+}
+
+static void bench_decode(void *context, size_t iterations)
+{
+	struct hex_bench *hb = context;
+	for (size_t i = 0; i < iterations; ++i) {
+		struct hex_to_bin_state state = Hex_to_bin_state_init;
+		if (hb->decode(&state, hb->in, hb->len, hb->out,
+			       &hb->written)) {
+			hb->failed = 1;
+		}
+		Microbench_do_not_optimize(hb->out);
+	}
+}
+
+/* returns the median ns of one pass */
+static double time_hex(microbench_func func, struct hex_bench *hb,
+		       size_t samples)
+{
+	struct microbench bench = Microbench_init;
+	bench.samples = samples;
+	microbench_run(&bench, func, hb);
+	if (hb->failed) {
+		fprintf(stderr, "decode failed\n");
+		exit(EXIT_FAILURE);
+	}
+	return bench.ns_median;
+}
+
+/* "# line N" before every 16th line */
+static size_t add_comments(const char *hex, size_t len, char *out)
+{
+	size_t w = 0;
+	size_t line = 0;
+	for (size_t i = 0; i < len; ++i) {
+		if ((i == 0 || hex[i - 1] == '\n') && !(line++ % 16)) {
+			w += sprintf(out + w, "# line %zu\n", line);
+		}
+		out[w++] = hex[i];
+	}
+	return w;
+}
+
+int main(int argc, char **argv)
+{
+	size_t megabytes = (argc > 1) ? strtoul(argv[1], NULL, 10) : 64;
+	size_t samples = (argc > 2) ? strtoul(argv[2], NULL, 10) : 3;
+	size_t len = megabytes * 1024 * 1024;
+
+	if (check_identical()) {
+		return EXIT_FAILURE;
+	}
+#if defined(HEX_TO_BIN_AVX2)
+	printf("kernel: avx2, identical to the simple path\n");
+#elif defined(HEX_TO_BIN_SSSE3)
+	printf("kernel: ssse3, identical to the simple path\n");
+#else
+	printf("kernel: none, the simple path only\n");
+#endif
+
+	size_t hex_size = Bin_to_hex_size_needed(len);
+	unsigned char *bytes = malloc(len);
+	unsigned char *out = malloc(len);
+	char *hex = malloc(hex_size);
+	char *hex_simple = malloc(hex_size);
+	char *dense = malloc(hex_size);
+	char *commented = malloc(hex_size + (hex_size / 16));
+	if (!bytes || !out || !hex || !hex_simple || !dense || !commented) {
+		return EXIT_FAILURE;
+	}
+	uint64_t seed = 7;
+	for (size_t i = 0; i < len; ++i) {
+		bytes[i] = microbench_random(&seed);
+	}
+
+	double ns[2][4];
+	struct hex_bench simple = { bin_to_hex_chunk_simple, NULL, bytes,
+		len, hex_simple, 0, 0
+	};
+	struct hex_bench simd = { bin_to_hex_chunk, NULL, bytes, len, hex, 0,
+		0
+	};
+	ns[0][0] = time_hex(bench_encode, &simple, samples);
+	ns[1][0] = time_hex(bench_encode, &simd, samples);
+	size_t hex_len = simd.written;
+	if (hex_len != simple.written || memcmp(hex, hex_simple, hex_len)) {
+		fprintf(stderr, "encoded output differs\n");
+		return EXIT_FAILURE;
+	}
+
+	size_t dense_len = 0;
+	for (size_t i = 0; i < hex_len; ++i) {
+		if (hex[i] != ' ' && hex[i] != '\n') {
+			dense[dense_len++] = hex[i];
+		}
+	}
+	size_t commented_len = add_comments(hex, hex_len, commented);
+
+	const char *inputs[3] = { hex, dense, commented };
+	size_t lens[3] = { hex_len, dense_len, commented_len };
+	hex_to_bin_func decodes[2] = { hex_to_bin_chunk_simple,
+		hex_to_bin_chunk
+	};
+	for (size_t k = 0; k < 3; ++k) {
+		for (size_t f = 0; f < 2; ++f) {
+			struct hex_bench hb = { NULL, decodes[f], inputs[k],
+				lens[k], out, 0, 0
+			};
+			memset(out, 0, len);
+			ns[f][1 + k] = time_hex(bench_decode, &hb, samples);
+			if (hb.written != len || memcmp(out, bytes, len)) {
+				fprintf(stderr, "round trip %zu differs\n", k);
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	const char *what[4] = { "encode", "decode spaced", "decode dense",
+		"decode commented"
+	};
+	printf("%zu MB of bytes, GB/s of bytes, median of %zu\n", megabytes,
+	       samples);
+	printf("%-17s %8s %8s %8s\n", "", "simple", "simd", "speedup");
+	for (size_t k = 0; k < 4; ++k) {
+		printf("%-17s %8.2f %8.2f %7.1fx\n", what[k],
+		       len / ns[0][k], len / ns[1][k], ns[0][k] / ns[1][k]);
+	}
+
+	free(commented);
+	free(dense);
+	free(hex_simple);
+	free(hex);
+	free(out);
+	free(bytes);
+	return EXIT_SUCCESS;
+}
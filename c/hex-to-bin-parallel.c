@@ -0,0 +1,329 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2026 Eric Herman <eric@freesa.org> */
+
+/* hex-to-bin-parallel.c : hex_to_bin of a large file, on many threads
+ *
+ * The input is mapped, and cut into a chunk per thread, each cut just
+ * after a line break, so that every chunk starts outside of a comment
+ * and between pairs, just as hex_to_bin would be at that point. Each
+ * thread first counts the bytes of its chunk (finding any error), then
+ * the output file is sized to the total, mapped, and each thread
+ * decodes its chunk into its own offset.
+ *
+ * gcc -g -Wall -Werror -O2 -DNDEBUG -march=native -pthread \
+ *	-o hex-to-bin-parallel hex-to-bin-parallel.c
+ * ./hex-to-bin-parallel [-j threads] input.hex output.bin
+ */
+
+/* the stdin and stdout defaults are not used here */
+#define read_byte_stdin 0
+#define write_byte_stdout 0
+#define read_block_stdin 0
+#define write_block_stdout 0
+
+#define HEX_TO_BIN_LIB 1
+#include "hex-to-bin.c"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef HEX_TO_BIN_PARALLEL_MAX_THREADS
+#define HEX_TO_BIN_PARALLEL_MAX_THREADS 256
+#endif
+
+enum hex_char_class {
+	hex_class_other = 0,
+	hex_class_digit,
+	hex_class_space,
+	hex_class_line,		/* also ends a comment */
+	hex_class_hash
+};
+
+static const unsigned char hex_char_classes[256] = {
+	['0'] = hex_class_digit, ['1'] = hex_class_digit,
+	['2'] = hex_class_digit, ['3'] = hex_class_digit,
+	['4'] = hex_class_digit, ['5'] = hex_class_digit,
+	['6'] = hex_class_digit, ['7'] = hex_class_digit,
+	['8'] = hex_class_digit, ['9'] = hex_class_digit,
+	['a'] = hex_class_digit, ['b'] = hex_class_digit,
+	['c'] = hex_class_digit, ['d'] = hex_class_digit,
+	['e'] = hex_class_digit, ['f'] = hex_class_digit,
+	['A'] = hex_class_digit, ['B'] = hex_class_digit,
+	['C'] = hex_class_digit, ['D'] = hex_class_digit,
+	['E'] = hex_class_digit, ['F'] = hex_class_digit,
+	[' '] = hex_class_space, ['\t'] = hex_class_space,
+	['\v'] = hex_class_space, ['\f'] = hex_class_space,
+	['\n'] = hex_class_line, ['\r'] = hex_class_line,
+	['#'] = hex_class_hash,
+};
+
+/* the bytes which hex_to_bin_chunk would write, without writing them;
+ * returns 1 where hex_to_bin_chunk would fail, with *error_at set */
+static int hex_to_bin_count(struct hex_to_bin_state *state, const char *in,
+			    size_t len, size_t *count, size_t *error_at)
+{
+	int comment = state->comment;
+	int have_hi = state->have_hi;
+	size_t digits = 0;
+	for (size_t i = 0; i < len; ++i) {
+		unsigned char cls = hex_char_classes[(unsigned char)in[i]];
+		if (comment) {
+			comment = (cls != hex_class_line);
+			continue;
+		}
+		switch (cls) {
+		case hex_class_digit:
+			++digits;
+			have_hi = !have_hi;
+			break;
+		case hex_class_hash:
+			comment = 1;
+			/* fall through */
+		case hex_class_space:
+		case hex_class_line:
+			if (have_hi) {
+				*error_at = i;
+				return 1;
+			}
+			break;
+		default:
+			*error_at = i;
+			return 1;
+		}
+	}
+	state->comment = comment;
+	state->have_hi = have_hi;
+	*count = digits / 2;
+	return 0;
+}
+
+struct hex_chunk {
+	const char *in;
+	size_t len;
+	size_t in_offset;
+	unsigned char *out;
+	size_t out_len;
+	size_t out_offset;
+	int have_hi;		/* at the end of the chunk */
+	int error;
+	size_t error_at;
+	pthread_t thread;
+};
+
+#ifndef HEX_TO_BIN_PARALLEL_SCRATCH
+#define HEX_TO_BIN_PARALLEL_SCRATCH (64 * 1024)
+#endif
+
+/* decoding into a scratch buffer, which is thrown away, is faster than
+ * hex_to_bin_count, but only hex_to_bin_count can tell where it failed */
+static void *hex_chunk_count(void *arg)
+{
+	struct hex_chunk *chunk = (struct hex_chunk *)arg;
+	struct hex_to_bin_state state = Hex_to_bin_state_init;
+	unsigned char scratch[HEX_TO_BIN_PARALLEL_SCRATCH];
+	const size_t step = 2 * sizeof(scratch);
+	chunk->out_len = 0;
+	chunk->error = 0;
+	for (size_t i = 0; i < chunk->len; i += step) {
+		size_t len = (chunk->len - i) < step ? (chunk->len - i) : step;
+		size_t written = 0;
+		if (hex_to_bin_chunk(&state, chunk->in + i, len, scratch,
+				     &written)) {
+			struct hex_to_bin_state again = Hex_to_bin_state_init;
+			chunk->error = hex_to_bin_count(&again, chunk->in,
+							chunk->len,
+							&chunk->out_len,
+							&chunk->error_at);
+			return NULL;
+		}
+		chunk->out_len += written;
+	}
+	chunk->have_hi = state.have_hi;
+	return NULL;
+}
+
+static void *hex_chunk_decode(void *arg)
+{
+	struct hex_chunk *chunk = (struct hex_chunk *)arg;
+	struct hex_to_bin_state state = Hex_to_bin_state_init;
+	size_t written = 0;
+	chunk->error = hex_to_bin_chunk(&state, chunk->in, chunk->len,
+					chunk->out, &written);
+	if (written != chunk->out_len) {
+		chunk->error = 1;
+	}
+	return NULL;
+}
+
+/* runs `func` on every chunk, each on a thread, the first on this one;
+ * any which can not get a thread run on this one, after */
+static void hex_chunks_run(struct hex_chunk *chunks, size_t count,
+			   void *(*func)(void *))
+{
+	size_t started = 1;
+	for (; started < count; ++started) {
+		if (pthread_create(&chunks[started].thread, NULL, func,
+				   &chunks[started])) {
+			break;
+		}
+	}
+	if (count) {
+		func(&chunks[0]);
+	}
+	for (size_t i = 1; i < started; ++i) {
+		pthread_join(chunks[i].thread, NULL);
+	}
+	for (size_t i = started; i < count; ++i) {
+		func(&chunks[i]);
+	}
+}
+
+/* cuts after the first line break at or after each even split */
+static size_t hex_chunks_split(struct hex_chunk *chunks, size_t threads,
+			       const char *in, size_t len)
+{
+	size_t count = 0;
+	size_t start = 0;
+	for (size_t t = 1; t <= threads && start < len; ++t) {
+		size_t end = (t == threads) ? len : ((len / threads) * t);
+		if (end < start) {
+			end = start;
+		}
+		const char *nl = (end < len) ?
+		    memchr(in + end, '\n', len - end) : NULL;
+		end = nl ? (size_t)(nl - in) + 1 : len;
+		chunks[count].in = in + start;
+		chunks[count].len = end - start;
+		chunks[count].in_offset = start;
+		++count;
+		start = end;
+	}
+	return count;
+}
+
+int hex_to_bin_parallel(const char *in_path, const char *out_path,
+			size_t threads)
+{
+	static struct hex_chunk chunks[HEX_TO_BIN_PARALLEL_MAX_THREADS];
+	const char *in = NULL;
+	unsigned char *out = NULL;
+	size_t in_len = 0;
+	size_t out_len = 0;
+	int out_fd = -1;
+	int err = 1;
+
+	if (threads < 1) {
+		threads = 1;
+	}
+	if (threads > HEX_TO_BIN_PARALLEL_MAX_THREADS) {
+		threads = HEX_TO_BIN_PARALLEL_MAX_THREADS;
+	}
+
+	int in_fd = open(in_path, O_RDONLY);
+	if (in_fd < 0) {
+		perror(in_path);
+		return 1;
+	}
+	struct stat st;
+	if (fstat(in_fd, &st)) {
+		perror(in_path);
+		goto end;
+	}
+	in_len = (size_t)st.st_size;
+	if (in_len) {
+		in = mmap(NULL, in_len, PROT_READ, MAP_PRIVATE, in_fd, 0);
+		if (in == MAP_FAILED) {
+			in = NULL;
+			perror("mmap");
+			goto end;
+		}
+		madvise((void *)in, in_len, MADV_SEQUENTIAL);
+	}
+
+	size_t count = hex_chunks_split(chunks, threads, in, in_len);
+	hex_chunks_run(chunks, count, hex_chunk_count);
+	for (size_t i = 0; i < count; ++i) {
+		if (chunks[i].error) {
+			fprintf(stderr, "%s: not hex, or a split byte,"
+				" at offset %zu\n", in_path,
+				chunks[i].in_offset + chunks[i].error_at);
+			goto end;
+		}
+		chunks[i].out_offset = out_len;
+		out_len += chunks[i].out_len;
+	}
+	/* only the end of the input can be part way through a byte */
+	if (count && chunks[count - 1].have_hi) {
+		fprintf(stderr, "%s: odd number of hex digits\n", in_path);
+		goto end;
+	}
+
+	out_fd = open(out_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (out_fd < 0) {
+		perror(out_path);
+		goto end;
+	}
+	if (ftruncate(out_fd, (off_t)out_len)) {
+		perror(out_path);
+		goto end;
+	}
+	if (out_len) {
+		out = mmap(NULL, out_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+			   out_fd, 0);
+		if (out == MAP_FAILED) {
+			out = NULL;
+			perror("mmap");
+			goto end;
+		}
+	}
+	for (size_t i = 0; i < count; ++i) {
+		chunks[i].out = out + chunks[i].out_offset;
+	}
+	hex_chunks_run(chunks, count, hex_chunk_decode);
+	err = 0;
+	for (size_t i = 0; i < count; ++i) {
+		err |= chunks[i].error;
+	}
+
+end:
+	if (out) {
+		munmap(out, out_len);
+	}
+	if (out_fd >= 0 && close(out_fd)) {
+		perror(out_path);
+		err = 1;
+	}
+	if (in) {
+		munmap((void *)in, in_len);
+	}
+	close(in_fd);
+	return err;
+}
+
+#ifndef HEX_TO_BIN_PARALLEL_LIB
+int main(int argc, char **argv)
+{
+	long threads = sysconf(_SC_NPROCESSORS_ONLN);
+	int arg = 1;
+	if (argc > 2 && strcmp(argv[1], "-j") == 0) {
+		threads = atol(argv[2]);
+		arg += 2;
+	}
+	if ((argc - arg) != 2) {
+		fprintf(stderr, "usage: %s [-j threads] input.hex output.bin\n",
+			argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (threads < 1) {
+		threads = 1;
+	}
+	return hex_to_bin_parallel(argv[arg], argv[arg + 1], threads)
+	    ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+#endif
@@ -31,6 +31,48 @@ static int write_byte_stdout_posix(void *b)
 #error "write_byte_stdout not defined"
 #endif
 
+#ifndef read_block_stdin
+#if defined (__unix__) || (defined (__APPLE__) && defined (__MACH__))
+#include <unistd.h>
+static size_t read_block_stdin_posix(void *buf, size_t len)
+{
+	ssize_t got = read(STDIN_FILENO, buf, len);
+	return (got > 0) ? (size_t)got : 0;
+}
+
+#define read_block_stdin read_block_stdin_posix
+#endif
+#endif
+#ifndef read_block_stdin
+#error "read_block_stdin not defined"
+#endif
+
+#ifndef write_block_stdout
+#if defined (__unix__) || (defined (__APPLE__) && defined (__MACH__))
+#include <unistd.h>
+static int write_block_stdout_posix(const void *buf, size_t len)
+{
+	const char *pos = (const char *)buf;
+	while (len) {
+		ssize_t put = write(STDOUT_FILENO, pos, len);
+		if (put <= 0) {
+			return 1;
+		}
+		pos += put;
+		len -= put;
+	}
+	return 0;
+}
+
+#define write_block_stdout write_block_stdout_posix
+#endif
+#endif
+#ifndef write_block_stdout
+#error "write_block_stdout not defined"
+#endif
+
+#include <stddef.h>
+
 static unsigned char hex_to_nibble(char hex)
 {
 	if (hex >= '0' && hex <= '9') {
@@ -79,15 +121,29 @@ static int is_hex(char c)
 	    )? 1 : 0;
 }
 
-int hex_to_bin(int (*read_byte)(void *b), int (*write_byte)(void *b))
+/* what is carried from one chunk to the next */
+struct hex_to_bin_state {
+	int comment;
+	int have_hi;
+	char hi;
+};
+
+#define Hex_to_bin_state_init { 0, 0, 0 }
+
+/* the state machine, a character at a time; `resync`, if not zero, is
+ * the count after which it returns once the state is clear again, so
+ * that the caller can try the SIMD path; *used is the characters read */
+static int hex_to_bin_steps(struct hex_to_bin_state *state, const char *in,
+			    size_t len, unsigned char *out, size_t *written,
+			    size_t resync, size_t *used)
 {
-	int comment = 0;
-	char c = 0;
-	int have_hi = 0;
-	unsigned char b = 0;
-	char hi = 0;
-	char lo = 0;
-	while (read_byte(&c)) {
+	int comment = state->comment;
+	int have_hi = state->have_hi;
+	char hi = state->hi;
+	size_t w = 0;
+	int err = 0;
+	for (size_t i = 0; i < len; ++i) {
+		char c = in[i];
 		if (c == '#') {
 			comment = 1;
 		} else if (c == '\n' || c == '\r') {
@@ -95,29 +151,296 @@ int hex_to_bin(int (*read_byte)(void *b), int (*write_byte)(void *b))
 		}
 		if (is_space(c) || comment) {
 			if (have_hi) {
-				return 1;
+				err = 1;
+				break;
+			}
+			if (resync && i >= resync && !comment) {
+				len = i + 1;
+				break;
 			}
 			continue;
 		}
 		if (!is_hex(c)) {
-			return 1;
+			err = 1;
+			break;
 		}
 		if (have_hi) {
 			have_hi = 0;
-			lo = c;
-			b = hex_chars_to_byte(hi, lo);
-			write_byte(&b);
+			out[w++] = hex_chars_to_byte(hi, c);
 		} else {
 			have_hi = 1;
 			hi = c;
 		}
+		/* between pairs, unless a separator follows */
+		if (resync && i >= resync && !have_hi
+		    && ((i + 1) == len || !is_space(in[i + 1]))) {
+			len = i + 1;
+			break;
+		}
 	}
-	return have_hi ? 1 : 0;
+	state->comment = comment;
+	state->have_hi = have_hi;
+	state->hi = hi;
+	*written = w;
+	*used = len;
+	return err;
+}
+
+/* the same as hex_to_bin_chunk, a character at a time, without SIMD */
+int hex_to_bin_chunk_simple(struct hex_to_bin_state *state, const char *in,
+			    size_t len, unsigned char *out, size_t *written)
+{
+	size_t used = 0;
+	return hex_to_bin_steps(state, in, len, out, written, 0, &used);
+}
+
+#ifndef HEX_TO_BIN_NO_SIMD
+#if defined(__AVX2__)
+#define HEX_TO_BIN_AVX2 1
+#endif
+#if defined(__SSSE3__)
+#define HEX_TO_BIN_SSSE3 1
+#include <immintrin.h>
+#endif
+#endif
+
+#ifdef HEX_TO_BIN_SSSE3
+/* the nibble of each hex digit, and a mask of which were hex digits */
+static inline __m128i hex_to_nibbles(__m128i c, __m128i *is_hex_mask)
+{
+	__m128i d = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+	__m128i is_d = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+	__m128i l = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)),
+				 _mm_set1_epi8('a'));
+	__m128i is_l = _mm_cmpeq_epi8(_mm_min_epu8(l, _mm_set1_epi8(5)), l);
+	*is_hex_mask = _mm_or_si128(is_d, is_l);
+	__m128i ten_up = _mm_add_epi8(l, _mm_set1_epi8(10));
+	return _mm_or_si128(_mm_and_si128(is_d, d),
+			    _mm_and_si128(is_l, ten_up));
+}
+
+/* "HH HH HH", as bin_to_hex writes, is 16 bytes in 48 characters: each
+ * vector of 16 characters has the digits and separators in one of three
+ * phases, and gives some of the high and low nibbles */
+static const signed char hex_to_bin_triples_hex[3][16] = {
+	{ -1, -1, 0, -1, -1, 0, -1, -1, 0, -1, -1, 0, -1, -1, 0, -1 },
+	{ -1, 0, -1, -1, 0, -1, -1, 0, -1, -1, 0, -1, -1, 0, -1, -1 },
+	{ 0, -1, -1, 0, -1, -1, 0, -1, -1, 0, -1, -1, 0, -1, -1, 0 },
+};
+
+static const signed char hex_to_bin_triples_hi[3][16] = {
+	{ 0, 3, 6, 9, 12, 15, -128, -128,
+	  -128, -128, -128, -128, -128, -128, -128, -128 },
+	{ -128, -128, -128, -128, -128, -128, 2, 5,
+	  8, 11, 14, -128, -128, -128, -128, -128 },
+	{ -128, -128, -128, -128, -128, -128, -128, -128,
+	  -128, -128, -128, 1, 4, 7, 10, 13 },
+};
+
+static const signed char hex_to_bin_triples_lo[3][16] = {
+	{ 1, 4, 7, 10, 13, -128, -128, -128,
+	  -128, -128, -128, -128, -128, -128, -128, -128 },
+	{ -128, -128, -128, -128, -128, 0, 3, 6,
+	  9, 12, 15, -128, -128, -128, -128, -128 },
+	{ -128, -128, -128, -128, -128, -128, -128, -128,
+	  -128, -128, -128, 2, 5, 8, 11, 14 },
+};
+
+#define Hex_to_bin_load(table) _mm_loadu_si128((const __m128i *)(table))
+
+/* the separators may be a space or a line break, nothing else */
+static inline int hex_to_bin_triples_part(const char *in, int j,
+					  __m128i *hi, __m128i *lo)
+{
+	__m128i c = _mm_loadu_si128((const __m128i *)(in + (16 * j)));
+	__m128i is_hex_mask;
+	__m128i n = hex_to_nibbles(c, &is_hex_mask);
+	__m128i is_sep = _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8(' ')),
+				      _mm_cmpeq_epi8(c, _mm_set1_epi8('\n')));
+	__m128i want_hex = Hex_to_bin_load(hex_to_bin_triples_hex[j]);
+	__m128i ok = _mm_or_si128(_mm_and_si128(want_hex, is_hex_mask),
+				  _mm_andnot_si128(want_hex, is_sep));
+	*hi = _mm_or_si128(*hi, _mm_shuffle_epi8(n,
+			   Hex_to_bin_load(hex_to_bin_triples_hi[j])));
+	*lo = _mm_or_si128(*lo, _mm_shuffle_epi8(n,
+			   Hex_to_bin_load(hex_to_bin_triples_lo[j])));
+	return _mm_movemask_epi8(ok) == 0xFFFF;
+}
+
+/* decodes while the input is hex digits in pairs, either run together,
+ * or with a space or line break after each pair; these change nothing
+ * in the state of the scalar path, which handles all else, and which
+ * starts where this stopped; returns the characters used */
+static size_t hex_to_bin_runs(const char *in, size_t len, unsigned char *out,
+			      size_t *written)
+{
+	size_t i = 0;
+	size_t w = 0;
+	while (1) {
+		/* the separator after the first pair tells which it is */
+		if ((len - i) >= 48
+		    && (in[i + 2] == ' ' || in[i + 2] == '\n')) {
+			__m128i hi = _mm_setzero_si128();
+			__m128i lo = _mm_setzero_si128();
+			int ok = hex_to_bin_triples_part(in + i, 0, &hi, &lo);
+			ok &= hex_to_bin_triples_part(in + i, 1, &hi, &lo);
+			ok &= hex_to_bin_triples_part(in + i, 2, &hi, &lo);
+			if (ok) {
+				__m128i b = _mm_or_si128(_mm_slli_epi16(hi, 4),
+							 lo);
+				_mm_storeu_si128((__m128i *)(out + w), b);
+				i += 48;
+				w += 16;
+				continue;
+			}
+			break;
+		}
+#ifdef HEX_TO_BIN_AVX2
+		if ((len - i) >= 64) {
+			__m256i c0 = _mm256_loadu_si256((const __m256i *)
+							(in + i));
+			__m256i c1 = _mm256_loadu_si256((const __m256i *)
+							(in + i + 32));
+			__m128i m0, m1, m2, m3;
+			__m128i n0 = hex_to_nibbles(_mm256_castsi256_si128(c0),
+						    &m0);
+			__m128i n1 = hex_to_nibbles(_mm256_extracti128_si256
+						    (c0, 1), &m1);
+			__m128i n2 = hex_to_nibbles(_mm256_castsi256_si128(c1),
+						    &m2);
+			__m128i n3 = hex_to_nibbles(_mm256_extracti128_si256
+						    (c1, 1), &m3);
+			__m128i all = _mm_and_si128(_mm_and_si128(m0, m1),
+						    _mm_and_si128(m2, m3));
+			if (_mm_movemask_epi8(all) == 0xFFFF) {
+				__m256i n = _mm256_set_m128i(n1, n0);
+				__m256i m = _mm256_set_m128i(n3, n2);
+				const __m256i weights = _mm256_set1_epi16(0x0110);
+				__m256i b = _mm256_packus_epi16(
+					_mm256_maddubs_epi16(n, weights),
+					_mm256_maddubs_epi16(m, weights));
+				/* packus works per lane: 0,2 | 1,3 */
+				b = _mm256_permute4x64_epi64(b, 0xD8);
+				_mm256_storeu_si256((__m256i *)(out + w), b);
+				i += 64;
+				w += 32;
+				continue;
+			}
+		}
+#endif
+		if ((len - i) >= 32) {
+			__m128i m0, m1;
+			__m128i c0 = _mm_loadu_si128((const __m128i *)(in + i));
+			__m128i c1 = _mm_loadu_si128((const __m128i *)
+						     (in + i + 16));
+			__m128i n0 = hex_to_nibbles(c0, &m0);
+			__m128i n1 = hex_to_nibbles(c1, &m1);
+			if (_mm_movemask_epi8(_mm_and_si128(m0, m1)) == 0xFFFF) {
+				const __m128i weights = _mm_set1_epi16(0x0110);
+				__m128i b = _mm_packus_epi16(
+					_mm_maddubs_epi16(n0, weights),
+					_mm_maddubs_epi16(n1, weights));
+				_mm_storeu_si128((__m128i *)(out + w), b);
+				i += 32;
+				w += 16;
+				continue;
+			}
+		}
+		break;
+	}
+	*written = w;
+	return i;
+}
+#endif
+
+#ifndef HEX_TO_BIN_RESYNC
+#define HEX_TO_BIN_RESYNC 16
+#endif
+
+/* decodes a chunk, of any size, into `out`, which must have room for
+ * (len + 1) / 2 bytes; returns 1 at the first character which is not
+ * hex, or splits a byte, with `*written` set to what was decoded */
+int hex_to_bin_chunk(struct hex_to_bin_state *state, const char *in,
+		     size_t len, unsigned char *out, size_t *written)
+{
+#ifdef HEX_TO_BIN_SSSE3
+	size_t i = 0;
+	size_t w = 0;
+	while (i < len) {
+		size_t step = 0;
+		if (!state->comment && !state->have_hi) {
+			i += hex_to_bin_runs(in + i, len - i, out + w, &step);
+			w += step;
+			if (i == len) {
+				break;
+			}
+		}
+		/* comments, odd spacing, and the rest of the chunk */
+		size_t used = 0;
+		int err = hex_to_bin_steps(state, in + i, len - i, out + w,
+					   &step, HEX_TO_BIN_RESYNC, &used);
+		i += used;
+		w += step;
+		if (err) {
+			*written = w;
+			return err;
+		}
+	}
+	*written = w;
+	return 0;
+#else
+	return hex_to_bin_chunk_simple(state, in, len, out, written);
+#endif
+}
+
+int hex_to_bin(int (*read_byte)(void *b), int (*write_byte)(void *b))
+{
+	struct hex_to_bin_state state = Hex_to_bin_state_init;
+	char c = 0;
+	unsigned char b = 0;
+	size_t written = 0;
+	while (read_byte(&c)) {
+		if (hex_to_bin_chunk(&state, &c, 1, &b, &written)) {
+			return 1;
+		}
+		if (written) {
+			write_byte(&b);
+		}
+	}
+	return state.have_hi ? 1 : 0;
+}
+
+#ifndef HEX_TO_BIN_BLOCK_SIZE
+#define HEX_TO_BIN_BLOCK_SIZE (64 * 1024)
+#endif
+
+/* like hex_to_bin, but HEX_TO_BIN_BLOCK_SIZE at a time */
+int hex_to_bin_blocks(size_t (*read_block)(void *buf, size_t len),
+		      int (*write_block)(const void *buf, size_t len))
+{
+	static char in[HEX_TO_BIN_BLOCK_SIZE];
+	static unsigned char out[(HEX_TO_BIN_BLOCK_SIZE + 1) / 2];
+	struct hex_to_bin_state state = Hex_to_bin_state_init;
+	size_t len = 0;
+	size_t written = 0;
+	while ((len = read_block(in, sizeof(in))) > 0) {
+		int err = hex_to_bin_chunk(&state, in, len, out, &written);
+		if (write_block(out, written) || err) {
+			return 1;
+		}
+	}
+	return state.have_hi ? 1 : 0;
 }
 
 #ifndef HEX_TO_BIN_LIB
-int main(void)
+#include <string.h>
+
+/* --byte-at-a-time for the old way, one system call per byte */
+int main(int argc, char **argv)
 {
-	return hex_to_bin(read_byte_stdin, write_byte_stdout);
+	if (argc > 1 && strcmp(argv[1], "--byte-at-a-time") == 0) {
+		return hex_to_bin(read_byte_stdin, write_byte_stdout);
+	}
+	return hex_to_bin_blocks(read_block_stdin, write_block_stdout);
 }
 #endif
@@ -0,0 +1,254 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2026 Eric Herman <eric@freesa.org> */
+
+/* itoan-bench.c : u64toan, i64toan, u32toan and format_u64_array
+ * versus snprintf, first checking that they write the same
+ *
+ * cc -O2 -DNDEBUG c/itoan-bench.c -o itoan-bench
+ * ./itoan-bench [count] [samples]
+ */
+
+#define ITOAN_LIB 1
+#include "itoan.c"
+
+#include <inttypes.h>
+
+#include "microbench.h"
+
+/* lengths spread evenly, as in logs: from 1 to 20 digits */
+static uint64_t random_value(uint64_t *seed)
+{
+	unsigned bits = 1 + (microbench_random(seed) % 64);
+	uint64_t n = microbench_random(seed);
+	return (bits == 64) ? n : (n & ((1ULL << bits) - 1));
+}
+
+static int check_one(const char *got, const char *want, const char *what,
+		     uint64_t n)
+{
+	if (!got || strcmp(got, want)) {
+		fprintf(stderr, "%s(%" PRIu64 "): '%s' != '%s'\n", what, n,
+			got ? got : "(null)", want);
+		return 1;
+	}
+	return 0;
+}
+
+static const uint64_t edges[] = {
+	0, 1, 9, 10, 99, 100, 999, 1000, 9999, 10000, UINT32_MAX,
+	(uint64_t)UINT32_MAX + 1, 9999999999ULL, 10000000000ULL,
+	INT64_MAX, (uint64_t)INT64_MAX + 1, 9999999999999999999ULL,
+	10000000000000000000ULL, UINT64_MAX
+};
+
+#define edges_count (sizeof(edges) / sizeof(edges[0]))
+
+/* format_u64_array into every buffer length, most of which end part
+ * way through a value: only the whole values which fit, and the NULL,
+ * may be written */
+static int check_array(void)
+{
+	char want[edges_count * 21 + 1], got[edges_count * 21 + 2];
+	size_t ends[edges_count + 1];
+	int errors = 0;
+
+	ends[0] = 0;
+	for (size_t i = 0; i < edges_count; ++i) {
+		ends[i + 1] = ends[i] + snprintf(want + ends[i],
+						 sizeof(want) - ends[i],
+						 "%" PRIu64 ",", edges[i]);
+	}
+	for (size_t buflen = 0; buflen <= ends[edges_count] + 1; ++buflen) {
+		size_t fit = 0;
+		while (fit < edges_count && ends[fit + 1] + 1 <= buflen) {
+			++fit;
+		}
+		size_t written = (size_t)-1;
+		memset(got, 'x', sizeof(got));
+		size_t count = format_u64_array(edges, edges_count, ',', got,
+						buflen, &written);
+		if (count != fit || written != ends[fit]
+		    || memcmp(got, want, written)
+		    || (buflen && got[written] != '\0')
+		    || got[buflen] != 'x') {
+			fprintf(stderr, "format_u64_array(buflen %zu): %zu"
+				" values, %zu chars, want %zu, %zu\n",
+				buflen, count, written, fit, ends[fit]);
+			++errors;
+		}
+	}
+	return errors;
+}
+
+static int check_identical(void)
+{
+	char want[80], got[80];
+	uint64_t seed = 1;
+	int errors = check_array();
+
+	for (size_t i = 0; i < 1000000; ++i) {
+		uint64_t n = (i < edges_count) ? edges[i]
+					       : random_value(&seed);
+		if (i & 1) {
+			n -= 1;
+		}
+
+		snprintf(want, sizeof(want), "%" PRIu64, n);
+		errors += check_one(u64toan(n, got, sizeof(got), 10), want,
+				    "u64toan", n);
+		snprintf(want, sizeof(want), "%" PRId64, (int64_t)n);
+		errors += check_one(i64toan(n, got, sizeof(got), 10), want,
+				    "i64toan", n);
+		snprintf(want, sizeof(want), "%" PRIu32, (uint32_t)n);
+		errors += check_one(u32toan(n, got, sizeof(got), 10), want,
+				    "u32toan", n);
+		snprintf(want, sizeof(want), "%" PRId32, (int32_t)n);
+		errors += check_one(i32toan(n, got, sizeof(got), 10), want,
+				    "i32toan", n);
+		snprintf(want, sizeof(want), "%" PRIX64, n);
+		errors += check_one(u64toan(n, got, sizeof(got), 16), want,
+				    "u64toan/16", n);
+		snprintf(want, sizeof(want), "%" PRIo64, n);
+		errors += check_one(u64toan(n, got, sizeof(got), 8), want,
+				    "u64toan/8", n);
+		snprintf(want, sizeof(want), "%" PRIo32, (uint32_t)n);
+		errors += check_one(u32toan(n, got, sizeof(got), 8), want,
+				    "u32toan/8", n);
+
+		/* exactly enough room, then one too few */
+		size_t len = strlen(want);
+		errors += check_one(u32toan(n, got, len + 1, 8), want,
+				    "u32toan/8 exact", n);
+		if (u32toan(n, got, len, 8) || got[0]) {
+			fprintf(stderr, "u32toan(%" PRIu64 ") too long\n", n);
+			++errors;
+		}
+	}
+	return errors;
+}
+
+/* each is compared with the snprintf before it */
+enum itoan_kind { snprintf_u64, u64toan_10, i64toan_10, format_array,
+	snprintf_x64, u64toan_16, kinds
+};
+
+/* writes the values a line each, returns the length */
+static size_t format_values(enum itoan_kind k, const uint64_t *values,
+			    size_t count, char *out, size_t size)
+{
+	char *pos = out;
+	char *end = out + size;
+	size_t len = 0;
+	switch (k) {
+	case snprintf_u64:
+		for (size_t i = 0; i < count; ++i) {
+			pos += snprintf(pos, end - pos, "%" PRIu64 "\n",
+					values[i]);
+		}
+		break;
+	case snprintf_x64:
+		for (size_t i = 0; i < count; ++i) {
+			pos += snprintf(pos, end - pos, "%" PRIX64 "\n",
+					values[i]);
+		}
+		break;
+	case u64toan_10:
+	case i64toan_10:
+	case u64toan_16:
+		for (size_t i = 0; i < count; ++i) {
+			if (k == i64toan_10) {
+				i64toan(values[i], pos, end - pos, 10);
+			} else {
+				u64toan(values[i], pos, end - pos,
+					k == u64toan_16 ? 16 : 10);
+			}
+			pos += strlen(pos);
+			*pos++ = '\n';
+		}
+		break;
+	case format_array:
+		format_u64_array(values, count, '\n', out, size, &len);
+		pos = out + len;
+		break;
+	case kinds:
+		break;
+	}
+	return pos - out;
+}
+
+struct itoan_bench {
+	enum itoan_kind kind;
+	const uint64_t *values;
+	size_t count;
+	char *out;
+	size_t size;
+	size_t len;
+};
+
+/* an iteration formats all the values */
+static void bench_format(void *context, size_t iterations)
+{
+	struct itoan_bench *ib = context;
+	for (size_t i = 0; i < iterations; ++i) {
+		ib->len = format_values(ib->kind, ib->values, ib->count,
+					ib->out, ib->size);
+		Microbench_do_not_optimize(ib->out);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	size_t count = (argc > 1) ? strtoul(argv[1], NULL, 10) : 10000000;
+	size_t samples = (argc > 2) ? strtoul(argv[2], NULL, 10) : 3;
+
+	if (check_identical()) {
+		return EXIT_FAILURE;
+	}
+	printf("identical to snprintf\n");
+
+	uint64_t *values = malloc(count * sizeof(uint64_t));
+	char *out = malloc(count * 21 + 1);
+	char *out2 = malloc(count * 21 + 1);
+	if (!values || !out || !out2) {
+		return EXIT_FAILURE;
+	}
+	uint64_t seed = 7;
+	for (size_t i = 0; i < count; ++i) {
+		values[i] = random_value(&seed);
+	}
+
+	const char *names[kinds] = { "snprintf", "u64toan", "i64toan",
+		"format_u64_array", "snprintf base 16", "u64toan base 16"
+	};
+	double ns[kinds];
+	size_t want_len = 0;
+	for (int k = 0; k < kinds; ++k) {
+		struct itoan_bench ib = { (enum itoan_kind)k, values, count,
+			out, (count * 21) + 1, 0
+		};
+		struct microbench bench = Microbench_init;
+		bench.samples = samples;
+		microbench_run(&bench, bench_format, &ib);
+		ns[k] = bench.ns_median;
+		if (k == snprintf_u64 || k == snprintf_x64) {
+			memcpy(out2, out, ib.len);
+			want_len = ib.len;
+		} else if (k != i64toan_10 && (ib.len != want_len
+					       || memcmp(out, out2, ib.len))) {
+			fprintf(stderr, "%s differs\n", names[k]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	printf("%zu values, 1 to 20 digits, median of %zu\n", count,
+	       samples);
+	for (int k = 0; k < kinds; ++k) {
+		printf("%-22s %7.2f ns per value\n", names[k],
+		       ns[k] / count);
+	}
+
+	free(out2);
+	free(out);
+	free(values);
+	return EXIT_SUCCESS;
+}
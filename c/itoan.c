@@ -14,6 +14,7 @@
 	https://www.gnu.org/licenses/lgpl-3.0.txt
 	https://www.gnu.org/licenses/gpl-3.0.txt
  */
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -26,86 +27,224 @@
  *
  * Typically, itoa treats non-base10 calls as unsigned, however this
  * behavior can be altered with "gcc -DNEED_SIGNED_NON_BASE10_ITOA=1".
+ *
+ * The same, for each width and signedness, are u32toan, i32toan, u64toan
+ * and i64toan: they count the digits first, then write them from the
+ * end, two at a time from a table for base 10, and with a shift and mask
+ * for bases which are powers of two. Each returns NULL, with buf set to
+ * "", if buflen is too short for the digits and the NULL terminator.
+ *
+ * This is a change for itoan in base 10, which used to be snprintf: a
+ * short buffer then got as many leading digits as fit, and the return
+ * was buf rather than NULL. Callers which relied on that truncation
+ * must now check for NULL.
+ *
+ * To compare with snprintf:
+ * cc -O2 -DNDEBUG c/itoan-bench.c -o itoan-bench && ./itoan-bench
  */
 
 #if NEED_UNSAFE_ITOA
 #define itoa(n, buf, base) itoan(n, buf, ((size_t)-1), base)
 #endif
 
+char *u32toan(uint32_t n, char *buf, size_t buflen, unsigned base);
+char *i32toan(int32_t n, char *buf, size_t buflen, unsigned base);
+char *u64toan(uint64_t n, char *buf, size_t buflen, unsigned base);
+char *i64toan(int64_t n, char *buf, size_t buflen, unsigned base);
+
+/* Writes the values in base 10, each followed by the separator, as many
+ * whole values as fit, and a NULL terminator. Returns the number of the
+ * values written, and sets *written to the characters written, not
+ * counting the NULL terminator. */
+size_t format_u64_array(const uint64_t *values, size_t count, char separator,
+			char *buf, size_t buflen, size_t *written);
+
 char *itoan(int n, char *buf, size_t buflen, unsigned base)
 {
-	size_t i, j, maxlen;
-
+	if (base == 10) {
+		return i32toan(n, buf, buflen, base);
+	}
 #if NEED_SIGNED_NON_BASE10_ITOA
-	long l;
+	return i32toan(n, buf, buflen, base);
 #else
-	unsigned l;
+	return u32toan((unsigned)n, buf, buflen, base);
 #endif
+}
 
-	char c;
+/* "00" through "99" */
+static const char itoan_digit_pairs[200 + 1] =
+    "00010203040506070809" "10111213141516171819"
+    "20212223242526272829" "30313233343536373839"
+    "40414243444546474849" "50515253545556575859"
+    "60616263646566676869" "70717273747576777879"
+    "80818283848586878889" "90919293949596979899";
 
-	if (buf == NULL || buflen == 0 || base == 0 || base > 36) {
-		return NULL;
-	}
-	maxlen = buflen - 1;
+static const char itoan_digits[36 + 1] =
+    "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
 
-	/* base is 10; good grief, just use sprintf */
+static const uint64_t itoan_powers_of_10[20] = {
+	1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+	10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+	100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+	100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+	100000000000000000ULL, 1000000000000000000ULL,
+	10000000000000000000ULL
+};
+
+static unsigned itoan_bit_width(uint64_t n)
+{
+	return 64 - __builtin_clzll(n | 1);
+}
+
+/* 1233/4096 is a little more than log10(2), so the guess from the bit
+ * width is right, or one too many */
+static unsigned itoan_count_digits_10(uint64_t n)
+{
+	n |= 1;
+	unsigned guess = (itoan_bit_width(n) * 1233) >> 12;
+	return guess + 1 - ((n < itoan_powers_of_10[guess]) ? 1 : 0);
+}
+
+static unsigned itoan_count_digits(uint64_t n, unsigned base)
+{
 	if (base == 10) {
-		snprintf(buf, buflen, "%d", n);
-		return buf;
+		return itoan_count_digits_10(n);
+	}
+	if ((base & (base - 1)) == 0) {
+		unsigned shift = __builtin_ctz(base);
+		return (itoan_bit_width(n) + shift - 1) / shift;
 	}
+	unsigned digits = 1;
+	while (n >= base) {
+		n /= base;
+		++digits;
+	}
+	return digits;
+}
 
-	/* cast to long to try to preserve sign-ness of INT_MIN */
-#if NEED_SIGNED_NON_BASE10_ITOA
-	l = (n < 0) ? -((long)n) : n;
-#else
-	l = n;
-#endif
+/* writes the digits of n, without leading zeros, ending just before
+ * `end`; the caller has counted them, and made room */
+static void itoan_fill_10(uint64_t n, char *end)
+{
+	while (n >= 100) {
+		unsigned pair = n % 100;
+		n /= 100;
+		end -= 2;
+		memcpy(end, itoan_digit_pairs + (2 * pair), 2);
+	}
+	if (n >= 10) {
+		memcpy(end - 2, itoan_digit_pairs + (2 * n), 2);
+	} else {
+		end[-1] = '0' + n;
+	}
+}
 
-	/* fill the string in little endian order */
-	i = 0;
-	do {
-		if (i >= maxlen) {
-			/* buffer too short, bail out */
-			buf[0] = '\0';
-			return NULL;
+static void itoan_fill(uint64_t n, char *end, unsigned base)
+{
+	if (base == 10) {
+		/* 32 bit division is cheaper, when it will do */
+		while (n > UINT32_MAX) {
+			uint64_t high = n / 100000000;
+			uint32_t low = n - (high * 100000000);
+			for (int i = 0; i < 4; ++i) {
+				end -= 2;
+				memcpy(end, itoan_digit_pairs + (2 * (low % 100)),
+				       2);
+				low /= 100;
+			}
+			n = high;
 		}
+		itoan_fill_10((uint32_t)n, end);
+	} else if ((base & (base - 1)) == 0) {
+		unsigned shift = __builtin_ctz(base);
+		uint64_t mask = base - 1;
+		do {
+			*--end = itoan_digits[n & mask];
+			n >>= shift;
+		} while (n);
+	} else {
+		do {
+			*--end = itoan_digits[n % base];
+			n /= base;
+		} while (n);
+	}
+}
 
-		c = l % base;
-		if (c < 10) {
-			c = '0' + c;
-		} else {
-			c = 'A' + (c - 10);
-		}
-		buf[i++] = c;
+/* returns the length, or 0 if it did not fit or the base is invalid */
+static size_t itoan_format(uint64_t n, int negative, char *buf,
+			   size_t buflen, unsigned base)
+{
+	if (buf == NULL || buflen == 0) {
+		return 0;
+	}
+	if (base < 2 || base > 36) {
+		buf[0] = '\0';
+		return 0;
+	}
+	size_t len = itoan_count_digits(n, base) + (negative ? 1 : 0);
+	if (len >= buflen) {
+		/* buffer too short, bail out */
+		buf[0] = '\0';
+		return 0;
+	}
+	if (negative) {
+		buf[0] = '-';
+	}
+	itoan_fill(n, buf + len, base);
+	buf[len] = '\0';
+	return len;
+}
 
-		l = l / base;
-	} while (l);
+char *u32toan(uint32_t n, char *buf, size_t buflen, unsigned base)
+{
+	return itoan_format(n, 0, buf, buflen, base) ? buf : NULL;
+}
 
-#if NEED_SIGNED_NON_BASE10_ITOA
-	/* tack on the sign if needed */
-	if (n < 0) {
-		if (i >= maxlen) {
-			/* buffer too short, bail out */
-			buf[0] = '\0';
-			return NULL;
-		}
-		buf[i++] = '-';
-	}
-#endif
+char *i32toan(int32_t n, char *buf, size_t buflen, unsigned base)
+{
+	/* as unsigned, so that INT32_MIN can be negated */
+	uint32_t u = (n < 0) ? (0U - (uint32_t)n) : (uint32_t)n;
+	return itoan_format(u, n < 0, buf, buflen, base) ? buf : NULL;
+}
 
-	buf[i] = '\0';
+char *u64toan(uint64_t n, char *buf, size_t buflen, unsigned base)
+{
+	return itoan_format(n, 0, buf, buflen, base) ? buf : NULL;
+}
 
-	/* reverse the string for big endian */
-	for (i = 0, j = (strnlen(buf, buflen) - 1); i < j; ++i, --j) {
-		c = buf[i];
-		buf[i] = buf[j];
-		buf[j] = c;
-	}
+char *i64toan(int64_t n, char *buf, size_t buflen, unsigned base)
+{
+	uint64_t u = (n < 0) ? (0ULL - (uint64_t)n) : (uint64_t)n;
+	return itoan_format(u, n < 0, buf, buflen, base) ? buf : NULL;
+}
+
+size_t format_u64_array(const uint64_t *values, size_t count, char separator,
+			char *buf, size_t buflen, size_t *written)
+{
+	size_t pos = 0;
+	size_t i = 0;
 
-	return buf;
+	*written = 0;
+	if (buf == NULL || buflen == 0) {
+		return 0;
+	}
+	for (; i < count; ++i) {
+		uint64_t n = values[i];
+		size_t len = itoan_count_digits_10(n);
+		/* the digits, the separator, and room for the NULL */
+		if ((buflen - pos) < (len + 2)) {
+			break;
+		}
+		itoan_fill(n, buf + pos + len, 10);
+		buf[pos + len] = separator;
+		pos += len + 1;
+	}
+	buf[pos] = '\0';
+	*written = pos;
+	return i;
 }
 
+#ifndef ITOAN_LIB
 #define BUFLEN 255
 int main(int argc, char **argv)
 {
@@ -124,3 +263,4 @@ int main(int argc, char **argv)
 
 	return 0;
 }
+#endif /* ITOAN_LIB */
@@ -0,0 +1,238 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* microbench.h : a small header-only harness for timing loops */
+/* Copyright (C) 2026 Eric Herman <eric@freesa.org> */
+
+/*
+   The function being timed runs `iterations` of the operation itself,
+   so the operation can be inlined into that loop, rather than called
+   through a pointer each time. microbench_run doubles the iterations
+   until one sample takes at least min_sample_ns, runs a few samples to
+   warm up the caches and branch predictors, then times `samples` more,
+   and reports the median and the median absolute deviation (MAD) of the
+   time per iteration: both are robust to the odd interrupted sample.
+
+	static void bench_foo(void *context, size_t iterations)
+	{
+		uint32_t x = 0;
+		for (size_t i = 0; i < iterations; ++i) {
+			uint32_t y = (uint32_t)i;
+			Microbench_do_not_optimize(y);
+			x += foo(y);
+		}
+		Microbench_do_not_optimize(x);
+	}
+
+	struct microbench bench = Microbench_init;
+	microbench_run(&bench, bench_foo, NULL);
+	printf("%.2f ns (+/- %.2f)\n", bench.ns_median, bench.ns_mad);
+
+   The cycles are the time stamp counter on x86, which ticks at a fixed
+   rate rather than with the core clock, and the virtual counter on
+   AArch64; elsewhere they are the same as the ns.
+ */
+
+#ifndef MICROBENCH_H
+#define MICROBENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <time.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#ifndef MICROBENCH_MAX_SAMPLES
+#ifdef ARDUINO
+#define MICROBENCH_MAX_SAMPLES 9
+#else
+#define MICROBENCH_MAX_SAMPLES 101
+#endif
+#endif
+
+#ifndef MICROBENCH_SAMPLES
+#define MICROBENCH_SAMPLES 21
+#endif
+
+#ifndef MICROBENCH_WARMUP_SAMPLES
+#define MICROBENCH_WARMUP_SAMPLES 2
+#endif
+
+#ifndef MICROBENCH_MIN_SAMPLE_NS
+#define MICROBENCH_MIN_SAMPLE_NS (2 * 1000 * 1000)
+#endif
+
+/* Makes the compiler assume that `x` is read and may be changed here:
+ * the code which computed it can not be removed, and the code which
+ * uses it can not be computed ahead of time. `x` must be an lvalue. */
+#if defined(__GNUC__)
+#define Microbench_do_not_optimize(x) \
+	__asm__ volatile("" : "+r,m"(x) : : "memory")
+#else
+#define Microbench_do_not_optimize(x) \
+	microbench_escape((volatile void *)&(x), sizeof(x))
+
+/* without inline asm: a volatile read and write of each byte */
+static inline void microbench_escape(volatile void *x, size_t size)
+{
+	volatile unsigned char *bytes = (volatile unsigned char *)x;
+	for (size_t i = 0; i < size; ++i) {
+		bytes[i] = bytes[i];
+	}
+}
+#endif
+
+/* a 64 bit LCG, its low bits mixed with the high ones: good enough to
+ * make up bench data, the same way in every bench */
+static inline uint64_t microbench_random(uint64_t *seed)
+{
+	*seed = (*seed * 6364136223846793005ULL) + 1442695040888963407ULL;
+	return *seed ^ (*seed >> 29);
+}
+
+/* the function which is timed runs the operation `iterations` times */
+typedef void (*microbench_func)(void *context, size_t iterations);
+
+struct microbench {
+	/* set by the caller, or left zero for the defaults */
+	size_t samples;
+	uint64_t min_sample_ns;
+	size_t min_iterations;
+
+	/* set by microbench_run; the time is per iteration */
+	size_t iterations;
+	double ns_median;
+	double ns_mad;
+	double cycles_median;
+	double cycles_mad;
+};
+
+#define Microbench_init { 0, 0, 0, 0, 0.0, 0.0, 0.0, 0.0 }
+
+static inline uint64_t microbench_ns(void)
+{
+#if defined(ARDUINO)
+	return (uint64_t)micros() * 1000;
+#elif defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec;
+#else
+	return (uint64_t)((clock() * 1e9) / CLOCKS_PER_SEC);
+#endif
+}
+
+static inline uint64_t microbench_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	/* lfence: do not start reading the counter before the work ends */
+	_mm_lfence();
+	uint64_t tsc = __rdtsc();
+	_mm_lfence();
+	return tsc;
+#elif defined(__aarch64__)
+	uint64_t cnt;
+	__asm__ volatile("isb; mrs %0, cntvct_el0" : "=r"(cnt) : : "memory");
+	return cnt;
+#else
+	return microbench_ns();
+#endif
+}
+
+static inline void microbench_sort(double *values, size_t n)
+{
+	for (size_t i = 1; i < n; ++i) {
+		double v = values[i];
+		size_t j = i;
+		for (; j > 0 && values[j - 1] > v; --j) {
+			values[j] = values[j - 1];
+		}
+		values[j] = v;
+	}
+}
+
+/* sorts values, and returns their median; *mad is set to the median
+ * of the distances from the median */
+static inline double microbench_median_mad(double *values, size_t n,
+					   double *mad)
+{
+	microbench_sort(values, n);
+	double median = (n & 1) ? values[n / 2]
+	    : ((values[(n / 2) - 1] + values[n / 2]) / 2);
+	for (size_t i = 0; i < n; ++i) {
+		double d = values[i] - median;
+		values[i] = (d < 0) ? -d : d;
+	}
+	microbench_sort(values, n);
+	*mad = (n & 1) ? values[n / 2]
+	    : ((values[(n / 2) - 1] + values[n / 2]) / 2);
+	return median;
+}
+
+static inline void microbench_sample(microbench_func func, void *context,
+				     size_t iterations, uint64_t *ns,
+				     uint64_t *cycles)
+{
+	uint64_t ns_start = microbench_ns();
+	uint64_t cycles_start = microbench_cycles();
+	func(context, iterations);
+	*cycles = microbench_cycles() - cycles_start;
+	*ns = microbench_ns() - ns_start;
+}
+
+/* returns the number of samples taken */
+static inline size_t microbench_run(struct microbench *bench,
+				    microbench_func func, void *context)
+{
+	double ns[MICROBENCH_MAX_SAMPLES];
+	double cycles[MICROBENCH_MAX_SAMPLES];
+	size_t samples = bench->samples ? bench->samples : MICROBENCH_SAMPLES;
+	uint64_t min_ns = bench->min_sample_ns ? bench->min_sample_ns
+	    : MICROBENCH_MIN_SAMPLE_NS;
+	size_t iterations = bench->min_iterations ? bench->min_iterations : 1;
+	uint64_t sample_ns = 0;
+	uint64_t sample_cycles = 0;
+
+	if (samples > MICROBENCH_MAX_SAMPLES) {
+		samples = MICROBENCH_MAX_SAMPLES;
+	}
+
+	/* calibrate: the first sample also warms up */
+	for (;;) {
+		microbench_sample(func, context, iterations, &sample_ns,
+				  &sample_cycles);
+		if (sample_ns >= min_ns || iterations > (SIZE_MAX / 8)) {
+			break;
+		}
+		/* jump most of the way there, if far from it */
+		if (sample_ns && (sample_ns * 16) < min_ns) {
+			iterations *= 8;
+		} else {
+			iterations *= 2;
+		}
+	}
+	for (size_t i = 0; i < MICROBENCH_WARMUP_SAMPLES; ++i) {
+		microbench_sample(func, context, iterations, &sample_ns,
+				  &sample_cycles);
+	}
+
+	for (size_t i = 0; i < samples; ++i) {
+		microbench_sample(func, context, iterations, &sample_ns,
+				  &sample_cycles);
+		ns[i] = (double)sample_ns / iterations;
+		cycles[i] = (double)sample_cycles / iterations;
+	}
+
+	bench->iterations = iterations;
+	bench->ns_median = microbench_median_mad(ns, samples, &bench->ns_mad);
+	bench->cycles_median = microbench_median_mad(cycles, samples,
+						     &bench->cycles_mad);
+	return samples;
+}
+
+#endif /* MICROBENCH_H */
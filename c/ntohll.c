@@ -63,13 +63,25 @@ however, nothing for 64 bit ... this #defines these:
 #define Bswap_64 Bswap_64_32x2
 #endif
 
-#if HAVE_ENDIAN_H
+/* the byte order is known at compile time: GCC and clang define
+   __BYTE_ORDER__, so there is no test at all in htonll and ntohll */
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define Host_is_big_endian 1
+#elif defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define Host_is_big_endian 0
+#elif HAVE_ENDIAN_H
 #include <endian.h>
-#define htonll(x) htobe64(x)
-#define ntohll(x) be64toh(x)
+#define Host_is_big_endian (__BYTE_ORDER == __BIG_ENDIAN)
 #else
-#define htonll(x) ((Bswap_32_constant(1) == 1) ? x : Bswap_64(x))
-#define ntohll(x) ((Bswap_32_constant(1) == 1) ? x : Bswap_64(x))
+#error "unknown byte order: define __BYTE_ORDER__ or HAVE_ENDIAN_H"
+#endif
+
+#if Host_is_big_endian
+#define htonll(x) (x)
+#define ntohll(x) (x)
+#else
+#define htonll(x) Bswap_64(x)
+#define ntohll(x) Bswap_64(x)
 #endif
 
 int main(int argc, char *argv[])
@@ -77,7 +89,7 @@ int main(int argc, char *argv[])
 	uint64_t host_le, netw_be;
 	uint64_t actual1, actual2;
 
-	if (Bswap_32_constant(1) == 1) {
+	if (Host_is_big_endian) {
 		fprintf(stderr, "this expects a little endian host\n");
 	}
 
@@ -0,0 +1,193 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2026 Eric Herman <eric@freesa.org> */
+
+/* octal-bytes-bench.c : octal_encode and octal_decode versus the
+ * simple, one group at a time, versions; checks that the output is the
+ * same, then reports GB/s of binary bytes
+ *
+ * cc -O2 -DNDEBUG -march=native c/octal-bytes-bench.c -o octal-bytes-bench
+ * ./octal-bytes-bench [megabytes] [samples]
+ *
+ * add -DOCTAL_NO_SIMD to time the table kernel on a machine which has
+ * the vector ones
+ */
+
+#define OCTAL_BYTES_LIB 1
+#include "octal-bytes.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "microbench.h"
+
+/* every length up to a few vectors, at each alignment, and with a
+ * non-octal character at each position of the encoded string */
+static int check_identical(void)
+{
+	enum { max_len = 200 };
+	uint8_t bytes[max_len + 8];
+	uint8_t out1[max_len + 8], out2[max_len + 8];
+	char oct1[(max_len * 3) + 8], oct2[(max_len * 3) + 8];
+	uint64_t seed = 1;
+	int errors = 0;
+
+	for (size_t len = 0; len <= max_len; ++len) {
+		for (size_t align = 0; align < 8; ++align) {
+			const uint8_t *in = bytes + align;
+			for (size_t i = 0; i < sizeof(bytes); ++i) {
+				bytes[i] = microbench_random(&seed);
+			}
+			size_t size = octal_encode_size_needed_for_string(len);
+			size_t w1 = 0, w2 = 0;
+			octal_encode(oct1, size, &w1, in, len);
+			octal_encode_simple(oct2, size, &w2, in, len);
+			if (w1 != w2 || memcmp(oct1, oct2, w1 + 1)) {
+				fprintf(stderr, "encode %zu+%zu differs\n",
+					align, len);
+				++errors;
+			}
+			/* w1 and w2 are reused for the decoded lengths */
+			size_t octal_len = w1;
+			size_t junk = len ? microbench_random(&seed) % octal_len
+					  : 0;
+			for (int bad = 0; bad < 2; ++bad) {
+				if (bad && octal_len) {
+					oct1[junk] = (junk & 1) ? '8' : '\n';
+					memcpy(oct2, oct1, octal_len + 1);
+				}
+				memset(out1, 0xAA, sizeof(out1));
+				memset(out2, 0xAA, sizeof(out2));
+				octal_decode(out1, len + 1, &w1, oct1,
+					     octal_len);
+				octal_decode_simple(out2, len + 1, &w2, oct2,
+						    octal_len);
+				if (w1 != w2 || memcmp(out1, out2,
+						       sizeof(out1))) {
+					fprintf(stderr, "decode %zu+%zu (%d)"
+						" differs\n", align, len, bad);
+					++errors;
+				}
+				if (!bad && (w1 != len || memcmp(out1, in,
+								 len))) {
+					fprintf(stderr, "round trip %zu+%zu"
+						" differs\n", align, len);
+					++errors;
+				}
+			}
+		}
+	}
+	return errors;
+}
+
+typedef char *(*encode_func)(char *octal, size_t octal_size,
+			     size_t *written, const uint8_t *bytes,
+			     size_t bytes_len);
+typedef uint8_t *(*decode_func)(uint8_t *bytes, size_t bytes_size,
+				size_t *written, const char *octal,
+				size_t octal_len);
+
+struct octal_bench {
+	encode_func encode;
+	decode_func decode;
+	uint8_t *bytes;
+	size_t len;
+	char *octal;
+	size_t octal_size;
+	uint8_t *out;
+	size_t written;
+};
+
+/* an iteration encodes, or decodes, the whole buffer */
+static void bench_encode(void *context, size_t iterations)
+{
+	struct octal_bench *ob = context;
+	for (size_t i = 0; i < iterations; ++i) {
+		ob->encode(ob->octal, ob->octal_size, &ob->written, ob->bytes,
+			   ob->len);
+		Microbench_do_not_optimize(ob->octal);
+	}
+}
+
+static void bench_decode(void *context, size_t iterations)
+{
+	struct octal_bench *ob = context;
+	for (size_t i = 0; i < iterations; ++i) {
+		ob->decode(ob->out, ob->len, &ob->written, ob->octal,
+			   ob->octal_size - 1);
+		Microbench_do_not_optimize(ob->out);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	size_t megabytes = (argc > 1) ? strtoul(argv[1], NULL, 10) : 64;
+	size_t samples = (argc > 2) ? strtoul(argv[2], NULL, 10) : 5;
+	size_t len = megabytes * 1024 * 1024;
+
+	int errors = check_identical();
+	if (errors) {
+		return EXIT_FAILURE;
+	}
+
+#if defined(OCTAL_AVX2)
+	const char *kernel = "avx2";
+#elif defined(OCTAL_SSSE3)
+	const char *kernel = "ssse3";
+#else
+	const char *kernel = "table";
+#endif
+	printf("kernel: %s, identical to the simple path\n", kernel);
+
+	size_t octal_size = octal_encode_size_needed_for_string(len);
+	uint8_t *bytes = malloc(len);
+	uint8_t *out = malloc(len);
+	char *octal = malloc(octal_size);
+	char *octal_simple = malloc(octal_size);
+	if (!bytes || !out || !octal || !octal_simple) {
+		return EXIT_FAILURE;
+	}
+	uint64_t seed = 7;
+	for (size_t i = 0; i < len; ++i) {
+		bytes[i] = microbench_random(&seed);
+	}
+
+	const char *names[2] = { "simple", "fast" };
+	encode_func encodes[2] = { octal_encode_simple, octal_encode };
+	decode_func decodes[2] = { octal_decode_simple, octal_decode };
+	double encode_ns[2], decode_ns[2];
+	for (size_t f = 0; f < 2; ++f) {
+		struct octal_bench ob = { encodes[f], decodes[f], bytes, len,
+			f ? octal : octal_simple, octal_size, out, 0
+		};
+		struct microbench bench = Microbench_init;
+		bench.samples = samples;
+		microbench_run(&bench, bench_encode, &ob);
+		encode_ns[f] = bench.ns_median;
+
+		memset(out, 0, len);
+		microbench_run(&bench, bench_decode, &ob);
+		decode_ns[f] = bench.ns_median;
+		if (ob.written != len || memcmp(out, bytes, len)) {
+			fprintf(stderr, "%s round trip differs\n", names[f]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (memcmp(octal, octal_simple, octal_size)) {
+		fprintf(stderr, "encoded output differs\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("%zu MB, median of %zu\n", megabytes, samples);
+	for (size_t f = 0; f < 2; ++f) {
+		printf("%-6s encode: %6.2f GB/s  decode: %6.2f GB/s\n",
+		       names[f], len / encode_ns[f], len / decode_ns[f]);
+	}
+	printf("speedup encode: %.1fx  decode: %.1fx\n",
+	       encode_ns[0] / encode_ns[1], decode_ns[0] / decode_ns[1]);
+
+	free(octal_simple);
+	free(octal);
+	free(out);
+	free(bytes);
+	return EXIT_SUCCESS;
+}
@@ -1,5 +1,5 @@
 /* SPDX-License-Identifier: LGPL-3.0-or-later */
-/* octal-bytes.c : encode bytes in octal (simple, slow) */
+/* octal-bytes.c : encode bytes in octal */
 /* Copyright (C) 2023 Eric Herman <eric@freesa.org> */
 
 #ifdef ARDUINO
@@ -35,12 +35,69 @@ uint8_t *octal_decode(uint8_t *bytes, size_t bytes_size, size_t *written,
 
 size_t octal_find_first_nonoctal(const char *octal, size_t octal_size);
 
+/* the same as the above, a group of 3 bytes and 8 digits at a time, with
+ * no lookup tables and no SIMD; simple, slow, for comparison */
+char *octal_encode_simple(char *octal, size_t octal_size, size_t *written,
+			  const uint8_t *bytes, size_t bytes_len);
+
+uint8_t *octal_decode_simple(uint8_t *bytes, size_t bytes_size,
+			     size_t *written, const char *octal,
+			     size_t octal_len);
+
 size_t octal_encode_size_needed_for_string(size_t bytes_len);
 
 /* round_up should be set to 0 unless the original octal string did not come
  * from an 8bit binary source, otherwise the trailing bits should be ignored */
 size_t octal_decode_size_needed_for_bytes(size_t octal_str_len, int round_up);
 
+/* Streaming, for input which does not fit in memory: each call takes the
+ * next chunk, of any size, and the partial group at the end of it is
+ * carried to the next call. The output is not NULL terminated. */
+struct octal_encoder {
+	uint8_t pending[3];
+	size_t pending_len;
+};
+
+void octal_encoder_init(struct octal_encoder *encoder);
+
+/* the most that octal_encoder_update can write for bytes_len */
+size_t octal_encoder_size_needed(const struct octal_encoder *encoder,
+				 size_t bytes_len);
+
+/* returns NULL if octal_size is less than octal_encoder_size_needed */
+char *octal_encoder_update(struct octal_encoder *encoder,
+			   char *octal, size_t octal_size, size_t *written,
+			   const uint8_t *bytes, size_t bytes_len);
+
+/* writes the last partial group, if any: at most 6 characters */
+char *octal_encoder_final(struct octal_encoder *encoder,
+			  char *octal, size_t octal_size, size_t *written);
+
+/* whitespace (e.g.: line breaks) between digits is skipped */
+struct octal_decoder {
+	char pending[8];
+	size_t pending_len;
+};
+
+void octal_decoder_init(struct octal_decoder *decoder);
+
+size_t octal_decoder_size_needed(const struct octal_decoder *decoder,
+				 size_t octal_len);
+
+/* returns NULL if bytes_size is less than octal_decoder_size_needed, or
+ * at a character which is neither octal nor whitespace; *written is what
+ * was decoded before it */
+uint8_t *octal_decoder_update(struct octal_decoder *decoder,
+			      uint8_t *bytes, size_t bytes_size,
+			      size_t *written, const char *octal,
+			      size_t octal_len);
+
+/* writes what is left of a partial group, as octal_decode would:
+ * at most 2 bytes */
+uint8_t *octal_decoder_final(struct octal_decoder *decoder,
+			     uint8_t *bytes, size_t bytes_size,
+			     size_t *written);
+
 /* * * * * * * * *\
  * Sanity checks *
 \* * * * * * * * */
@@ -59,6 +116,22 @@ _Static_assert(OCTAL_BIT == 3, "Expect 3, but " OCTAL_BIT_SIZE_MSG "?!");
  * implementation *
 \* * * * * * * * */
 #include <assert.h>
+#include <string.h>
+
+/* Whole groups of 3 bytes and 8 digits take a fast path: SSSE3 or AVX2
+ * if the compiler targets them (e.g.: -march=native), otherwise a table
+ * of digit pairs to encode and a 64 bit word at a time to decode. The
+ * partial group at the end, or a non-octal character, take the simple
+ * path, so that the output is the same either way. */
+#ifndef OCTAL_NO_SIMD
+#if defined(__AVX2__)
+#define OCTAL_AVX2 1
+#endif
+#if defined(__SSSE3__)
+#define OCTAL_SSSE3 1
+#include <immintrin.h>
+#endif
+#endif
 
 size_t octal_encode_size_needed_for_string(size_t bytes_len)
 {
@@ -79,6 +152,107 @@ size_t octal_decode_size_needed_for_bytes(size_t octal_str_len, int round_up)
 	return needed;
 }
 
+/* "00" through "77", the digits for each 6 bits */
+static const char octal_pairs[64 * 2 + 1] =
+    "0001020304050607" "1011121314151617" "2021222324252627"
+    "3031323334353637" "4041424344454647" "5051525354555657"
+    "6061626364656667" "7071727374757677";
+
+static void octal_encode_group(char *octal, const uint8_t *bytes)
+{
+	uint32_t b24 = (((uint32_t)bytes[0]) << 16)
+	    | (((uint32_t)bytes[1]) << 8)
+	    | bytes[2];
+	memcpy(octal + 0, octal_pairs + (2 * (0x3F & (b24 >> 18))), 2);
+	memcpy(octal + 2, octal_pairs + (2 * (0x3F & (b24 >> 12))), 2);
+	memcpy(octal + 4, octal_pairs + (2 * (0x3F & (b24 >> 6))), 2);
+	memcpy(octal + 6, octal_pairs + (2 * (0x3F & b24)), 2);
+}
+
+#ifdef OCTAL_SSSE3
+/* Each 16 bit lane gets the two bytes which hold its digit, high byte
+ * first in the group, so the lane is 16 bits of the 24 bit group, then
+ * a multiply moves the digit to the top 3 bits, and a shift down: */
+#define Octal_encode_shuffle(g) \
+	_mm_setr_epi8(1 + (3 * g), 0 + (3 * g), 1 + (3 * g), 0 + (3 * g), \
+		      1 + (3 * g), 0 + (3 * g), 1 + (3 * g), 0 + (3 * g), \
+		      2 + (3 * g), 1 + (3 * g), 2 + (3 * g), 1 + (3 * g), \
+		      2 + (3 * g), 1 + (3 * g), 2 + (3 * g), 1 + (3 * g))
+#define Octal_encode_multipliers() \
+	_mm_setr_epi16(1, 8, 64, 512, 16, 128, 1024, 8192)
+
+static inline __m128i octal_encode_lanes(__m128i in, __m128i shuffle)
+{
+	__m128i lanes = _mm_shuffle_epi8(in, shuffle);
+	lanes = _mm_mullo_epi16(lanes, Octal_encode_multipliers());
+	return _mm_srli_epi16(lanes, 13);
+}
+#endif
+
+#ifdef OCTAL_AVX2
+static inline __m256i octal_encode_lanes256(__m256i in, __m128i shuffle)
+{
+	__m256i both = _mm256_broadcastsi128_si256(shuffle);
+	__m256i lanes = _mm256_shuffle_epi8(in, both);
+	lanes = _mm256_mullo_epi16(lanes,
+				   _mm256_broadcastsi128_si256
+				   (Octal_encode_multipliers()));
+	return _mm256_srli_epi16(lanes, 13);
+}
+#endif
+
+/* encodes the whole groups, returns the number of bytes used */
+static size_t octal_encode_groups(char *octal, const uint8_t *bytes,
+				  size_t bytes_len)
+{
+	size_t i = 0;
+	char *out = octal;
+
+#ifdef OCTAL_AVX2
+	/* 8 groups, reads 28 bytes: 4 groups in each 128 bit lane */
+	const __m256i zeros = _mm256_set1_epi8('0');
+	for (; (bytes_len - i) >= 28; i += 24, out += 64) {
+		__m128i lo = _mm_loadu_si128((const __m128i *)(bytes + i));
+		__m128i hi = _mm_loadu_si128((const __m128i *)(bytes + i + 12));
+		__m256i in = _mm256_set_m128i(hi, lo);
+		__m256i g0 = octal_encode_lanes256(in, Octal_encode_shuffle(0));
+		__m256i g1 = octal_encode_lanes256(in, Octal_encode_shuffle(1));
+		__m256i g2 = octal_encode_lanes256(in, Octal_encode_shuffle(2));
+		__m256i g3 = octal_encode_lanes256(in, Octal_encode_shuffle(3));
+		/* groups 0,1 | 4,5 and 2,3 | 6,7 */
+		__m256i a = _mm256_add_epi8(_mm256_packus_epi16(g0, g1), zeros);
+		__m256i b = _mm256_add_epi8(_mm256_packus_epi16(g2, g3), zeros);
+		_mm256_storeu_si256((__m256i *)out,
+				    _mm256_permute2x128_si256(a, b, 0x20));
+		_mm256_storeu_si256((__m256i *)(out + 32),
+				    _mm256_permute2x128_si256(a, b, 0x31));
+	}
+#endif
+#ifdef OCTAL_SSSE3
+	/* 4 groups, reads 16 bytes */
+	for (; (bytes_len - i) >= 16; i += 12, out += 32) {
+		__m128i in = _mm_loadu_si128((const __m128i *)(bytes + i));
+		__m128i g0 = octal_encode_lanes(in, Octal_encode_shuffle(0));
+		__m128i g1 = octal_encode_lanes(in, Octal_encode_shuffle(1));
+		__m128i g2 = octal_encode_lanes(in, Octal_encode_shuffle(2));
+		__m128i g3 = octal_encode_lanes(in, Octal_encode_shuffle(3));
+		const __m128i zeros = _mm_set1_epi8('0');
+		__m128i a = _mm_add_epi8(_mm_packus_epi16(g0, g1), zeros);
+		__m128i b = _mm_add_epi8(_mm_packus_epi16(g2, g3), zeros);
+		_mm_storeu_si128((__m128i *)out, a);
+		_mm_storeu_si128((__m128i *)(out + 16), b);
+	}
+#endif
+	for (; (bytes_len - i) >= 3; i += 3, out += 8) {
+		octal_encode_group(out, bytes + i);
+	}
+	return i;
+}
+
+static void octal_encode_tail(char *octal, size_t *written,
+			      const uint8_t *bytes, size_t bytes_len,
+			      size_t start);
+
 char *octal_encode(char *octal, size_t octal_size, size_t *written,
 		   const uint8_t *bytes, size_t bytes_len)
 {
@@ -97,7 +271,43 @@ char *octal_encode(char *octal, size_t octal_size, size_t *written,
 		return NULL;
 	}
 
-	for (size_t i = 0; i < bytes_len; i += 3) {
+	size_t i = octal_encode_groups(octal, bytes, bytes_len);
+	*written = (i / 3) * 8;
+	octal_encode_tail(octal, written, bytes, bytes_len, i);
+
+	octal[*written] = '\0';
+	return octal;
+}
+
+char *octal_encode_simple(char *octal, size_t octal_size, size_t *written,
+			  const uint8_t *bytes, size_t bytes_len)
+{
+	assert(octal);
+	assert(octal_size);
+	assert(written);
+	assert(bytes);
+
+	*written = 0;
+
+	size_t needed = octal_encode_size_needed_for_string(bytes_len);
+	if (octal_size < needed) {
+		if (octal_size) {
+			octal[0] = '\0';
+		}
+		return NULL;
+	}
+
+	octal_encode_tail(octal, written, bytes, bytes_len, 0);
+
+	octal[*written] = '\0';
+	return octal;
+}
+
+static void octal_encode_tail(char *octal, size_t *written,
+			      const uint8_t *bytes, size_t bytes_len,
+			      size_t start)
+{
+	for (size_t i = start; i < bytes_len; i += 3) {
 		uint32_t b24 = 0;
 		size_t used = 0;
 		for (size_t j = 0; j < 3; ++j) {
@@ -119,9 +329,6 @@ char *octal_encode(char *octal, size_t octal_size, size_t *written,
 			octal[(*written)++] = coct;
 		}
 	}
-
-	octal[*written] = '\0';
-	return octal;
 }
 
 size_t octal_find_first_nonoctal(const char *octal, size_t octal_size)
@@ -137,6 +344,161 @@ size_t octal_find_first_nonoctal(const char *octal, size_t octal_size)
 	return octal_size;
 }
 
+static uint64_t octal_load_le64(const char *octal)
+{
+	const uint8_t *u = (const uint8_t *)octal;
+	uint64_t x = 0;
+	for (size_t i = 0; i < 8; ++i) {
+		x |= ((uint64_t)u[i]) << (8 * i);
+	}
+	return x;
+}
+
+/* all 8 characters are '0' through '7' */
+static int octal_is_group(uint64_t x)
+{
+	return (x & 0xF8F8F8F8F8F8F8F8ULL) == 0x3030303030303030ULL;
+}
+
+/* the first digit is the lowest byte; digits into pairs, pairs into
+ * quads, quads into the 24 bits */
+static void octal_decode_group(uint8_t *bytes, uint64_t x)
+{
+	const uint64_t m8 = 0x00FF00FF00FF00FFULL;
+	const uint64_t m16 = 0x0000FFFF0000FFFFULL;
+	x &= 0x0707070707070707ULL;
+	x = ((x & m8) << 3) + ((x >> 8) & m8);
+	x = ((x & m16) << 6) + ((x >> 16) & m16);
+	x = ((x & 0xFFFFFFFFULL) << 12) + (x >> 32);
+	bytes[0] = 0xFF & (x >> 16);
+	bytes[1] = 0xFF & (x >> 8);
+	bytes[2] = 0xFF & x;
+}
+
+#ifdef OCTAL_SSSE3
+/* 16 digits to two groups of 24 bits, each in the low of a 64 bit lane */
+static inline __m128i octal_decode_lanes(__m128i digits)
+{
+	__m128i pairs = _mm_maddubs_epi16(digits, _mm_set1_epi16(0x0108));
+	__m128i quads = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00010040));
+	__m128i high = _mm_slli_epi64(_mm_and_si128(quads,
+						    _mm_set1_epi64x
+						    (0xFFFFFFFF)), 12);
+	return _mm_or_si128(high, _mm_srli_epi64(quads, 32));
+}
+
+/* the 3 bytes of each lane, the highest first */
+#define Octal_decode_shuffle_lo() \
+	_mm_setr_epi8(2, 1, 0, 10, 9, 8, -1, -1, \
+		      -1, -1, -1, -1, -1, -1, -1, -1)
+#define Octal_decode_shuffle_hi() \
+	_mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 1, \
+		      0, 10, 9, 8, -1, -1, -1, -1)
+
+static inline int octal_all_digits(__m128i chars)
+{
+	__m128i masked = _mm_and_si128(chars, _mm_set1_epi8((char)0xF8));
+	__m128i eq = _mm_cmpeq_epi8(masked, _mm_set1_epi8('0'));
+	return _mm_movemask_epi8(eq) == 0xFFFF;
+}
+#endif
+
+#ifdef OCTAL_AVX2
+static inline int octal_all_digits256(__m256i chars)
+{
+	__m256i masked = _mm256_and_si256(chars,
+					  _mm256_set1_epi8((char)0xF8));
+	__m256i eq = _mm256_cmpeq_epi8(masked, _mm256_set1_epi8('0'));
+	return _mm256_movemask_epi8(eq) == -1;
+}
+
+static inline __m256i octal_decode_lanes256(__m256i digits)
+{
+	__m256i pairs = _mm256_maddubs_epi16(digits,
+					     _mm256_set1_epi16(0x0108));
+	__m256i quads = _mm256_madd_epi16(pairs,
+					  _mm256_set1_epi32(0x00010040));
+	__m256i high = _mm256_slli_epi64(_mm256_and_si256(quads,
+							  _mm256_set1_epi64x
+							  (0xFFFFFFFF)), 12);
+	return _mm256_or_si256(high, _mm256_srli_epi64(quads, 32));
+}
+#endif
+
+/* decodes whole groups of octal digits, stops before any group with a
+ * non-octal character, returns the number of characters used */
+static size_t octal_decode_groups(uint8_t *bytes, const char *octal,
+				  size_t octal_len)
+{
+	size_t i = 0;
+	uint8_t *out = bytes;
+
+#ifdef OCTAL_AVX2
+	/* 8 groups: 0,1 | 4,5 in one vector and 2,3 | 6,7 in the other,
+	 * so that each 128 bit lane shuffles into 12 bytes in order */
+	for (; (octal_len - i) >= 64; i += 64, out += 24) {
+		const char *in = octal + i;
+		__m256i c0 = _mm256_set_m128i(_mm_loadu_si128((const __m128i *)
+							      (in + 32)),
+					      _mm_loadu_si128((const __m128i *)
+							      in));
+		__m256i c1 = _mm256_set_m128i(_mm_loadu_si128((const __m128i *)
+							      (in + 48)),
+					      _mm_loadu_si128((const __m128i *)
+							      (in + 16)));
+		if (!octal_all_digits256(c0) || !octal_all_digits256(c1)) {
+			break;
+		}
+		const __m256i sevens = _mm256_set1_epi8(0x07);
+		__m256i v0 = octal_decode_lanes256(_mm256_and_si256(c0, sevens));
+		__m256i v1 = octal_decode_lanes256(_mm256_and_si256(c1, sevens));
+		__m256i b = _mm256_or_si256(_mm256_shuffle_epi8(v0,
+			_mm256_broadcastsi128_si256(Octal_decode_shuffle_lo())),
+					    _mm256_shuffle_epi8(v1,
+			_mm256_broadcastsi128_si256(Octal_decode_shuffle_hi())));
+		/* 12 bytes in each lane, make them 24 in a row */
+		b = _mm256_permutevar8x32_epi32(b, _mm256_setr_epi32(0, 1, 2,
+								     4, 5, 6,
+								     7, 7));
+		_mm_storeu_si128((__m128i *)out, _mm256_castsi256_si128(b));
+		_mm_storel_epi64((__m128i *)(out + 16),
+				 _mm256_extracti128_si256(b, 1));
+	}
+#endif
+#ifdef OCTAL_SSSE3
+	/* 4 groups */
+	for (; (octal_len - i) >= 32; i += 32, out += 12) {
+		__m128i c0 = _mm_loadu_si128((const __m128i *)(octal + i));
+		__m128i c1 = _mm_loadu_si128((const __m128i *)(octal + i + 16));
+		if (!octal_all_digits(c0) || !octal_all_digits(c1)) {
+			break;
+		}
+		const __m128i sevens = _mm_set1_epi8(0x07);
+		__m128i v0 = octal_decode_lanes(_mm_and_si128(c0, sevens));
+		__m128i v1 = octal_decode_lanes(_mm_and_si128(c1, sevens));
+		__m128i b = _mm_or_si128(_mm_shuffle_epi8(v0,
+						Octal_decode_shuffle_lo()),
+					 _mm_shuffle_epi8(v1,
+						Octal_decode_shuffle_hi()));
+		_mm_storel_epi64((__m128i *)out, b);
+		uint32_t last4 = (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(b, 8));
+		memcpy(out + 8, &last4, 4);
+	}
+#endif
+	for (; (octal_len - i) >= 8; i += 8, out += 3) {
+		uint64_t x = octal_load_le64(octal + i);
+		if (!octal_is_group(x)) {
+			break;
+		}
+		octal_decode_group(out, x);
+	}
+	return i;
+}
+
+static void octal_decode_tail(uint8_t *bytes, size_t *written,
+			      const char *octal, size_t octal_len,
+			      size_t start);
+
 uint8_t *octal_decode(uint8_t *bytes, size_t bytes_size, size_t *written,
 		      const char *octal, size_t octal_len)
 {
@@ -158,7 +520,43 @@ uint8_t *octal_decode(uint8_t *bytes, size_t bytes_size, size_t *written,
 		}
 	}
 
-	for (size_t i = 0; i < octal_len; i += 8) {
+	size_t i = octal_decode_groups(bytes, octal, octal_len);
+	*written = (i / 8) * 3;
+	octal_decode_tail(bytes, written, octal, octal_len, i);
+	return bytes;
+}
+
+uint8_t *octal_decode_simple(uint8_t *bytes, size_t bytes_size,
+			     size_t *written, const char *octal,
+			     size_t octal_len)
+{
+	assert(bytes);
+	assert(bytes_size);
+	assert(written);
+	assert(octal);
+
+	*written = 0;
+
+	size_t needed = octal_decode_size_needed_for_bytes(octal_len, 0);
+	if (bytes_size < needed) {
+		/* maybe there is enough space if we trim trailing non-octal
+		 * characters, like newlines ? */
+		octal_len = octal_find_first_nonoctal(octal, octal_len);
+		needed = octal_decode_size_needed_for_bytes(octal_len, 0);
+		if (bytes_size < needed) {
+			return NULL;
+		}
+	}
+
+	octal_decode_tail(bytes, written, octal, octal_len, 0);
+	return bytes;
+}
+
+static void octal_decode_tail(uint8_t *bytes, size_t *written,
+			      const char *octal, size_t octal_len,
+			      size_t start)
+{
+	for (size_t i = start; i < octal_len; i += 8) {
 		size_t used = 0;
 		uint32_t b3 = 0;
 		for (size_t j = 0; j < 8; ++j) {
@@ -183,10 +581,161 @@ uint8_t *octal_decode(uint8_t *bytes, size_t bytes_size, size_t *written,
 			bytes[(*written)++] = byte;
 		}
 	}
+}
+
+void octal_encoder_init(struct octal_encoder *encoder)
+{
+	assert(encoder);
+	encoder->pending_len = 0;
+}
+
+size_t octal_encoder_size_needed(const struct octal_encoder *encoder,
+				 size_t bytes_len)
+{
+	return ((encoder->pending_len + bytes_len) / 3) * 8;
+}
+
+char *octal_encoder_update(struct octal_encoder *encoder,
+			   char *octal, size_t octal_size, size_t *written,
+			   const uint8_t *bytes, size_t bytes_len)
+{
+	assert(encoder);
+	assert(octal);
+	assert(written);
+	assert(bytes || !bytes_len);
+
+	*written = 0;
+
+	if (octal_size < octal_encoder_size_needed(encoder, bytes_len)) {
+		return NULL;
+	}
+
+	size_t i = 0;
+	if (encoder->pending_len) {
+		while (encoder->pending_len < 3 && i < bytes_len) {
+			encoder->pending[encoder->pending_len++] = bytes[i++];
+		}
+		if (encoder->pending_len < 3) {
+			return octal;
+		}
+		octal_encode_group(octal, encoder->pending);
+		encoder->pending_len = 0;
+		*written = 8;
+	}
+
+	size_t used = octal_encode_groups(octal + *written, bytes + i,
+					  bytes_len - i);
+	*written += (used / 3) * 8;
+	i += used;
+
+	while (i < bytes_len) {
+		encoder->pending[encoder->pending_len++] = bytes[i++];
+	}
+	return octal;
+}
+
+char *octal_encoder_final(struct octal_encoder *encoder,
+			  char *octal, size_t octal_size, size_t *written)
+{
+	assert(encoder);
+	assert(octal);
+	assert(written);
+
+	*written = 0;
+
+	if (octal_size < (encoder->pending_len * 3)) {
+		return NULL;
+	}
+	octal_encode_tail(octal, written, encoder->pending,
+			  encoder->pending_len, 0);
+	encoder->pending_len = 0;
+	return octal;
+}
+
+void octal_decoder_init(struct octal_decoder *decoder)
+{
+	assert(decoder);
+	decoder->pending_len = 0;
+}
+
+size_t octal_decoder_size_needed(const struct octal_decoder *decoder,
+				 size_t octal_len)
+{
+	return ((decoder->pending_len + octal_len) / 8) * 3;
+}
+
+static int octal_is_space(char c)
+{
+	return c == '\n' || c == '\r' || c == ' ' || c == '\t';
+}
+
+uint8_t *octal_decoder_update(struct octal_decoder *decoder,
+			      uint8_t *bytes, size_t bytes_size,
+			      size_t *written, const char *octal,
+			      size_t octal_len)
+{
+	assert(decoder);
+	assert(bytes);
+	assert(written);
+	assert(octal || !octal_len);
+
+	*written = 0;
+
+	if (bytes_size < octal_decoder_size_needed(decoder, octal_len)) {
+		return NULL;
+	}
+
+	size_t i = 0;
+	while (i < octal_len) {
+		if (!decoder->pending_len) {
+			/* the runs between line breaks at full speed */
+			size_t used = octal_decode_groups(bytes + *written,
+							  octal + i,
+							  octal_len - i);
+			*written += (used / 8) * 3;
+			i += used;
+			if (i == octal_len) {
+				break;
+			}
+		}
+
+		char c = octal[i++];
+		if (c >= '0' && c <= '7') {
+			decoder->pending[decoder->pending_len++] = c;
+		} else if (!octal_is_space(c)) {
+			return NULL;
+		}
+		if (decoder->pending_len == 8) {
+			uint64_t x = octal_load_le64(decoder->pending);
+			octal_decode_group(bytes + *written, x);
+			*written += 3;
+			decoder->pending_len = 0;
+		}
+	}
+	return bytes;
+}
+
+uint8_t *octal_decoder_final(struct octal_decoder *decoder,
+			     uint8_t *bytes, size_t bytes_size,
+			     size_t *written)
+{
+	assert(decoder);
+	assert(bytes);
+	assert(written);
+
+	*written = 0;
+
+	if (bytes_size < 2) {
+		return NULL;
+	}
+	octal_decode_tail(bytes, written, decoder->pending,
+			  decoder->pending_len, 0);
+	decoder->pending_len = 0;
 	return bytes;
 }
 
 /* ***************************************************************** */
+#ifndef OCTAL_BYTES_LIB
 
 /* * * * * * * * *\
  * Demonstration *
@@ -324,8 +873,97 @@ size_t round_trip_string(const char *str)
 	return differ;
 }
 
+#ifndef OCTAL_STREAM_BLOCK_SIZE
+#define OCTAL_STREAM_BLOCK_SIZE (3 * 8 * 64 * 1024)
+#endif
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+	const char *pos = (const char *)buf;
+	while (len) {
+		ssize_t got = write(fd, pos, len);
+		if (got < 0) {
+			perror("write");
+			return -1;
+		}
+		pos += got;
+		len -= got;
+	}
+	return 0;
+}
+
+static ssize_t read_some(int fd, void *buf, size_t len)
+{
+	ssize_t got = read(fd, buf, len);
+	if (got < 0) {
+		perror("read");
+	}
+	return got;
+}
+
+/* a block at a time, in constant memory, whatever the size:
+ * octal-bytes --encode < file > file.octal
+ * octal-bytes --decode < file.octal > file */
+int octal_stream_encode(int in_fd, int out_fd)
+{
+	static uint8_t bytes[OCTAL_STREAM_BLOCK_SIZE];
+	static char octal[((OCTAL_STREAM_BLOCK_SIZE + 2) / 3) * 8];
+	struct octal_encoder encoder;
+	size_t written = 0;
+	ssize_t got;
+
+	octal_encoder_init(&encoder);
+	while ((got = read_some(in_fd, bytes, sizeof(bytes))) > 0) {
+		octal_encoder_update(&encoder, octal, sizeof(octal), &written,
+				     bytes, got);
+		if (write_all(out_fd, octal, written)) {
+			return -1;
+		}
+	}
+	octal_encoder_final(&encoder, octal, sizeof(octal), &written);
+	if (got < 0 || write_all(out_fd, octal, written)) {
+		return -1;
+	}
+	return 0;
+}
+
+int octal_stream_decode(int in_fd, int out_fd)
+{
+	static char octal[OCTAL_STREAM_BLOCK_SIZE];
+	static uint8_t bytes[((OCTAL_STREAM_BLOCK_SIZE + 7) / 8) * 3];
+	struct octal_decoder decoder;
+	size_t written = 0;
+	ssize_t got;
+
+	octal_decoder_init(&decoder);
+	while ((got = read_some(in_fd, octal, sizeof(octal))) > 0) {
+		if (!octal_decoder_update(&decoder, bytes, sizeof(bytes),
+					  &written, octal, got)) {
+			write_all(out_fd, bytes, written);
+			fprintf(stderr, "not octal\n");
+			return -1;
+		}
+		if (write_all(out_fd, bytes, written)) {
+			return -1;
+		}
+	}
+	octal_decoder_final(&decoder, bytes, sizeof(bytes), &written);
+	if (got < 0 || write_all(out_fd, bytes, written)) {
+		return -1;
+	}
+	return 0;
+}
+
 int main(int argc, char **argv)
 {
+	if (argc > 1 && strcmp(argv[1], "--encode") == 0) {
+		return octal_stream_encode(STDIN_FILENO, STDOUT_FILENO)
+		    ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+	if (argc > 1 && strcmp(argv[1], "--decode") == 0) {
+		return octal_stream_decode(STDIN_FILENO, STDOUT_FILENO)
+		    ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
 	if (argc > 1) {
 		return round_trip_string(argv[1]) ? EXIT_FAILURE : EXIT_SUCCESS;
 	}
@@ -340,5 +978,6 @@ int main(int argc, char **argv)
 	}
 }
 #endif
+#endif /* OCTAL_BYTES_LIB */
 Octal__end_C_functions
 #undef Octal__end_C_functions
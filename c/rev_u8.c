@@ -1,15 +1,33 @@
 /* SPDX-License-Identifier: LGPL-3.0-or-later */
 /* rev_u8.c: comparing different ways of inverting bits in a byte */
 /* Copyright (C) 2022 Eric Herman <eric@freesa.org> */
-/*  gcc -Wall -Wextra -g -O3 -DIS_TEST=1 rev_u8.c -o rev_u8 &&
-    { for i in `seq 1000`; do echo $i; ./rev_u8; done } > rev.out &&
-    { for func in \
-      rev_u8_loop rev_u8_ugly rev_u8_8shifts rev_u8_3swaps rev_u8_table; do
-      grep $func rev.out | sort -rn | tail -n10; done } | sort -n
+/*  gcc -Wall -Wextra -g -O3 -DIS_TEST=1 rev_u8.c -o rev_u8 && ./rev_u8
+    # each is timed with microbench.h, the median (+/- the median absolute
+    # deviation) of many samples, per byte, so one run is enough
     # -O3, -Os, -O2 may provide different orderings
+
+    rev_u16, rev_u32, and rev_u64 do the same for wider integers, and
+    rev_bits_buffer for a whole buffer, with a nibble table in pshufb
+    (add -march=native), or rbit on AArch64; the test reports its GB/s.
 */
 
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
+
+#ifndef REV_U8_NO_SIMD
+#if defined(__AVX2__)
+#define REV_U8_AVX2 1
+#endif
+#if defined(__SSSE3__)
+#define REV_U8_SSSE3 1
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#define REV_U8_NEON 1
+#include <arm_neon.h>
+#endif
+#endif
 
 /* rev_u8_loop returns b with the bit-order reversed. */
 uint8_t rev_u8_loop(uint8_t b)
@@ -157,6 +175,168 @@ uint8_t rev_u8_table(uint8_t b)
 	return table[b];
 }
 
+/* rev_u16, rev_u32, and rev_u64 return x with the bit-order reversed:
+ * rev_u8_3swaps on every byte at once, then the bytes reversed */
+uint16_t rev_u16(uint16_t x)
+{
+	x = (uint16_t)(((x & 0xF0F0) >> 4) | ((x & 0x0F0F) << 4));
+	x = (uint16_t)(((x & 0xCCCC) >> 2) | ((x & 0x3333) << 2));
+	x = (uint16_t)(((x & 0xAAAA) >> 1) | ((x & 0x5555) << 1));
+	return __builtin_bswap16(x);
+}
+
+uint32_t rev_u32(uint32_t x)
+{
+	x = ((x & 0xF0F0F0F0UL) >> 4) | ((x & 0x0F0F0F0FUL) << 4);
+	x = ((x & 0xCCCCCCCCUL) >> 2) | ((x & 0x33333333UL) << 2);
+	x = ((x & 0xAAAAAAAAUL) >> 1) | ((x & 0x55555555UL) << 1);
+	return __builtin_bswap32(x);
+}
+
+uint64_t rev_u64(uint64_t x)
+{
+	x = ((x & 0xF0F0F0F0F0F0F0F0ULL) >> 4)
+	    | ((x & 0x0F0F0F0F0F0F0F0FULL) << 4);
+	x = ((x & 0xCCCCCCCCCCCCCCCCULL) >> 2)
+	    | ((x & 0x3333333333333333ULL) << 2);
+	x = ((x & 0xAAAAAAAAAAAAAAAAULL) >> 1)
+	    | ((x & 0x5555555555555555ULL) << 1);
+	return __builtin_bswap64(x);
+}
+
+/* rev_bits_buffer_simple is rev_bits_buffer a byte at a time */
+void rev_bits_buffer_simple(uint8_t *dst, const uint8_t *src, size_t len)
+{
+	for (size_t i = 0, j = len; i < j; ++i, --j) {
+		uint8_t head = src[i];
+		uint8_t tail = src[j - 1];
+		dst[i] = rev_u8_3swaps(tail);
+		dst[j - 1] = rev_u8_3swaps(head);
+	}
+}
+
+#if defined(REV_U8_SSSE3)
+/* each byte of x with its bits reversed, by looking up each nibble,
+ * and the 16 bytes in reverse order */
+static inline __m128i rev_bits_16(__m128i x)
+{
+	const __m128i lo_to_hi = _mm_setr_epi8(0x00, 0x80, 0x40, 0xC0,
+					       0x20, 0xA0, 0x60, 0xE0,
+					       0x10, 0x90, 0x50, 0xD0,
+					       0x30, 0xB0, 0x70, 0xF0);
+	const __m128i hi_to_lo = _mm_setr_epi8(0x0, 0x8, 0x4, 0xC,
+					       0x2, 0xA, 0x6, 0xE,
+					       0x1, 0x9, 0x5, 0xD,
+					       0x3, 0xB, 0x7, 0xF);
+	const __m128i reverse = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8,
+					      7, 6, 5, 4, 3, 2, 1, 0);
+	const __m128i nibble = _mm_set1_epi8(0x0F);
+	__m128i lo = _mm_and_si128(x, nibble);
+	__m128i hi = _mm_and_si128(_mm_srli_epi16(x, 4), nibble);
+	x = _mm_or_si128(_mm_shuffle_epi8(lo_to_hi, lo),
+			 _mm_shuffle_epi8(hi_to_lo, hi));
+	return _mm_shuffle_epi8(x, reverse);
+}
+#endif
+
+#if defined(REV_U8_AVX2)
+static inline __m256i rev_bits_32(__m256i x)
+{
+	const __m256i lo_to_hi = _mm256_setr_epi8(0x00, 0x80, 0x40, 0xC0,
+						  0x20, 0xA0, 0x60, 0xE0,
+						  0x10, 0x90, 0x50, 0xD0,
+						  0x30, 0xB0, 0x70, 0xF0,
+						  0x00, 0x80, 0x40, 0xC0,
+						  0x20, 0xA0, 0x60, 0xE0,
+						  0x10, 0x90, 0x50, 0xD0,
+						  0x30, 0xB0, 0x70, 0xF0);
+	const __m256i hi_to_lo = _mm256_setr_epi8(0x0, 0x8, 0x4, 0xC,
+						  0x2, 0xA, 0x6, 0xE,
+						  0x1, 0x9, 0x5, 0xD,
+						  0x3, 0xB, 0x7, 0xF,
+						  0x0, 0x8, 0x4, 0xC,
+						  0x2, 0xA, 0x6, 0xE,
+						  0x1, 0x9, 0x5, 0xD,
+						  0x3, 0xB, 0x7, 0xF);
+	const __m256i reverse = _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8,
+						 7, 6, 5, 4, 3, 2, 1, 0,
+						 15, 14, 13, 12, 11, 10, 9, 8,
+						 7, 6, 5, 4, 3, 2, 1, 0);
+	const __m256i nibble = _mm256_set1_epi8(0x0F);
+	__m256i lo = _mm256_and_si256(x, nibble);
+	__m256i hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), nibble);
+	x = _mm256_or_si256(_mm256_shuffle_epi8(lo_to_hi, lo),
+			    _mm256_shuffle_epi8(hi_to_lo, hi));
+	/* pshufb reverses within each 128 bit lane, then swap the lanes */
+	x = _mm256_shuffle_epi8(x, reverse);
+	return _mm256_permute4x64_epi64(x, 0x4E);
+}
+#endif
+
+#if defined(REV_U8_NEON)
+/* AArch64 has rbit for each byte, so no nibble table is needed */
+static inline uint8x16_t rev_bits_16(uint8x16_t x)
+{
+	x = vrev64q_u8(vrbitq_u8(x));
+	return vcombine_u8(vget_high_u8(x), vget_low_u8(x));
+}
+#endif
+
+/* rev_bits_buffer reverses the bit-order of the whole buffer, as if it
+ * were one len * 8 bit number: the last bit of src is the first of dst.
+ * dst may be src, but may not otherwise overlap it. It takes a block
+ * from each end at a time, so that reading both before writing either
+ * makes it safe in place. */
+void rev_bits_buffer(uint8_t *dst, const uint8_t *src, size_t len)
+{
+	size_t i = 0;
+	size_t j = len;
+#if defined(REV_U8_AVX2)
+	while ((j - i) >= 64) {
+		__m256i head = _mm256_loadu_si256((const __m256i *)(src + i));
+		__m256i tail = _mm256_loadu_si256((const __m256i *)
+						  (src + j - 32));
+		_mm256_storeu_si256((__m256i *)(dst + i), rev_bits_32(tail));
+		_mm256_storeu_si256((__m256i *)(dst + j - 32),
+				    rev_bits_32(head));
+		i += 32;
+		j -= 32;
+	}
+#endif
+#if defined(REV_U8_SSSE3)
+	while ((j - i) >= 32) {
+		__m128i head = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i tail = _mm_loadu_si128((const __m128i *)(src + j - 16));
+		_mm_storeu_si128((__m128i *)(dst + i), rev_bits_16(tail));
+		_mm_storeu_si128((__m128i *)(dst + j - 16), rev_bits_16(head));
+		i += 16;
+		j -= 16;
+	}
+#elif defined(REV_U8_NEON)
+	while ((j - i) >= 32) {
+		uint8x16_t head = vld1q_u8(src + i);
+		uint8x16_t tail = vld1q_u8(src + j - 16);
+		vst1q_u8(dst + i, rev_bits_16(tail));
+		vst1q_u8(dst + j - 16, rev_bits_16(head));
+		i += 16;
+		j -= 16;
+	}
+#endif
+	/* a 64 bit word from each end; the same in either byte order */
+	while ((j - i) >= 16) {
+		uint64_t head, tail;
+		memcpy(&head, src + i, 8);
+		memcpy(&tail, src + j - 8, 8);
+		head = rev_u64(head);
+		tail = rev_u64(tail);
+		memcpy(dst + i, &tail, 8);
+		memcpy(dst + j - 8, &head, 8);
+		i += 8;
+		j -= 8;
+	}
+	rev_bits_buffer_simple(dst + i, src + i, j - i);
+}
+
 #ifndef TEST_EXHAUSTIVE
 #define TEST_EXHAUSTIVE 0
 #endif
@@ -249,7 +429,8 @@ void (*log_eol)(void *context) = NULL;
 
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
+
+#include "microbench.h"
 
 char *byte_to_bitstr(char *buf, uint8_t b)
 {
@@ -290,6 +471,90 @@ unsigned check_equals_u8(int line, uint8_t a, uint8_t b)
 
 #define Check_equals_u8(a, b) check_equals_u8(__LINE__, a, b)
 
+unsigned check_equals_u64(int line, uint64_t a, uint64_t b)
+{
+	if (a == b) {
+		return 0;
+	}
+	log_s(log_context(), "FAIL ");
+	log_u(log_context(), line);
+	log_s(log_context(), ": ");
+	log_u(log_context(), a);
+	log_s(log_context(), " != ");
+	log_u(log_context(), b);
+	log_eol(log_context());
+	return 1;
+}
+
+#define Check_equals_u64(a, b) check_equals_u64(__LINE__, a, b)
+
+#ifndef REV_BITS_CHECK_LEN
+#define REV_BITS_CHECK_LEN 160
+#endif
+
+/* every length, out of place and in place, against rev_u8_loop */
+unsigned check_rev_bits_buffer(void)
+{
+	uint8_t src[REV_BITS_CHECK_LEN];
+	uint8_t want[REV_BITS_CHECK_LEN];
+	uint8_t got[REV_BITS_CHECK_LEN + 1];
+	unsigned failures = 0;
+	for (size_t i = 0; i < REV_BITS_CHECK_LEN; ++i) {
+		src[i] = (uint8_t)((i * 167) + 13);
+	}
+	for (size_t len = 0; len <= REV_BITS_CHECK_LEN; ++len) {
+		for (size_t i = 0; i < len; ++i) {
+			want[i] = rev_u8_loop(src[len - 1 - i]);
+		}
+		got[len] = 0xA5;
+		rev_bits_buffer(got, src, len);
+		failures += (memcmp(got, want, len) != 0);
+		failures += Check_equals_u8(got[len], 0xA5);
+		memcpy(got, src, len);
+		rev_bits_buffer(got, got, len);
+		failures += (memcmp(got, want, len) != 0);
+		rev_bits_buffer_simple(got, src, len);
+		failures += (memcmp(got, want, len) != 0);
+		if (failures) {
+			log_s(log_context(), "FAIL rev_bits_buffer len ");
+			log_u(log_context(), len);
+			log_eol(log_context());
+			return failures;
+		}
+	}
+	return failures;
+}
+
+/* rev_u16 for every value; rev_u32 and rev_u64 by their halves, which
+ * rev_u16 and rev_u32 have been checked for */
+unsigned check_exhaustive_wide(void)
+{
+	unsigned failures = 0;
+	for (uint32_t i = 0; i <= 0xFFFF; ++i) {
+		uint16_t x = (uint16_t)i;
+		uint16_t want = (uint16_t)((rev_u8_table(x & 0xFF) << 8)
+					   | rev_u8_table(x >> 8));
+		failures += Check_equals_u64(rev_u16(x), want);
+		failures += Check_equals_u64(rev_u16(rev_u16(x)), x);
+
+		uint32_t y = i * 0x9E3779B9UL;
+		uint32_t want32 = ((uint32_t)rev_u16(y & 0xFFFF) << 16)
+		    | rev_u16(y >> 16);
+		failures += Check_equals_u64(rev_u32(y), want32);
+		failures += Check_equals_u64(rev_u32(rev_u32(y)), y);
+
+		uint64_t z = i * 0x9E3779B97F4A7C15ULL;
+		uint64_t want64 = ((uint64_t)rev_u32(z & 0xFFFFFFFF) << 32)
+		    | rev_u32(z >> 32);
+		failures += Check_equals_u64(rev_u64(z), want64);
+		failures += Check_equals_u64(rev_u64(rev_u64(z)), z);
+		if (failures) {
+			return failures;
+		}
+	}
+	return failures + check_rev_bits_buffer();
+}
+
 unsigned check_exhaustive(void)
 {
 	unsigned failures = 0;
@@ -333,44 +598,115 @@ unsigned check_exhaustive(void)
 		failures += Check_equals_u8(r2, r3);
 		failures += Check_equals_u8(r3, r4);
 	}
+	failures += check_exhaustive_wide();
 	return failures;
 }
 
-clock_t system_start = 0;
+/* each calls its rev_u8 function directly, so that it may be inlined,
+ * as it would be in real use; the byte is hidden from the optimizer */
+#define Rev_u8_bench(rev_func) \
+void bench_ ## rev_func(void *context, size_t iterations) \
+{ \
+	uint8_t a = 0; \
+	for (size_t i = 0; i < iterations; ++i) { \
+		uint8_t b = (uint8_t)i; \
+		Microbench_do_not_optimize(b); \
+		a += rev_func(b); \
+	} \
+	*(uint8_t *)context += a; \
+}
+
+Rev_u8_bench(rev_u8_loop)
+Rev_u8_bench(rev_u8_ugly)
+Rev_u8_bench(rev_u8_8shifts)
+Rev_u8_bench(rev_u8_3swaps)
+Rev_u8_bench(rev_u8_table)
 
-clock_t count_clocks(uint8_t (*rev_func)(uint8_t), size_t cycles)
+/* log_u only prints whole numbers, so this prints hundredths */
+void print_hundredths(double value)
 {
-	size_t a = 0;
-	clock_t start = (clock() - system_start);
-	for (size_t i = 0; i < cycles; ++i) {
-		uint8_t b = i & 0xFF;
-		a += rev_func(b);
-	}
-	clock_t end = (clock() - system_start);
+	uint64_t hundredths = (uint64_t)((value * 100) + 0.5);
+	log_u(log_context(), hundredths / 100);
+	log_s(log_context(), ((hundredths % 100) < 10) ? ".0" : ".");
+	log_u(log_context(), hundredths % 100);
+}
 
-	if (Check_equals_u8(a > 0 ? 1 : 0, 1)) {
-		log_s(log_context(), "cycles = ");
-		log_u(log_context(), cycles);
-		log_s(log_context(), ", unexpected 'a' of 0");
-		log_eol(log_context());
-	}
-	return (end - start);
+void print_bench(const struct microbench *bench, const char *label)
+{
+	print_hundredths(bench->ns_median);
+	log_s(log_context(), " ns (+/- ");
+	print_hundredths(bench->ns_mad);
+	log_s(log_context(), ")\t");
+	print_hundredths(bench->cycles_median);
+	log_s(log_context(), " cycles\t: ");
+	log_s(log_context(), label);
+	log_eol(log_context());
 }
 
-void print_clocks(clock_t clocks, const char *label)
+void run_rev_u8_bench(microbench_func func, const char *label,
+		      size_t samples)
 {
-	log_u(log_context(), clocks);
-	log_s(log_context(), "\t: ");
+	struct microbench bench = Microbench_init;
+	uint8_t sum = 0;
+	bench.samples = samples;
+	microbench_run(&bench, func, &sum);
+	Microbench_do_not_optimize(sum);
+	print_bench(&bench, label);
+}
+
+#ifndef REV_BITS_BENCH_LEN
+#ifdef ARDUINO
+#define REV_BITS_BENCH_LEN 256
+#else
+#define REV_BITS_BENCH_LEN (16 * 1024)
+#endif
+#endif
+
+static uint8_t rev_bits_bench_buf[REV_BITS_BENCH_LEN];
+
+/* in place, twice, so the buffer ends each iteration as it began */
+#define Rev_bits_bench(rev_func) \
+void bench_ ## rev_func(void *context, size_t iterations) \
+{ \
+	(void)context; \
+	for (size_t i = 0; i < iterations; ++i) { \
+		rev_func(rev_bits_bench_buf, rev_bits_bench_buf, \
+			 REV_BITS_BENCH_LEN); \
+		rev_func(rev_bits_bench_buf, rev_bits_bench_buf, \
+			 REV_BITS_BENCH_LEN); \
+	} \
+}
+
+Rev_bits_bench(rev_bits_buffer_simple)
+Rev_bits_bench(rev_bits_buffer)
+
+unsigned run_rev_bits_bench(microbench_func func, const char *label,
+			    size_t samples)
+{
+	static uint8_t orig[REV_BITS_BENCH_LEN];
+	for (size_t i = 0; i < REV_BITS_BENCH_LEN; ++i) {
+		orig[i] = (uint8_t)((i * 167) + 13);
+	}
+	memcpy(rev_bits_bench_buf, orig, REV_BITS_BENCH_LEN);
+
+	struct microbench bench = Microbench_init;
+	bench.samples = samples;
+	microbench_run(&bench, func, NULL);
+
+	/* bytes per ns is GB/s */
+	print_hundredths((2.0 * REV_BITS_BENCH_LEN) / bench.ns_median);
+	log_s(log_context(), " GB/s\t: ");
 	log_s(log_context(), label);
 	log_eol(log_context());
+	return Check_equals_u8(memcmp(rev_bits_bench_buf, orig,
+				      REV_BITS_BENCH_LEN) ? 1 : 0, 0);
 }
 
-int main_loop(size_t outer_cycles, size_t inner_cycles)
+/* samples of 0 is the microbench.h default */
+int main_loop(size_t samples)
 {
 	unsigned failures = 0;
 
-	system_start = clock();
-
 	failures += Check_equals_u8(0xF0, rev_u8_loop(0x0F));
 	failures += Check_equals_u8(0xF0, rev_u8_ugly(0x0F));
 	failures += Check_equals_u8(0xF0, rev_u8_3swaps(0x0F));
@@ -389,29 +725,26 @@ int main_loop(size_t outer_cycles, size_t inner_cycles)
 	failures += Check_equals_u8(0xAA, rev_u8_8shifts(0x55));
 	failures += Check_equals_u8(0xAA, rev_u8_table(0x55));
 
+	failures += Check_equals_u64(0x8000, rev_u16(0x0001));
+	failures += Check_equals_u64(0x0F0F0F0F, rev_u32(0xF0F0F0F0));
+	failures += Check_equals_u64(0x8000000000000001ULL,
+				     rev_u64(0x8000000000000001ULL));
+	failures += Check_equals_u64(0x1ULL << 63, rev_u64(0x1));
+
 	if (TEST_EXHAUSTIVE) {
 		failures += check_exhaustive();
 	}
 
-	clock_t clocks_loop = 0;
-	clock_t clocks_ugly = 0;
-	clock_t clocks_straight = 0;
-	clock_t clocks_3swaps = 0;
-	clock_t clocks_table = 0;
-
-	for (size_t i = 0; i < outer_cycles; ++i) {
-		clocks_loop += count_clocks(rev_u8_loop, inner_cycles);
-		clocks_ugly += count_clocks(rev_u8_ugly, inner_cycles);
-		clocks_straight += count_clocks(rev_u8_8shifts, inner_cycles);
-		clocks_3swaps += count_clocks(rev_u8_3swaps, inner_cycles);
-		clocks_table += count_clocks(rev_u8_table, inner_cycles);
-	}
+	run_rev_u8_bench(bench_rev_u8_loop, "rev_u8_loop", samples);
+	run_rev_u8_bench(bench_rev_u8_ugly, "rev_u8_ugly", samples);
+	run_rev_u8_bench(bench_rev_u8_8shifts, "rev_u8_8shifts", samples);
+	run_rev_u8_bench(bench_rev_u8_3swaps, "rev_u8_3swaps", samples);
+	run_rev_u8_bench(bench_rev_u8_table, "rev_u8_table", samples);
 
-	print_clocks(clocks_loop, "rev_u8_loop");
-	print_clocks(clocks_ugly, "rev_u8_ugly");
-	print_clocks(clocks_straight, "rev_u8_8shifts");
-	print_clocks(clocks_3swaps, "rev_u8_3swaps");
-	print_clocks(clocks_table, "rev_u8_table");
+	failures += run_rev_bits_bench(bench_rev_bits_buffer_simple,
+				       "rev_bits_buffer_simple", samples);
+	failures += run_rev_bits_bench(bench_rev_bits_buffer,
+				       "rev_bits_buffer", samples);
 
 	return failures ? 1 : 0;
 }
@@ -425,18 +758,16 @@ void setup(void)
 
 void loop(void)
 {
-	size_t outer_cycles = 100;
-	size_t inner_cycles = 100;
-	main_loop(outer_cycles, inner_cycles);
+	size_t samples = 5;
+	main_loop(samples);
 	delay(1000);
 	Serial.println();
 }
 #else
 int main(void)
 {
-	size_t outer_cycles = 1000;
-	size_t inner_cycles = 1000;
-	return main_loop(outer_cycles, inner_cycles);
+	size_t samples = 0;
+	return main_loop(samples);
 }
 #endif
 #endif
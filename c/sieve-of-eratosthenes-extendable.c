@@ -0,0 +1,298 @@
+/* sieve-of-eratosthenes-extendable.c : primes, sieved on demand
+   Copyright (C) 2018 Eric Herman <eric@freesa.org>
+   License: LGPL v2.1 or any later version */
+
+/* gcc -g -Wall -Werror -O2 -DNDEBUG \
+	-o sieve-of-eratosthenes-extendable \
+	sieve-of-eratosthenes-extendable.c
+*/
+
+/*
+   Unlike sieve-of-eratosthenes.c, the max does not need to be known up
+   front. When is_prime() is asked about a number beyond what has been
+   sieved, only the new range is sieved, one cache-sized segment at a
+   time, using the base primes which were already found. The bitmap is
+   grown geometrically, and nothing which was sieved before is touched
+   again.
+
+   ./sieve-of-eratosthenes-extendable 97 1000003 10000019
+*/
+
+#include <assert.h>
+#include <inttypes.h>		/* PRIu64, SCNu64 */
+#include <limits.h>		/* CHAR_BIT */
+#include <stdint.h>		/* uint64_t */
+#include <stdio.h>		/* printf, sscanf */
+#include <stdlib.h>		/* malloc, realloc, free */
+#include <string.h>		/* memset */
+
+/* numbers per segment: two per bit, as only odd numbers are stored */
+#ifndef SIEVE_SEGMENT_BYTES
+#define SIEVE_SEGMENT_BYTES (32 * 1024)
+#endif
+#define Sieve_segment_numbers ((uint64_t)SIEVE_SEGMENT_BYTES * CHAR_BIT * 2)
+
+struct sieve_s {
+	/* all numbers <= max have been sieved */
+	uint64_t max;
+
+	/* bit i is set if (2i + 3) is prime */
+	unsigned char *primes;
+	size_t primes_size;
+
+	/* odd primes found so far which are used for sieving new segments */
+	uint64_t *base_primes;
+	size_t base_primes_len;
+	size_t base_primes_size;
+	uint64_t base_primes_max;
+
+	/* statistics */
+	size_t segments_sieved;
+	size_t grow_count;
+};
+
+static uint64_t primes_index(uint64_t number)
+{
+	return (number - 3) / 2;
+}
+
+static unsigned get_bit(const unsigned char *bytes, uint64_t index)
+{
+	return (bytes[index / CHAR_BIT] >> (index % CHAR_BIT)) & 1U;
+}
+
+static void clear_bit(unsigned char *bytes, uint64_t index)
+{
+	bytes[index / CHAR_BIT] &= ~(1U << (index % CHAR_BIT));
+}
+
+static uint64_t isqrt_u64(uint64_t n)
+{
+	uint64_t r = 0;
+	uint64_t bit = ((uint64_t)1) << 62;
+
+	while (bit > n) {
+		bit >>= 2;
+	}
+	while (bit) {
+		if (n >= r + bit) {
+			n -= r + bit;
+			r = (r >> 1) + bit;
+		} else {
+			r >>= 1;
+		}
+		bit >>= 2;
+	}
+	return r;
+}
+
+void sieve_init(struct sieve_s *sieve)
+{
+	memset(sieve, 0x00, sizeof(struct sieve_s));
+	sieve->max = 2;
+	sieve->base_primes_max = 2;
+}
+
+void sieve_free(struct sieve_s *sieve)
+{
+	free(sieve->primes);
+	free(sieve->base_primes);
+	sieve_init(sieve);
+}
+
+/* grow the bitmap so that it can hold bits up to number, new bits are
+   set (that is, presumed prime) so that sieving only needs to clear */
+static int sieve_reserve(struct sieve_s *sieve, uint64_t number)
+{
+	size_t needed = (primes_index(number) / CHAR_BIT) + 1;
+	if (needed <= sieve->primes_size) {
+		return 0;
+	}
+
+	size_t size = sieve->primes_size ? sieve->primes_size : 64;
+	while (size < needed) {
+		size *= 2;
+	}
+	unsigned char *primes = realloc(sieve->primes, size);
+	if (!primes) {
+		fprintf(stderr, "failed to realloc %zu bytes?\n", size);
+		return 1;
+	}
+	memset(primes + sieve->primes_size, -1, size - sieve->primes_size);
+	sieve->primes = primes;
+	sieve->primes_size = size;
+	++sieve->grow_count;
+	return 0;
+}
+
+/* collect odd primes up to limit from the already sieved bitmap, only
+   scanning the part which has not been scanned before */
+static int sieve_collect_base_primes(struct sieve_s *sieve, uint64_t limit)
+{
+	assert(limit <= sieve->max);
+
+	for (uint64_t n = sieve->base_primes_max + 1; n <= limit; ++n) {
+		if (!(n % 2) || !get_bit(sieve->primes, primes_index(n))) {
+			continue;
+		}
+		if (sieve->base_primes_len == sieve->base_primes_size) {
+			size_t size = sieve->base_primes_size ?
+			    sieve->base_primes_size * 2 : 64;
+			uint64_t *base = realloc(sieve->base_primes,
+						 size * sizeof(uint64_t));
+			if (!base) {
+				fprintf(stderr, "failed to realloc %zu?\n",
+					size * sizeof(uint64_t));
+				return 1;
+			}
+			sieve->base_primes = base;
+			sieve->base_primes_size = size;
+		}
+		sieve->base_primes[sieve->base_primes_len++] = n;
+	}
+	if (limit > sieve->base_primes_max) {
+		sieve->base_primes_max = limit;
+	}
+	return 0;
+}
+
+/* sieve the numbers in [lo, hi], all primes <= sqrt(hi) must be known */
+static void sieve_segment(struct sieve_s *sieve, uint64_t lo, uint64_t hi)
+{
+	uint64_t root = isqrt_u64(hi);
+
+	for (size_t i = 0; i < sieve->base_primes_len; ++i) {
+		uint64_t p = sieve->base_primes[i];
+		if (p > root) {
+			break;
+		}
+		/* first odd multiple of p in the segment, but not below p*p */
+		uint64_t j = p * p;
+		if (j < lo) {
+			j = ((lo + p - 1) / p) * p;
+			if (!(j % 2)) {
+				j += p;
+			}
+		}
+		for (; j <= hi; j += 2 * p) {
+			clear_bit(sieve->primes, primes_index(j));
+		}
+	}
+	++sieve->segments_sieved;
+}
+
+/* extend the sieve to at least number, sieving whole segments */
+int sieve_extend(struct sieve_s *sieve, uint64_t number)
+{
+	if (number <= sieve->max) {
+		return 0;
+	}
+
+	/* round up to the end of a segment, so that a series of small
+	   increases does not pay for a pass over the base primes each */
+	uint64_t target = number - (number % Sieve_segment_numbers);
+	target += Sieve_segment_numbers - 1;
+	if (target < number) {
+		target = UINT64_MAX;
+	}
+
+	if (sieve_reserve(sieve, target)) {
+		return 1;
+	}
+
+	while (sieve->max < target) {
+		uint64_t lo = sieve->max + 1;
+		uint64_t hi = lo + Sieve_segment_numbers - 1;
+		if (hi < lo || hi > target) {
+			hi = target;
+		}
+		/* primes up to sqrt(hi) must already be sieved */
+		uint64_t max_hi = (sieve->max > UINT32_MAX) ? UINT64_MAX
+		    : sieve->max * sieve->max;
+		if (hi > max_hi) {
+			hi = max_hi;
+		}
+		if (sieve_collect_base_primes(sieve, isqrt_u64(hi))) {
+			return 1;
+		}
+		sieve_segment(sieve, lo, hi);
+		sieve->max = hi;
+	}
+	return 0;
+}
+
+int is_prime(struct sieve_s *sieve, uint64_t number)
+{
+	if (number < 2) {
+		return 0;
+	}
+	if (number == 2) {
+		return 1;
+	}
+	if ((number % 2) == 0) {
+		return 0;
+	}
+	if (number > sieve->max && sieve_extend(sieve, number)) {
+		return -1;
+	}
+	return get_bit(sieve->primes, primes_index(number)) ? 1 : 0;
+}
+
+#ifndef NDEBUG
+static int is_prime_trial_division(uint64_t number)
+{
+	if (number < 2) {
+		return 0;
+	}
+	for (uint64_t d = 2; d * d <= number; ++d) {
+		if (!(number % d)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+#endif
+
+int main(int argc, char **argv)
+{
+	struct sieve_s sieve;
+	uint64_t n;
+	int rv;
+
+	sieve_init(&sieve);
+
+	if (argc < 2) {
+		/* with no arguments, ask about ever-larger numbers */
+		for (n = 0; n <= 100; ++n) {
+			rv = is_prime(&sieve, n);
+			assert(rv == is_prime_trial_division(n));
+			if (rv) {
+				printf("%" PRIu64 "\n", n);
+			}
+		}
+#ifndef NDEBUG
+		for (n = 101; n < (3 * Sieve_segment_numbers); n += 7919) {
+			assert(is_prime(&sieve, n)
+			       == is_prime_trial_division(n));
+		}
+#endif
+	}
+
+	for (int i = 1; i < argc; ++i) {
+		n = 0;
+		sscanf(argv[i], "%" SCNu64 "", &n);
+		rv = is_prime(&sieve, n);
+		if (rv < 0) {
+			sieve_free(&sieve);
+			return 1;
+		}
+		printf("%" PRIu64 " %s (sieved to %" PRIu64 ", %zu segments,"
+		       " %zu base primes, bitmap grown %zu times)\n", n,
+		       rv ? "is prime" : "is not prime", sieve.max,
+		       sieve.segments_sieved, sieve.base_primes_len,
+		       sieve.grow_count);
+	}
+
+	sieve_free(&sieve);
+	return 0;
+}
@@ -0,0 +1,204 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2026 Eric Herman <eric@freesa.org> */
+
+/* z-string-bench.c : z_string_new and z_string_delete per string,
+ * versus z_string_arena_str_new and a z_string_arena_reset per request,
+ * and building a 1 MB string from 10 byte pieces with strcat, with
+ * z_string_append, and with z_string_appendf
+ *
+ * cc -O2 -DNDEBUG c/z-string-bench.c -o z-string-bench
+ * ./z-string-bench [strings_per_request]
+ */
+
+#define Z_STRING_LIB 1
+#include "z-string.c"
+
+#include <stdio.h>
+
+#include "microbench.h"
+
+#ifndef Z_STRING_BENCH_MAX_STRINGS
+#define Z_STRING_BENCH_MAX_STRINGS 65536
+#endif
+
+static char *strs[Z_STRING_BENCH_MAX_STRINGS];
+
+/* short strings, of 4 to 63 characters, like headers and parameters */
+static const char *sample_string(size_t i)
+{
+	static const char text[] =
+	    "Accept-Language: en-US,en;q=0.9,nl;q=0.8 Connection: keep-alive";
+	return text + (sizeof(text) - 1) - (4 + ((i * 7919) % 60));
+}
+
+static size_t sum_strings(size_t n)
+{
+	size_t sum = 0;
+	for (size_t i = 0; i < n; ++i) {
+		sum += (unsigned char)strs[i][0] + z_string_max_len(strs[i]);
+	}
+	return sum;
+}
+
+/* one request's strings, each allocated and freed on its own */
+static size_t request_calloc(size_t r, size_t per_request)
+{
+	for (size_t i = 0; i < per_request; ++i) {
+		strs[i] = z_string_new(sample_string(r + i));
+	}
+	size_t sum = sum_strings(per_request);
+	for (size_t i = 0; i < per_request; ++i) {
+		z_string_delete(&strs[i]);
+	}
+	return sum;
+}
+
+/* one request's strings, from the arena, which is then reset */
+static size_t request_arena(struct z_string_arena *arena, size_t r,
+			    size_t per_request)
+{
+	for (size_t i = 0; i < per_request; ++i) {
+		strs[i] = z_string_arena_str_new(arena, sample_string(r + i));
+	}
+	size_t sum = sum_strings(per_request);
+	z_string_arena_reset(arena);
+	return sum;
+}
+
+struct request_bench {
+	struct z_string_arena *arena;	/* NULL for calloc */
+	size_t per_request;
+	size_t sum;
+};
+
+/* an iteration is one request */
+static void bench_requests(void *context, size_t iterations)
+{
+	struct request_bench *rb = context;
+	for (size_t r = 0; r < iterations; ++r) {
+		rb->sum += rb->arena ? request_arena(rb->arena, r,
+						     rb->per_request)
+		    : request_calloc(r, rb->per_request);
+	}
+	Microbench_do_not_optimize(rb->sum);
+}
+
+#ifndef Z_STRING_BENCH_BUILD_LEN
+#define Z_STRING_BENCH_BUILD_LEN (1024 * 1024)
+#endif
+
+static const char piece[] = "0123456789";
+
+/* the usual way: a fixed buffer, and strcat, which walks the string */
+static size_t build_strcat(void)
+{
+	char *buf = z_string_size_new(Z_STRING_BENCH_BUILD_LEN, NULL);
+	size_t len = 0;
+	while (len + (sizeof(piece) - 1) <= Z_STRING_BENCH_BUILD_LEN) {
+		strcat(buf, piece);
+		len = strlen(buf);
+	}
+	z_string_delete(&buf);
+	return len;
+}
+
+static size_t build_append(void)
+{
+	char *buf = z_string_new("");
+	while (z_string_len(buf) + (sizeof(piece) - 1)
+	       <= Z_STRING_BENCH_BUILD_LEN) {
+		if (z_string_append(&buf, piece)) {
+			exit(EXIT_FAILURE);
+		}
+	}
+	size_t len = z_string_len(buf);
+	z_string_delete(&buf);
+	return len;
+}
+
+static size_t build_appendf(void)
+{
+	char *buf = z_string_new("");
+	unsigned i = 0;
+	while (z_string_len(buf) + 10 <= Z_STRING_BENCH_BUILD_LEN) {
+		if (z_string_appendf(&buf, "%010u", i++)) {
+			exit(EXIT_FAILURE);
+		}
+	}
+	size_t len = z_string_len(buf);
+	z_string_delete(&buf);
+	return len;
+}
+
+struct build_bench {
+	size_t (*build)(void);
+	size_t len;
+};
+
+/* an iteration builds the whole string */
+static void bench_build_run(void *context, size_t iterations)
+{
+	struct build_bench *bb = context;
+	for (size_t i = 0; i < iterations; ++i) {
+		bb->len = bb->build();
+		Microbench_do_not_optimize(bb->len);
+	}
+}
+
+static void bench_build(const char *name, size_t (*build)(void))
+{
+	struct build_bench bb = { build, 0 };
+	struct microbench bench = Microbench_init;
+	/* strcat takes most of a second */
+	bench.samples = 3;
+	microbench_run(&bench, bench_build_run, &bb);
+	printf("%-18s %8zu bytes %10.3f ms %8.2f ns per piece\n", name,
+	       bb.len, bench.ns_median / 1e6, bench.ns_median / (bb.len / 10));
+}
+
+int main(int argc, char **argv)
+{
+	size_t per_request = (argc > 1) ? strtoul(argv[1], NULL, 10) : 1000;
+
+	if (per_request > Z_STRING_BENCH_MAX_STRINGS) {
+		per_request = Z_STRING_BENCH_MAX_STRINGS;
+	}
+
+	struct z_string_arena *arena = z_string_arena_new(0);
+	if (!arena) {
+		return EXIT_FAILURE;
+	}
+	for (size_t r = 0; r < 100; ++r) {
+		size_t calloc_sum = request_calloc(r, per_request);
+		size_t arena_sum = request_arena(arena, r, per_request);
+		if (calloc_sum != arena_sum) {
+			fprintf(stderr, "sums differ: %zu != %zu\n",
+				calloc_sum, arena_sum);
+			return EXIT_FAILURE;
+		}
+	}
+
+	struct request_bench calloc_rb = { NULL, per_request, 0 };
+	struct request_bench arena_rb = { arena, per_request, 0 };
+	struct microbench calloc_bench = Microbench_init;
+	struct microbench arena_bench = Microbench_init;
+	microbench_run(&calloc_bench, bench_requests, &calloc_rb);
+	microbench_run(&arena_bench, bench_requests, &arena_rb);
+	z_string_arena_delete(&arena);
+
+	printf("requests of %zu strings, %zu requests per sample\n",
+	       per_request, arena_bench.iterations);
+	printf("calloc: %8.2f ns per string\n",
+	       calloc_bench.ns_median / per_request);
+	printf("arena:  %8.2f ns per string (%.1fx)\n",
+	       arena_bench.ns_median / per_request,
+	       calloc_bench.ns_median / arena_bench.ns_median);
+
+	printf("\nbuilding %d bytes from %zu byte pieces\n",
+	       Z_STRING_BENCH_BUILD_LEN, sizeof(piece) - 1);
+	bench_build("strcat:", build_strcat);
+	bench_build("z_string_append:", build_append);
+	bench_build("z_string_appendf:", build_appendf);
+
+	return EXIT_SUCCESS;
+}
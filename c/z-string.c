@@ -17,19 +17,35 @@
  * `const char **` and thus is declared to take a `void *` which can
  * be compile-time checked to be of one of these two types.
  *
- * z_string buffers have the declared max_len at the front of the
- * allocated buffer, followed by the zero-terminated string. The pointer
- * returned from z_string_new is just the zero-terminated string
- * portion, so the other functions look in front of the zero-terminated
- * string to find the declared size.
+ * z_string buffers have a small header at the front of the allocated
+ * buffer, followed by the zero-terminated string. The pointer returned
+ * from z_string_new is just the zero-terminated string portion, so the
+ * other functions look in front of the zero-terminated string to find
+ * the header. The header records the arena the string came from (if
+ * any), the current length, and the declared max_len, which is last,
+ * so that it is still directly in front of the string.
  *
  * The size can be read with the z_string_max_len function, which
  * returns the space available for character content; the space
  * available is exclusive of the extra space which was allocated for the
- * NULL terminator and the max_len information.
+ * NULL terminator and the header.
+ *
+ * The length is kept up to date by z_string_append and
+ * z_string_appendf, which grow the buffer geometrically when it is
+ * full (so the pointer may change), and can be read with z_string_len
+ * without a strlen. Code which writes into the buffer directly, as with
+ * any `char *`, should call z_string_len_update afterwards.
  *
  * If a string is provided to the constructor, the buffer will be filled
  * with the contents of that string.
+ *
+ * Many short-lived z_strings can instead come from a z_string_arena,
+ * which bump-allocates them from large blocks, and frees them all at
+ * once with z_string_arena_reset. Arena strings have the same header,
+ * and z_string_delete on one only sets the pointer to NULL.
+ *
+ * To compare the arena with the calloc path, and appending:
+ * cc -O2 c/z-string-bench.c -o z-string-bench && ./z-string-bench
  */
 
 #ifndef Z_STRING_H
@@ -86,16 +102,61 @@ void z_string_delete_ref(void *ref);
  * provided. */
 size_t z_string_max_len(const char *str);
 
+/* Returns the length of the string, as of the last z_string function
+ * which changed it; O(1). */
+size_t z_string_len(const char *str);
+
+/* Records the length of a string which was written to directly, and
+ * returns it. */
+size_t z_string_len_update(char *str);
+
+/* Appends `str` to the z_string `*ref`, growing it if need be, in which
+ * case `*ref` is changed to the new buffer. Returns 0 on success, or -1
+ * if the buffer could not grow, leaving `*ref` as it was. */
+int z_string_append(char **ref, const char *str);
+
+/* Like `z_string_append`, but appends the printf-style output. */
+int z_string_appendf(char **ref, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/* An arena of z_strings, see z_string_arena_new. */
+struct z_string_arena;
+
+/* Returns an arena which takes blocks of `block_size` bytes (or a
+ * default size, if 0) from `z_string_calloc` as it needs them.
+ * The arena must be freed with `z_string_arena_delete`. */
+struct z_string_arena *z_string_arena_new(size_t block_size);
+
+/* Like `z_string_size_new`, but allocated from the arena, and zeroed.
+ * The string lives until the arena is reset or deleted; passing it to
+ * `z_string_delete` only sets the pointer to NULL. Appending to it
+ * takes a new buffer from the arena. */
+char *z_string_arena_size_new(struct z_string_arena *arena, size_t max_len,
+			      const char *str);
+
+/* Returns a copy of the string passed in, allocated from the arena. */
+#define z_string_arena_str_new(arena, str) \
+	z_string_arena_size_new(arena, str ? strlen(str) : 0, str)
+
+/* Frees every string allocated from the arena at once. One block is
+ * kept, so that the next round of strings need not allocate. */
+void z_string_arena_reset(struct z_string_arena *arena);
+
+/* Frees the arena and all of its strings, and sets `*arena` to NULL. */
+void z_string_arena_delete(struct z_string_arena **arena);
+
 /* *************************************************************** */
 /* Memory allocation function pointers used by z_string functions, */
-/* which default to `stdlib.h` `calloc` and `free`.
+/* which default to `stdlib.h` `calloc`, `realloc` and `free`.
  * Can be customized, but are global. */
 extern void *(*z_string_calloc)(size_t nmemb, size_t size);
+extern void *(*z_string_realloc)(void *ptr, size_t size);
 extern void (*z_string_free)(void *ptr);
 
 #endif /* Z_STRING_H */
 
 /* z-string-demo.c */
+#ifndef Z_STRING_LIB
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -126,44 +187,87 @@ int main(void)
 	assert(s2);
 	printf("s2 == '%s'\n", s2);
 	printf("z_string_max_len(s2) == %zu\n", z_string_max_len(s2));
+	printf("strcpy(s2, \"abc\"); z_string_len_update(s2);\n");
+	strcpy(s2, "abc");
+	z_string_len_update(s2);
+	for (int i = 0; i < 20; ++i) {
+		z_string_appendf(&s2, "-%d", i);
+	}
+	printf("s2 == '%s'\n", s2);
+	printf("z_string_len(s2) == %zu\n", z_string_len(s2));
+	printf("z_string_max_len(s2) == %zu\n", z_string_max_len(s2));
 	printf("z_string_delete(&s2);\n");
 	z_string_delete(&s2);
 	printf("s2 == '%s'\n", s2);
 	assert(!s2);
 
+	printf("\n");
+
+	printf("struct z_string_arena *arena = z_string_arena_new(0);\n");
+	struct z_string_arena *arena = z_string_arena_new(0);
+	assert(arena);
+	printf("char *s3 = z_string_arena_str_new(arena, \"bar\");\n");
+	char *s3 = z_string_arena_str_new(arena, "bar");
+	printf("char *s4 = z_string_arena_size_new(arena, 20, \"baz\");\n");
+	char *s4 = z_string_arena_size_new(arena, 20, "baz");
+	assert(s3 && s4);
+	printf("s3 == '%s', s4 == '%s'\n", s3, s4);
+	printf("z_string_max_len(s3) == %zu\n", z_string_max_len(s3));
+	printf("z_string_max_len(s4) == %zu\n", z_string_max_len(s4));
+	printf("z_string_append(&s4, \"-qux\");\n");
+	z_string_append(&s4, "-qux");
+	printf("z_string_appendf(&s4, \" %%d\", 42);\n");
+	z_string_appendf(&s4, " %d", 42);
+	printf("s4 == '%s', z_string_len(s4) == %zu\n", s4, z_string_len(s4));
+	printf("z_string_arena_reset(arena); /* frees s3 and s4 */\n");
+	z_string_arena_reset(arena);
+	printf("z_string_arena_delete(&arena);\n");
+	z_string_arena_delete(&arena);
+	assert(!arena);
+
 	return EXIT_SUCCESS;
 }
+#endif /* Z_STRING_LIB */
 
 /* z-string.c */
 #include <assert.h>
+#include <stdarg.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 void *(*z_string_calloc)(size_t nmemb, size_t size) = calloc;
+void *(*z_string_realloc)(void *ptr, size_t size) = realloc;
 void (*z_string_free)(void *ptr) = free;
 void *(*z_string_memcpy)(void *restrict dest, const void *restrict src,
 			 size_t n) = memcpy;
 
-char *z_string_size_new(size_t max_len, const char *str)
-{
-	assert(max_len < (SIZE_MAX - (sizeof(size_t) + 1)));
+struct z_string_header {
+	struct z_string_arena *arena;	/* NULL if from z_string_calloc */
+	size_t len;
+	size_t max_len;		/* last, so it is just before the string */
+};
 
-	/* allocate enough space for to record the size and the NULL */
-	const size_t buf_size = sizeof(size_t) + max_len + 1;
-	size_t *buf = (size_t *)z_string_calloc(1, buf_size);
-	if (!buf) {
-		return NULL;
-	}
+#define Z_string_max_max_len \
+	(SIZE_MAX - (sizeof(struct z_string_header) + sizeof(size_t) + 1))
 
-	/* record the size in the start of the buffer */
-	buf[0] = max_len;
+static struct z_string_header *z_string_header(const char *str)
+{
+	/* the header is directly in front of the string */
+	return ((struct z_string_header *)str) - 1;
+}
 
-	/* advance the buffer past the size data */
-	size_t *remainder = &(buf[1]);
+/* fills in a zeroed buffer, returns the string portion */
+static char *z_string_init(struct z_string_header *header,
+			   struct z_string_arena *arena, size_t max_len,
+			   const char *str)
+{
+	header->arena = arena;
+	header->max_len = max_len;
 
-	/* cast to a string that can be return to the caller */
-	char *s = (char *)remainder;
+	/* advance the buffer past the header data */
+	char *s = (char *)&(header[1]);
 
 	/* copy the contents in, if provied */
 	if (str) {
@@ -172,11 +276,25 @@ char *z_string_size_new(size_t max_len, const char *str)
 			len = max_len;
 		}
 		z_string_memcpy(s, str, len);
+		header->len = len;
 	}
-
 	return s;
 }
 
+char *z_string_size_new(size_t max_len, const char *str)
+{
+	assert(max_len < Z_string_max_max_len);
+
+	/* allocate enough space for the header and the NULL */
+	const size_t buf_size = sizeof(struct z_string_header) + max_len + 1;
+	struct z_string_header *header;
+	header = (struct z_string_header *)z_string_calloc(1, buf_size);
+	if (!header) {
+		return NULL;
+	}
+	return z_string_init(header, NULL, max_len, str);
+}
+
 void z_string_delete_ref(void *ref)
 {
 	/* cast to a pointer to char pointer */
@@ -185,14 +303,13 @@ void z_string_delete_ref(void *ref)
 	/* extract the char pointer that was allocated by z_string_size_new */
 	const char *str = *pstr;
 
-	/* cast to a size_t pointer so we can go index by size_t sizes */
-	size_t *remainder = (size_t *)str;
-
-	/* go backwards one to get to the location of the original buffer */
-	size_t *buf = &(remainder[-1]);
+	/* go backwards to get to the location of the original buffer */
+	struct z_string_header *header = z_string_header(str);
 
-	/* free the buffer that was allocated */
-	z_string_free(buf);
+	/* free the buffer that was allocated, arenas free theirs in bulk */
+	if (!header->arena) {
+		z_string_free(header);
+	}
 
 	/* set the pointer to NULL, since it is no longer valid */
 	*pstr = NULL;
@@ -203,7 +320,7 @@ size_t z_string_max_len(const char *str)
 	/* cast to a size_t pointer so we can go index by size_t sizes */
 	const size_t *remainder = (const size_t *)str;
 
-	/* go backwards one to get to the location of the original buffer */
+	/* go backwards one to get to the max_len, the last of the header */
 	const size_t *buf = &(remainder[-1]);
 
 	/* extract the size data that was stored there */
@@ -211,3 +328,243 @@ size_t z_string_max_len(const char *str)
 
 	return max_len;
 }
+
+size_t z_string_len(const char *str)
+{
+	return z_string_header(str)->len;
+}
+
+size_t z_string_len_update(char *str)
+{
+	struct z_string_header *header = z_string_header(str);
+	const char *end = memchr(str, '\0', header->max_len);
+	header->len = end ? (size_t)(end - str) : header->max_len;
+	return header->len;
+}
+
+/* makes room for at least `len` characters, doubling the buffer */
+static int z_string_reserve(char **ref, size_t len)
+{
+	struct z_string_header *header = z_string_header(*ref);
+	if (len <= header->max_len) {
+		return 0;
+	}
+
+	size_t max_len = header->max_len * 2;
+	if (max_len < len) {
+		max_len = len;
+	}
+	if (max_len < 16) {
+		max_len = 16;
+	}
+	if (max_len >= Z_string_max_max_len) {
+		if (len >= Z_string_max_max_len) {
+			return -1;
+		}
+		max_len = len;
+	}
+
+	if (header->arena) {
+		/* the old buffer stays in the arena until it is reset */
+		char *s = z_string_arena_size_new(header->arena, max_len, NULL);
+		if (!s) {
+			return -1;
+		}
+		z_string_memcpy(s, *ref, header->len);
+		z_string_header(s)->len = header->len;
+		*ref = s;
+		return 0;
+	}
+
+	size_t old_size = sizeof(struct z_string_header) + header->max_len + 1;
+	size_t buf_size = sizeof(struct z_string_header) + max_len + 1;
+	header = (struct z_string_header *)z_string_realloc(header, buf_size);
+	if (!header) {
+		return -1;
+	}
+	/* as if from calloc, like the rest of the buffer */
+	memset(((char *)header) + old_size, 0x00, buf_size - old_size);
+	header->max_len = max_len;
+	*ref = (char *)&(header[1]);
+	return 0;
+}
+
+int z_string_append(char **ref, const char *str)
+{
+	size_t len = strlen(str);
+	size_t old_len = z_string_len(*ref);
+
+	if (len > (Z_string_max_max_len - old_len)) {
+		return -1;
+	}
+	if (z_string_reserve(ref, old_len + len)) {
+		return -1;
+	}
+	z_string_memcpy(*ref + old_len, str, len);
+	(*ref)[old_len + len] = '\0';
+	z_string_header(*ref)->len = old_len + len;
+	return 0;
+}
+
+int z_string_appendf(char **ref, const char *format, ...)
+{
+	struct z_string_header *header = z_string_header(*ref);
+	size_t old_len = header->len;
+	size_t avail = header->max_len - old_len;
+	va_list ap;
+
+	va_start(ap, format);
+	int rv = vsnprintf(*ref + old_len, avail + 1, format, ap);
+	va_end(ap);
+	if (rv < 0) {
+		(*ref)[old_len] = '\0';
+		return -1;
+	}
+
+	size_t len = (size_t)rv;
+	if (len > avail) {
+		/* it did not fit; grow, then print it again */
+		if (len > (Z_string_max_max_len - old_len)
+		    || z_string_reserve(ref, old_len + len)) {
+			(*ref)[old_len] = '\0';
+			return -1;
+		}
+		va_start(ap, format);
+		vsnprintf(*ref + old_len, len + 1, format, ap);
+		va_end(ap);
+	}
+	z_string_header(*ref)->len = old_len + len;
+	return 0;
+}
+
+/* z-string-arena.c */
+#ifndef Z_STRING_ARENA_BLOCK_SIZE
+#define Z_STRING_ARENA_BLOCK_SIZE (64 * 1024)
+#endif
+
+struct z_string_arena_block {
+	struct z_string_arena_block *next;
+	size_t size;		/* including this header */
+};
+
+struct z_string_arena {
+	/* the block strings are currently bumped from is the first */
+	struct z_string_arena_block *blocks;
+	char *pos;
+	char *end;
+	size_t block_size;
+};
+
+struct z_string_arena *z_string_arena_new(size_t block_size)
+{
+	struct z_string_arena *arena;
+
+	arena = (struct z_string_arena *)
+	    z_string_calloc(1, sizeof(struct z_string_arena));
+	if (!arena) {
+		return NULL;
+	}
+	arena->block_size = block_size ? block_size : Z_STRING_ARENA_BLOCK_SIZE;
+	return arena;
+}
+
+static struct z_string_arena_block *z_string_arena_block_new(size_t size)
+{
+	struct z_string_arena_block *block;
+
+	block = (struct z_string_arena_block *)z_string_calloc(1, size);
+	if (block) {
+		block->size = size;
+	}
+	return block;
+}
+
+char *z_string_arena_size_new(struct z_string_arena *arena, size_t max_len,
+			      const char *str)
+{
+	const size_t header = sizeof(struct z_string_arena_block);
+	const size_t align = sizeof(size_t);
+
+	assert(arena);
+	assert(max_len < (Z_string_max_max_len - (header + align)));
+
+	/* the same layout as z_string_size_new: header, then the string */
+	size_t buf_size = sizeof(struct z_string_header) + max_len + 1;
+
+	uintptr_t pos = (uintptr_t)arena->pos;
+	pos = (pos + (align - 1)) & ~((uintptr_t)(align - 1));
+	struct z_string_header *buf;
+	if (arena->pos && pos <= (uintptr_t)arena->end
+	    && buf_size <= (size_t)((uintptr_t)arena->end - pos)) {
+		buf = (struct z_string_header *)pos;
+		arena->pos = ((char *)buf) + buf_size;
+		/* a reset arena hands out memory which was used before */
+		memset(buf, 0x00, buf_size);
+	} else if (buf_size > (arena->block_size / 4)) {
+		/* big strings get a block of their own, behind the current
+		 * one, so that what is left of the current is not wasted */
+		struct z_string_arena_block *block;
+		block = z_string_arena_block_new(header + buf_size);
+		if (!block) {
+			return NULL;
+		}
+		if (arena->blocks) {
+			block->next = arena->blocks->next;
+			arena->blocks->next = block;
+		} else {
+			/* nothing to bump from yet, keep pos NULL */
+			arena->blocks = block;
+		}
+		buf = (struct z_string_header *)(((char *)block) + header);
+	} else {
+		struct z_string_arena_block *block;
+		block = z_string_arena_block_new(arena->block_size);
+		if (!block) {
+			return NULL;
+		}
+		block->next = arena->blocks;
+		arena->blocks = block;
+		buf = (struct z_string_header *)(((char *)block) + header);
+		arena->pos = ((char *)buf) + buf_size;
+		arena->end = ((char *)block) + block->size;
+	}
+
+	return z_string_init(buf, arena, max_len, str);
+}
+
+void z_string_arena_reset(struct z_string_arena *arena)
+{
+	struct z_string_arena_block *keep = NULL;
+	struct z_string_arena_block *block = arena->blocks;
+
+	while (block) {
+		struct z_string_arena_block *next = block->next;
+		if (!keep && block->size == arena->block_size) {
+			keep = block;
+		} else {
+			z_string_free(block);
+		}
+		block = next;
+	}
+
+	arena->blocks = keep;
+	if (keep) {
+		keep->next = NULL;
+		arena->pos = ((char *)keep) + sizeof(struct z_string_arena_block);
+		arena->end = ((char *)keep) + keep->size;
+	} else {
+		arena->pos = NULL;
+		arena->end = NULL;
+	}
+}
+
+void z_string_arena_delete(struct z_string_arena **arena)
+{
+	if (!*arena) {
+		return;
+	}
+	z_string_arena_reset(*arena);
+	z_string_free((*arena)->blocks);
+	z_string_free(*arena);
+	*arena = NULL;
+}